@@ -0,0 +1,437 @@
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+#include <zstack/ZCL.h>
+#include <zstack/ZStack.h>
+#include <zstack/ZStackPosixPort.h>
+
+#define BENCH_CHANNEL                       11
+#define BENCH_PANID                         0x1234
+#define BENCH_FRAMES                        20000  // frames in every generated stream
+#define BENCH_BATCH                         16     // frames fed between event drains, below event pool size
+#define BENCH_RUNS                          5      // best run is reported
+#define BENCH_SEED                          42
+#define BENCH_DRAIN_TIMEOUT                 1000   // ms to wait for event workers to go idle before the run is marked as failed
+#define BENCH_IDLE_TIME                     2000   // ms idle ZStack on POSIX port is left alone while its CPU time is taken
+#define BENCH_LATENCY_FRAMES                2000   // frames written one by one to POSIX port for receive to callback latency
+
+// host benchmark for input and output hot paths, usage: bench
+// every result is printed as one JSON object per line, times are best of BENCH_RUNS runs
+//
+// parseInput is timed in batches, event workers are drained between batches outside of timed
+// region, so results are the input task cost of framing, device index update and event posting,
+// drain waits for the event pool to be idle, so late or dropped events do not shift between batches
+//
+// posixPort runs second ZStack on real ZStackPosixPort over socketpair, it reports process CPU time used while
+// nothing arrives and latency from write on the other end to messageReceived callback
+
+class BenchPort : public ZStackPort
+{
+    public:
+
+        bool begin(void) override
+        {
+            return true;
+        }
+
+        size_t read(uint8_t *, size_t, uint32_t timeout) override
+        {
+            zstackDelay(timeout < 100 ? timeout : 100);
+            return 0;
+        }
+
+        size_t write(const uint8_t *, size_t length) override
+        {
+            return length;
+        }
+
+        bool reset(void) override
+        {
+            return true;
+        }
+
+};
+
+struct batchStruct
+{
+    std::vector <uint8_t> data;
+    std::vector <size_t> chunks;
+};
+
+struct reportStruct
+{
+    uint16_t clusterId;
+    std::vector <uint8_t> payload;
+};
+
+static std::atomic <uint32_t> posixEvents(0);
+static std::atomic <uint64_t> posixTime(0);
+static ZStack *posixStack;
+static volatile uint64_t sink;
+
+static uint64_t clockTime(clockid_t clock)
+{
+    timespec time;
+    clock_gettime(clock, &time);
+    return static_cast <uint64_t> (time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+static uint64_t now(void)
+{
+    return clockTime(CLOCK_MONOTONIC);
+}
+
+static void zstackCallback(ZStack *zstack, ZStackEvent event, void *, size_t)
+{
+    if (event != ZStackEvent::messageReceived || zstack != posixStack)
+        return;
+
+    posixTime = now();
+    posixEvents++;
+}
+
+static void result(const char *name, size_t frames, size_t bytes, uint64_t time)
+{
+    printf("{\"name\": \"%s\", \"frames\": %zu, \"bytes\": %zu, \"nsPerFrame\": %.1f, \"framesPerSec\": %.0f, \"mbPerSec\": %.2f}\n", name, frames, bytes, static_cast <double> (time) / frames, frames * 1e9 / time, bytes * 1e3 / time);
+    fflush(stdout);
+}
+
+static void appendAttribute(std::vector <uint8_t> &payload, uint16_t id, uint8_t dataType, uint32_t value)
+{
+    payload.push_back(static_cast <uint8_t> (id));
+    payload.push_back(static_cast <uint8_t> (id >> 8));
+    payload.push_back(dataType);
+
+    for (uint8_t i = 0; i < zclDataSize(dataType); i++)
+        payload.push_back(static_cast <uint8_t> (value >> (i * 8)));
+}
+
+// typical sensor and plug reports, ZCL header included
+static std::vector <reportStruct> reportMix(void)
+{
+    std::vector <reportStruct> reports;
+    reportStruct report;
+    const char *model = "lumi.sensor_ht.agl02";
+
+    report = {CLUSTER_POWER_CONFIGURATION, {0x18, 0x00, CMD_REPORT_ATTRIBUTES}};
+    appendAttribute(report.payload, 0x0020, DATA_TYPE_8BIT_UNSIGNED, 29);
+    appendAttribute(report.payload, 0x0021, DATA_TYPE_8BIT_UNSIGNED, 164);
+    reports.push_back(report);
+
+    report = {CLUSTER_TEMPERATURE_MEASUREMENT, {0x18, 0x00, CMD_REPORT_ATTRIBUTES}};
+    appendAttribute(report.payload, 0x0000, DATA_TYPE_16BIT_SIGNED, 2143);
+    reports.push_back(report);
+
+    report = {0x0405, {0x18, 0x00, CMD_REPORT_ATTRIBUTES}};
+    appendAttribute(report.payload, 0x0000, DATA_TYPE_16BIT_UNSIGNED, 5120);
+    reports.push_back(report);
+
+    report = {0x0006, {0x18, 0x00, CMD_REPORT_ATTRIBUTES}};
+    appendAttribute(report.payload, 0x0000, DATA_TYPE_BOOLEAN, 1);
+    reports.push_back(report);
+
+    report = {0x0B04, {0x18, 0x00, CMD_REPORT_ATTRIBUTES}};
+    appendAttribute(report.payload, 0x0505, DATA_TYPE_16BIT_UNSIGNED, 231);
+    appendAttribute(report.payload, 0x0508, DATA_TYPE_16BIT_UNSIGNED, 1250);
+    appendAttribute(report.payload, 0x050B, DATA_TYPE_16BIT_SIGNED, 287);
+    reports.push_back(report);
+
+    report = {0x0000, {0x1C, 0x5F, 0x11, 0x00, CMD_REPORT_ATTRIBUTES}};
+    report.payload.insert(report.payload.end(), {0x05, 0x00, DATA_TYPE_CHARACTER_STRING, static_cast <uint8_t> (strlen(model))});
+    report.payload.insert(report.payload.end(), model, model + strlen(model));
+    appendAttribute(report.payload, 0x0001, DATA_TYPE_8BIT_UNSIGNED, 3);
+    reports.push_back(report);
+
+    return reports;
+}
+
+static std::vector <uint8_t> incomingMessage(const reportStruct &report, uint16_t shortAddress)
+{
+    incomingMessageStruct message = {0x0000, report.clusterId, shortAddress, 0x01, 0x01, 0x00, 0x60, 0x00, 0x00000000, 0x00, static_cast <uint8_t> (report.payload.size())};
+    std::vector <uint8_t> data(reinterpret_cast <uint8_t*> (&message), reinterpret_cast <uint8_t*> (&message) + sizeof(message)), frame(ZSTACK_TX_RING_SIZE);
+    frameSegmentStruct segment;
+
+    data.insert(data.end(), report.payload.begin(), report.payload.end());
+    data.insert(data.end(), {0x00, 0x00, 0x00});
+    segment = {data.data(), data.size()};
+    frame.resize(ZStack::encodeFrame(AF_INCOMING_MSG, &segment, 1, frame.data(), frame.size(), 0));
+    return frame;
+}
+
+// corrupted streams flip one byte in every tenth frame and put line noise before every twentieth, split streams are fed in 1 to 32 byte reads
+static std::vector <batchStruct> stream(const std::vector <reportStruct> &reports, bool corrupted, bool split)
+{
+    std::vector <batchStruct> batches(BENCH_FRAMES / BENCH_BATCH);
+
+    for (size_t i = 0; i < batches.size(); i++)
+    {
+        batchStruct &batch = batches[i];
+
+        for (size_t j = 0; j < BENCH_BATCH; j++)
+        {
+            std::vector <uint8_t> frame = incomingMessage(reports[rand() % reports.size()], static_cast <uint16_t> (0x1000 + rand() % 64));
+
+            if (corrupted && rand() % 20 == 0)
+                for (int k = rand() % 8 + 1; k; k--)
+                    batch.data.push_back(static_cast <uint8_t> (rand()));
+
+            if (corrupted && rand() % 10 == 0)
+                frame[1 + rand() % (frame.size() - 1)] ^= static_cast <uint8_t> (rand() % 255 + 1);
+
+            batch.data.insert(batch.data.end(), frame.begin(), frame.end());
+        }
+
+        if (!split)
+        {
+            batch.chunks.push_back(batch.data.size());
+            continue;
+        }
+
+        for (size_t offset = 0; offset < batch.data.size();)
+        {
+            size_t chunk = rand() % 32 + 1;
+
+            if (chunk > batch.data.size() - offset)
+                chunk = batch.data.size() - offset;
+
+            batch.chunks.push_back(chunk);
+            offset += chunk;
+        }
+    }
+
+    return batches;
+}
+
+static bool drain(ZStack *zstack)
+{
+    uint32_t start = zstackMillis();
+
+    while (zstack->pendingEvents())
+    {
+        if (zstackMillis() - start > BENCH_DRAIN_TIMEOUT)
+            return false;
+
+        sched_yield();
+    }
+
+    return true;
+}
+
+static void benchParseInput(ZStack *zstack, const char *name, std::vector <batchStruct> batches)
+{
+    uint64_t best = UINT64_MAX;
+    size_t bytes = 0;
+
+    // untimed pass warms up device index and event pool, corrupted length may keep partial frame
+    // in the input ring till next batch, so timed runs start from the same ring state
+    for (size_t i = 0; i < batches.size(); i++)
+    {
+        size_t offset = 0;
+
+        for (size_t j = 0; j < batches[i].chunks.size(); offset += batches[i].chunks[j++])
+            zstack->parseInput(batches[i].data.data() + offset, batches[i].chunks[j]);
+
+        bytes += batches[i].data.size();
+        drain(zstack);
+    }
+
+    for (uint8_t run = 0; run < BENCH_RUNS; run++)
+    {
+        uint64_t time = 0;
+
+        for (size_t i = 0; i < batches.size(); i++)
+        {
+            uint64_t start = now();
+            size_t offset = 0;
+
+            for (size_t j = 0; j < batches[i].chunks.size(); offset += batches[i].chunks[j++])
+                zstack->parseInput(batches[i].data.data() + offset, batches[i].chunks[j]);
+
+            time += now() - start;
+
+            if (!drain(zstack))
+            {
+                fprintf(stderr, "%s: event workers did not catch up\n", name);
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        if (best > time)
+            best = time;
+    }
+
+    result(name, batches.size() * BENCH_BATCH, bytes, best);
+}
+
+static void benchEncodeFrame(const std::vector <reportStruct> &reports)
+{
+    uint8_t ring[ZSTACK_TX_RING_SIZE], data[ZSTACK_BUFFER_SIZE - ZSTACK_MINIMAL_LENGTH];
+    uint64_t best = UINT64_MAX;
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = static_cast <uint8_t> (rand());
+
+    for (uint8_t run = 0; run < BENCH_RUNS; run++)
+    {
+        uint64_t start = now();
+
+        bytes = 0;
+
+        // data request sized frames, same lengths as reports carried in AF_DATA_REQUEST, written into
+        // TX ring sized buffer the way sendFrame does, so frames wrap at its end as they do there
+        for (size_t i = 0; i < BENCH_FRAMES; i++)
+        {
+            frameSegmentStruct segment = {data, sizeof(dataRequestStruct) + reports[i % reports.size()].payload.size()};
+            bytes += ZStack::encodeFrame(AF_DATA_REQUEST, &segment, 1, ring, sizeof(ring), bytes);
+        }
+
+        sink += ring[bytes % sizeof(ring)];
+        start = now() - start;
+
+        if (best > start)
+            best = start;
+    }
+
+    result("encodeFrame", BENCH_FRAMES, bytes, best);
+}
+
+// same steps as zclMessage and parseAttributesReport in ESP32 example, without printing
+static size_t zclMessage(const uint8_t *data, size_t length)
+{
+    uint8_t frameControl = data[0], commandId = data[2];
+    size_t offset = 3, count = 0;
+
+    if (frameControl & FC_MANUFACTURER_SPECIFIC)
+    {
+        commandId = data[4];
+        offset = 5;
+    }
+
+    if (frameControl & FC_CLUSTER_SPECIFIC || commandId != CMD_REPORT_ATTRIBUTES)
+        return 0;
+
+    for (const zclAttributeStruct &attribute : ZCLAttributes(data + offset, length - offset))
+    {
+        if (attribute.dataType == DATA_TYPE_CHARACTER_STRING)
+            sink += attribute.size;
+        else
+            sink += static_cast <uint64_t> (attribute.numericValue());
+
+        count++;
+    }
+
+    return count;
+}
+
+static void benchZclMessage(const std::vector <reportStruct> &reports)
+{
+    std::vector <size_t> mix(BENCH_FRAMES);
+    uint64_t best = UINT64_MAX;
+    size_t bytes = 0, attributes = 0;
+
+    for (size_t i = 0; i < mix.size(); i++)
+    {
+        mix[i] = rand() % reports.size();
+        bytes += reports[mix[i]].payload.size();
+    }
+
+    for (uint8_t run = 0; run < BENCH_RUNS; run++)
+    {
+        uint64_t start = now();
+
+        attributes = 0;
+
+        for (size_t i = 0; i < mix.size(); i++)
+            attributes += zclMessage(reports[mix[i]].payload.data(), reports[mix[i]].payload.size());
+
+        start = now() - start;
+
+        if (best > start)
+            best = start;
+    }
+
+    result("zclMessage", BENCH_FRAMES, bytes, best);
+    printf("{\"name\": \"zclAttribute\", \"attributes\": %zu, \"nsPerAttribute\": %.1f}\n", attributes, static_cast <double> (best) / attributes);
+}
+
+static void benchPosixPort(const std::vector <reportStruct> &reports)
+{
+    std::vector <uint8_t> frame = incomingMessage(reports[0], 0x1000);
+    uint64_t cpu, time, total = 0, worst = 0;
+    int fd[2];
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
+    {
+        perror("socketpair");
+        exit(EXIT_FAILURE);
+    }
+
+    // never deleted either, ZNP side is never answering, so startup requests time out in the background
+    posixStack = new ZStack(new ZStackPosixPort(fd[0]), zstackCallback, BENCH_CHANNEL, BENCH_PANID);
+    posixStack->start();
+    zstackDelay(100);
+
+    cpu = clockTime(CLOCK_PROCESS_CPUTIME_ID);
+    time = now();
+    zstackDelay(BENCH_IDLE_TIME);
+    cpu = clockTime(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+    time = now() - time;
+
+    printf("{\"name\": \"posixPortIdle\", \"ms\": %.0f, \"cpuMs\": %.2f, \"cpuPercent\": %.3f}\n", time / 1e6, cpu / 1e6, cpu * 100.0 / time);
+
+    for (size_t i = 0; i < BENCH_LATENCY_FRAMES; i++)
+    {
+        uint32_t count = posixEvents, start = zstackMillis();
+
+        time = now();
+
+        if (::write(fd[1], frame.data(), frame.size()) != static_cast <ssize_t> (frame.size()))
+        {
+            perror("write");
+            exit(EXIT_FAILURE);
+        }
+
+        while (posixEvents == count)
+        {
+            if (zstackMillis() - start > BENCH_DRAIN_TIMEOUT)
+            {
+                fprintf(stderr, "posixPort: frame %zu was not received\n", i);
+                exit(EXIT_FAILURE);
+            }
+
+            sched_yield();
+        }
+
+        time = posixTime - time;
+        total += time;
+
+        if (worst < time)
+            worst = time;
+    }
+
+    printf("{\"name\": \"posixPortLatency\", \"frames\": %d, \"usMean\": %.1f, \"usMax\": %.1f}\n", BENCH_LATENCY_FRAMES, total / 1e3 / BENCH_LATENCY_FRAMES, worst / 1e3);
+    fflush(stdout);
+}
+
+int main(void)
+{
+    // never deleted, ZStack tasks never return
+    ZStack *zstack = new ZStack(new BenchPort, zstackCallback, BENCH_CHANNEL, BENCH_PANID);
+    zstack->start();
+    std::vector <reportStruct> reports = reportMix();
+
+    srand(BENCH_SEED);
+
+    benchParseInput(zstack, "parseInputClean", stream(reports, false, false));
+    benchParseInput(zstack, "parseInputCorrupted", stream(reports, true, false));
+    benchParseInput(zstack, "parseInputSplit", stream(reports, false, true));
+    benchEncodeFrame(reports);
+    benchZclMessage(reports);
+    benchPosixPort(reports);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,332 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zstack/ZCLSchema.h>
+#include <zstack/ZStack.h>
+#include <zstack/ZStackAttributes.h>
+#include <zstack/ZStackCapture.h>
+#include <zstack/ZStackOta.h>
+#include <zstack/ZStackPosixPort.h>
+#include <zstack/ZStackProvisioning.h>
+#include <zstack/ZStackReader.h>
+#include <zstack/ZStackShards.h>
+
+#define ZSTACK_CHANNEL                      11     // every next coordinator is 5 channels and one PAN ID further
+#define ZSTACK_PANID                        0x1234
+#define ZSTACK_GROUP_ID                     0x0001 // coordinator endpoint joins it to receive group addressed commands
+#define TEMPERATURE_DEADBAND                10     // 0.1 °C
+#define METRICS_INTERVAL                    60     // seconds between metrics dumps
+
+// host build of the coordinator, usage: zstack [serial devices or pty] [capture file] [OTA image], without device pty is created and its slave path printed,
+// use "-" as device to capture pty traffic and "-" as capture file to skip it, capture file can be replayed with replay tool
+//
+// comma separated devices run one coordinator each, devices are spread over them by the shard layer,
+// capture records the first one only, OTA image is offered to every provisioned device
+
+typedef ZCLAttribute <0x0020, DATA_TYPE_8BIT_UNSIGNED, std::ratio <1, 10>>  batteryVoltage;
+typedef ZCLAttribute <0x0021, DATA_TYPE_8BIT_UNSIGNED, std::ratio <1, 2>>   batteryPercentage;
+typedef ZCLAttribute <0x0000, DATA_TYPE_16BIT_SIGNED,  std::ratio <1, 100>> temperature;
+
+typedef ZCLCluster <CLUSTER_POWER_CONFIGURATION,     true, batteryVoltage, batteryPercentage> powerConfiguration;
+typedef ZCLCluster <CLUSTER_TEMPERATURE_MEASUREMENT, true, temperature>                       temperatureMeasurement;
+
+typedef ZCLSchema <0x01, powerConfiguration, temperatureMeasurement> schema;
+
+// battery values are reported on change only, so provisioned device is read once to get them
+static const uint16_t batteryAttributes[] = {batteryVoltage::id, batteryPercentage::id};
+
+static ZStackShards *shards;
+static ZStackProvisioning *provisioning[ZSTACK_SHARD_COUNT];
+static ZStackAttributes *attributes[ZSTACK_SHARD_COUNT];     // short addresses are unique per network only
+static ZStackReader *readers[ZSTACK_SHARD_COUNT];
+static ZStackOta *ota[ZSTACK_SHARD_COUNT];
+static uint8_t instances;
+static FILE *captureFile;
+
+static void captureOutput(const uint8_t *data, size_t length)
+{
+    fwrite(data, 1, length, captureFile);
+    fflush(captureFile);
+}
+
+// one template prints every schema attribute, values come scaled to units
+struct attributePrinter
+{
+    const char *action;
+
+    template <typename cluster, typename attribute> void operator () (cluster, attribute, typename attribute::value value)
+    {
+        printf("ZStack attribute 0x%04x of cluster 0x%04x %s %g\n", attribute::id, cluster::id, action, static_cast <double> (value));
+    }
+};
+
+static void readCallback(const readResultStruct *result, void *context)
+{
+    ZStackAttributes *cache = reinterpret_cast <ZStackAttributes*> (context);
+    attributePrinter printer = {"read as"};
+
+    if (result->status != STATUS_SUCCESS)
+        printf("ZStack read of cluster 0x%04x from 0x%04x failed with status 0x%02x\n", result->clusterId, result->shortAddress, result->status);
+
+    for (const zclAttributeStruct &attribute : ZCLAttributes(result->data, result->length, CMD_READ_ATTRIBUTES_RESPONSE))
+        if (cache->update(result->shortAddress, result->endpointId, result->clusterId, attribute) && !schema::decode(result->clusterId, attribute, printer))
+            printf("ZStack attribute 0x%04x of cluster 0x%04x read as %g\n", attribute.id, result->clusterId, attribute.numericValue());
+
+    fflush(stdout);
+}
+
+static void otaCallback(uint16_t shortAddress, uint32_t fileVersion, uint8_t status)
+{
+    otaStatsStruct stats;
+    uint32_t rate = 0;
+
+    for (uint8_t i = 0; i < instances; i++)
+    {
+        ota[i]->stats(&stats);
+        rate += stats.rate;
+    }
+
+    printf("ZStack device 0x%04x upgrade to version 0x%08x finished with status 0x%02x, OTA throughput %u bytes/s\n", shortAddress, fileVersion, status, rate);
+    fflush(stdout);
+}
+
+static void metricsOutput(const char *text, size_t length)
+{
+    fwrite(text, 1, length, stdout);
+}
+
+static void provisionCallback(uint64_t ieeeAddress, bool success)
+{
+    ZStack *zstack = shards->find(ieeeAddress);
+    deviceStruct device;
+
+    printf("ZStack device 0x%016llx provisioning finished %s!\n", static_cast <unsigned long long> (ieeeAddress), success ? "successfully" : "with error");
+    fflush(stdout);
+
+    if (zstack && zstack->devices()->findByIeeeAddress(ieeeAddress, &device))
+    {
+        uint8_t index = shards->index(zstack);
+        readers[index]->read(device.shortAddress, schema::profile.endpointId, CLUSTER_POWER_CONFIGURATION, batteryAttributes, 2, readCallback, attributes[index]);
+
+        if (ota[index])
+            ota[index]->notify(device.shortAddress, schema::profile.endpointId);
+    }
+}
+
+// reported attributes are printed only when cache says their value changed, ones outside schema as raw numbers
+static void parseReport(uint8_t index, incomingMessageStruct *message)
+{
+    uint8_t *data = reinterpret_cast <uint8_t*> (message) + sizeof(incomingMessageStruct);
+    size_t offset = data[0] & FC_MANUFACTURER_SPECIFIC ? 5 : 3;
+    attributePrinter printer = {"changed to"};
+
+    if (message->length < offset || data[0] & FC_CLUSTER_SPECIFIC || data[offset - 1] != CMD_REPORT_ATTRIBUTES)
+        return;
+
+    for (const zclAttributeStruct &attribute : ZCLAttributes(data + offset, message->length - offset))
+        if (attributes[index]->update(message->srcAddress, message->srcEndpointId, message->clusterId, attribute) && !schema::decode(message->clusterId, attribute, printer))
+            printf("ZStack attribute 0x%04x of cluster 0x%04x changed to %g\n", attribute.id, message->clusterId, attribute.numericValue());
+}
+
+static void zstackCallback(ZStack *zstack, ZStackEvent event, void *data, size_t length)
+{
+    uint8_t index = shards->index(zstack);
+
+    provisioning[index]->parseEvent(event, data, length);
+    readers[index]->parseEvent(event, data, length);
+
+    if (ota[index])
+        ota[index]->parseEvent(event, data, length);
+
+    shards->parseEvent(zstack, event, data, length);
+
+    if (instances > 1)
+        printf("[%u] ", index);
+
+    switch (event)
+    {
+        case ZStackEvent::resetDetected:
+            printf("ZStack reset detected...\n");
+            break;
+
+        case ZStackEvent::configurationMismatch:
+            printf("ZStack NV item 0x%04x value mismatch, updating configuration...\n", *(reinterpret_cast <uint16_t*> (data)));
+            zstack->update();
+            break;
+
+        case ZStackEvent::configurationUpdated:
+            printf("ZStack configuration updated...\n");
+            break;
+
+        case ZStackEvent::configurationFailed:
+            printf("ZStack NV item 0x%04x configuration failed :(\n", *(reinterpret_cast <uint16_t*> (data)));
+            zstack->reset();
+            break;
+
+        case ZStackEvent::coordinatorReady:
+        {
+            coordinatorStartupStruct *startup = reinterpret_cast <coordinatorStartupStruct*> (data);
+            printf("ZStack coordinator ready in %u ms, address: 0x%016llx\n", startup->startupTime, static_cast <unsigned long long> (startup->ieeeAddress));
+            shards->permitJoin(true);
+            zstack->addGroup(ZSTACK_GROUP_ID);
+            break;
+        }
+
+        case ZStackEvent::coordinatorFailed:
+            printf("ZStack coordinator startup failed :(\n");
+            break;
+
+        case ZStackEvent::deviceJoinedNetwork:
+        {
+            deviceAnnounceStruct *announce = reinterpret_cast <deviceAnnounceStruct*> (data);
+            printf("ZStack device 0x%016llx joined network with short address 0x%04x!\n", static_cast <unsigned long long> (announce->ieeeAddress), announce->shortAddress);
+            attributes[index]->remove(announce->shortAddress);
+            provisioning[index]->deviceJoined(announce->shortAddress, announce->ieeeAddress);
+            break;
+        }
+
+        case ZStackEvent::requestFinished:
+        case ZStackEvent::bindFinished:
+        case ZStackEvent::requestTimeout:
+        {
+            requestStatusStruct *status = reinterpret_cast <requestStatusStruct*> (data);
+            printf("ZStack request %d (command 0x%04x) for 0x%04x finished with status 0x%02x\n", status->handle, status->command, status->shortAddress, status->status);
+            break;
+        }
+
+        case ZStackEvent::connectionChanged:
+            printf("ZStack connection to ZNP %s...\n", *(reinterpret_cast <bool*> (data)) ? "restored" : "lost");
+            break;
+
+        case ZStackEvent::messageReceived:
+        {
+            incomingMessageStruct *message = reinterpret_cast <incomingMessageStruct*> (data);
+            printf("ZStack message received from 0x%04x cluster 0x%04x, %d bytes\n", message->srcAddress, message->clusterId, message->length);
+            parseReport(index, message);
+            break;
+        }
+
+        default:
+            printf("ZStack event %d\n", event);
+            break;
+    }
+
+    fflush(stdout);
+}
+
+static int openPty(void)
+{
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (fd < 0 || grantpt(fd) || unlockpt(fd))
+    {
+        perror("pty");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("ZStack pty slave is %s\n", ptsname(fd));
+    fflush(stdout);
+    return fd;
+}
+
+static uint8_t *mapImage(const char *path, uint32_t *size)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    void *data;
+
+    // image is served straight from the mapping, it is never copied
+
+    if (fd < 0 || fstat(fd, &info) || (data = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+    {
+        perror("image");
+        exit(EXIT_FAILURE);
+    }
+
+    close(fd);
+    *size = static_cast <uint32_t> (info.st_size);
+    return reinterpret_cast <uint8_t*> (data);
+}
+
+int main(int argc, char **argv)
+{
+    char *devices = argc > 1 && strcmp(argv[1], "-") ? argv[1] : NULL;
+    const char *names[ZSTACK_SHARD_COUNT];
+    ZStack *zstack[ZSTACK_SHARD_COUNT];
+    uint8_t *image = NULL;
+    uint32_t imageSize = 0;
+
+    if (argc > 2 && strcmp(argv[2], "-") && !(captureFile = fopen(argv[2], "wb")))
+    {
+        perror("capture");
+        exit(EXIT_FAILURE);
+    }
+
+    if (argc > 3)
+        image = mapImage(argv[3], &imageSize);
+
+    do
+    {
+        char *device = devices ? strsep(&devices, ",") : NULL;
+        ZStackPort *port = device ? new ZStackPosixPort(device) : new ZStackPosixPort(openPty());
+
+        if (captureFile && !instances)
+            port = new ZStackCapturePort(port, new ZStackCapture(ZSTACK_CAPTURE_SIZE, captureOutput));
+
+        names[instances] = device ? device : "pty";
+        zstack[instances] = new ZStack(port, zstackCallback, ZSTACK_CHANNEL + instances * 5, ZSTACK_PANID + instances);
+        provisioning[instances] = new ZStackProvisioning(zstack[instances], &schema::profile, provisionCallback);
+        attributes[instances] = new ZStackAttributes();
+        readers[instances] = new ZStackReader(zstack[instances]);
+        attributes[instances]->setDeadband(CLUSTER_TEMPERATURE_MEASUREMENT, 0x0000, TEMPERATURE_DEADBAND);
+
+        if (image)
+        {
+            ota[instances] = new ZStackOta(zstack[instances], otaCallback);
+
+            if (!ota[instances]->addImage(image, imageSize))
+            {
+                fprintf(stderr, "image: not a valid OTA file\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        instances++;
+    }
+    while (devices && instances < ZSTACK_SHARD_COUNT);
+
+    shards = new ZStackShards(zstack, instances);
+
+    // event callback uses everything above, so tasks start only once all of it exists
+    for (uint8_t i = 0; i < instances; i++)
+    {
+        if (!zstack[i]->start())
+        {
+            perror(names[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (uint8_t i = 0; i < instances; i++)
+        zstack[i]->reset();
+
+    while (1)
+    {
+        static metricsStruct metrics;
+
+        sleep(METRICS_INTERVAL);
+
+        for (uint8_t i = 0; i < instances; i++)
+        {
+            if (instances > 1)
+                printf("[%u] ", i);
+
+            zstack[i]->metrics(&metrics);
+            ZStackMetrics::dump(&metrics, metricsOutput);
+        }
+
+        fflush(stdout);
+    }
+}
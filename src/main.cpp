@@ -1,187 +1,127 @@
+#include <zstack/ZCLSchema.h>
 #include <zstack/ZStack.h>
+#include <zstack/ZStackAttributes.h>
+#include <zstack/ZStackCapture.h>
+#include <zstack/ZStackLog.h>
+#include <zstack/ZStackProvisioning.h>
+#include <zstack/ZStackReader.h>
+#include <zstack/ZStackUartPort.h>
 
 #define PRINT_DUMPS                         true
+#define CAPTURE_COMMAND                     'c'    // send it to serial console to get capture file of recent ZNP traffic, see captureOutput
+#define CAPTURE_LINE                        32     // capture bytes per console line
+#define LINK_TEST_COMMAND                   'l'    // send it to serial console to measure ZNP link throughput
+#define METRICS_COMMAND                     'm'    // send it to serial console to get ZStack metrics right now
+#define METRICS_INTERVAL                    60000  // ms between metrics dumps
+#define LINK_TEST_DURATION                  5000
+#define LINK_TEST_LENGTH                    64
+#define TEMPERATURE_DEADBAND                10     // 0.1 °C, smaller changes are cached but not printed
 #define BLINK_PIN                           2
 
 #define ZSTACK_CHANNEL                      11
 #define ZSTACK_PANID                        0x1234 // WARNING: use unique panId for each zigbee network in the same area!
+#define ZSTACK_GROUP_ID                     0x0001 // coordinator endpoint joins it to receive group addressed commands
 
+#define ZSTACK_UART                         UART_NUM_2
 #define ZSTACK_BSL_PIN                      14
 #define ZSTACK_RST_PIN                      4
 #define ZSTACK_RX_PIN                       18
 #define ZSTACK_TX_PIN                       19
+#define ZSTACK_RTS_PIN                      -1     // set both RTS and CTS pins to enable hardware flow control
+#define ZSTACK_CTS_PIN                      -1
+#define ZSTACK_BAUD_RATE                    115200 // must match ZNP firmware
 
-// few ZCL definitions here
-#define FC_MANUFACTURER_SPECIFIC            0x04
-#define FC_CLUSTER_SPECIFIC                 0x01
-#define CMD_REPORT_ATTRIBUTES               0x0A
-#define CMD_CONFIGURE_REPORTING             0x06
-#define CMD_CONFIGURE_REPORTING_RESPONSE    0x07
-#define CMD_DEFAULT_RESPONSE                0x0B
-
-#define DATA_TYPE_8BIT_UNSIGNED             0x20
-#define DATA_TYPE_16BIT_UNSIGNED            0x21
-#define DATA_TYPE_24BIT_UNSIGNED            0x22
-#define DATA_TYPE_32BIT_UNSIGNED            0x23
-#define DATA_TYPE_40BIT_UNSIGNED            0x24
-#define DATA_TYPE_48BIT_UNSIGNED            0x25
-#define DATA_TYPE_56BIT_UNSIGNED            0x26
-#define DATA_TYPE_64BIT_UNSIGNED            0x27
-#define DATA_TYPE_8BIT_SIGNED               0x28
-#define DATA_TYPE_16BIT_SIGNED              0x29
-#define DATA_TYPE_24BIT_SIGNED              0x2A
-#define DATA_TYPE_32BIT_SIGNED              0x2B
-#define DATA_TYPE_40BIT_SIGNED              0x2C
-#define DATA_TYPE_48BIT_SIGNED              0x2D
-#define DATA_TYPE_56BIT_SIGNED              0x2E
-#define DATA_TYPE_64BIT_SIGNED              0x2F
-#define DATA_TYPE_SINGLE_PRECISION          0x39
-#define DATA_TYPE_DOUBLE_PRECISION          0x3A
-
-#define CLUSTER_POWER_CONFIGURATION         0x0001
-#define CLUSTER_TEMPERATURE_MEASUREMENT     0x0402
-#define CLUSTER_SOIL_MOISTURE               0x0408
-
-#pragma pack(push, 1)
-
-struct zclHeader // simplified header without "manufacturer core" field
-{
-    uint8_t  frameControl;
-    uint8_t  transationId;
-    uint8_t  commandId;
-};
+typedef ZCLAttribute <0x0020, DATA_TYPE_8BIT_UNSIGNED,  std::ratio <1, 10>>  batteryVoltage;
+typedef ZCLAttribute <0x0021, DATA_TYPE_8BIT_UNSIGNED,  std::ratio <1, 2>>   batteryPercentage;
+typedef ZCLAttribute <0x0000, DATA_TYPE_16BIT_SIGNED,   std::ratio <1, 100>> temperature;
+typedef ZCLAttribute <0x0000, DATA_TYPE_16BIT_UNSIGNED, std::ratio <1, 100>> soilMoisture;
 
-struct configureReportingStruct
-{
-    uint8_t  direction;
-    uint16_t attributeId;
-    uint8_t  dataType;
-    uint16_t minInterval;
-    uint16_t maxInterval;
-    uint16_t valueChange;
-};
+typedef ZCLCluster <CLUSTER_POWER_CONFIGURATION,     true, batteryVoltage, batteryPercentage> powerConfiguration;
+typedef ZCLCluster <CLUSTER_TEMPERATURE_MEASUREMENT, true, temperature>                       temperatureMeasurement;
+typedef ZCLCluster <CLUSTER_SOIL_MOISTURE,           true, soilMoisture>                      soilMoistureMeasurement;
+
+// binds and reporting configuration for every joined device, reporting from 0 seconds to 1 hour on any change
+typedef ZCLSchema <0x01, powerConfiguration, temperatureMeasurement, soilMoistureMeasurement> schema;
 
-#pragma pack(pop)
-// end of ZCL definitions
+// battery values are reported on change only, so provisioned device is read once to get them
+static const uint16_t batteryAttributes[] = {batteryVoltage::id, batteryPercentage::id};
 
+static ZStackUartPort port(ZSTACK_UART, ZSTACK_BSL_PIN, ZSTACK_RST_PIN, ZSTACK_RX_PIN, ZSTACK_TX_PIN, ZSTACK_BAUD_RATE, ZSTACK_RTS_PIN, ZSTACK_CTS_PIN);
+static ZStackCapture *capture;
+static ZStackAttributes *attributes;
 static ZStack *zstack;
-static uint8_t transactionId = 0;
+static ZStackProvisioning *provisioning;
+static ZStackReader *reader;
+static ZStackLog *logger;
 
-// look Zigbee Cluster Library Specification for all data types
-uint8_t zclDataSize(uint8_t dataType)
+static char captureLine[CAPTURE_LINE * 2 + 6] = "ZSCP ";
+static uint8_t captureCount;
+
+static void captureFlush(void)
 {
-    switch (dataType)
-    {
-        case DATA_TYPE_8BIT_UNSIGNED:
-        case DATA_TYPE_8BIT_SIGNED:
-            return 1;
-
-        case DATA_TYPE_16BIT_UNSIGNED:
-        case DATA_TYPE_16BIT_SIGNED:
-            return 2;
-
-        case DATA_TYPE_24BIT_UNSIGNED:
-        case DATA_TYPE_24BIT_SIGNED:
-            return 3;
-
-        case DATA_TYPE_32BIT_UNSIGNED:
-        case DATA_TYPE_32BIT_SIGNED:
-        case DATA_TYPE_SINGLE_PRECISION:
-            return 4;
-
-        case DATA_TYPE_40BIT_UNSIGNED:
-        case DATA_TYPE_40BIT_SIGNED:
-            return 5;
-
-        case DATA_TYPE_48BIT_UNSIGNED:
-        case DATA_TYPE_48BIT_SIGNED:
-            return 6;
-
-        case DATA_TYPE_56BIT_UNSIGNED:
-        case DATA_TYPE_56BIT_SIGNED:
-            return 7;
-
-        case DATA_TYPE_64BIT_UNSIGNED:
-        case DATA_TYPE_64BIT_SIGNED:
-        case DATA_TYPE_DOUBLE_PRECISION:
-            return 8;
-    }
+    if (!captureCount)
+        return;
 
-    return 0;
+    captureLine[captureCount * 2 + 5] = '\n';
+    Serial.write(reinterpret_cast <const uint8_t*> (captureLine), captureCount * 2 + 6);
+    captureCount = 0;
 }
 
-static void parseAttribute(uint8_t endpointId, uint16_t clusterId, uint16_t attributeId, uint8_t *data, size_t length)
+// log text goes to the same console, so capture is written as hex lines, each one by single write call,
+// get the file back with: grep -o 'ZSCP [0-9a-f]*' console.txt | cut -c6- | xxd -r -p > capture.zscp
+static void captureOutput(const uint8_t *data, size_t length)
 {
-    (void) endpointId;
-    (void) length;
+    static const char digits[] = "0123456789abcdef";
 
-    switch (clusterId)
+    for (size_t i = 0; i < length; i++)
     {
-        case CLUSTER_POWER_CONFIGURATION:
-
-            if (attributeId == 0x0020)
-                Serial.printf("Battery voltage: %.1f\n", *(reinterpret_cast <uint8_t*> (data)) / 10.0);
-
-            if (attributeId == 0x0021)
-                Serial.printf("Battery percentage: %.1f\n", *(reinterpret_cast <uint8_t*> (data)) / 2.0);
-
-            break;
-
-        case CLUSTER_TEMPERATURE_MEASUREMENT:
-
-            if (attributeId == 0x0000)
-                Serial.printf("Temperature: %.1f\n", *(reinterpret_cast <int16_t*> (data)) / 100.0);
-
-            break;
-
-        case CLUSTER_SOIL_MOISTURE:
-
-            if (attributeId == 0x0000)
-                Serial.printf("Soil moisture: %.1f\n", *(reinterpret_cast <uint16_t*> (data)) / 100.0);
+        captureLine[captureCount * 2 + 5] = digits[data[i] >> 4];
+        captureLine[captureCount * 2 + 6] = digits[data[i] & 0x0F];
 
-            break;
+        if (++captureCount == CAPTURE_LINE)
+            captureFlush();
     }
 }
 
-static void parseAttributesReport(uint8_t endpointId, uint16_t clusterId, uint8_t *data, size_t length)
+static void logOutput(const char *text, size_t length)
 {
-    size_t offset = 0;
+    Serial.write(reinterpret_cast <const uint8_t*> (text), length);
+}
 
-    while (length >= offset + 3) // attribute id field + data type field = 3 bytes
-    {
-        uint16_t attributeId = *(reinterpret_cast <uint16_t*> (data + offset));
-        uint8_t size = zclDataSize(data[offset + 2]), *payload = data + offset + 3;
+// schema decodes and scales values, every declared attribute needs its overload here
+struct attributePrinter
+{
+    void operator () (powerConfiguration, batteryVoltage, double value) { logger->print("Battery voltage: %.1f\n", value); }
+    void operator () (powerConfiguration, batteryPercentage, double value) { logger->print("Battery percentage: %.1f\n", value); }
+    void operator () (temperatureMeasurement, temperature, double value) { logger->print("Temperature: %.1f\n", value); }
+    void operator () (soilMoistureMeasurement, soilMoisture, double value) { logger->print("Soil moisture: %.1f\n", value); }
+};
 
-        if (PRINT_DUMPS)
-        {
-            Serial.printf("Attribute 0x%04x (data type 0x%02x) data:", attributeId, data[offset + 2]);
+// only changed values are decoded, the rest just refresh attribute cache timestamps
+static void parseAttributesReport(uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, uint8_t *data, size_t length)
+{
+    attributePrinter printer;
 
-            for (size_t i = 0; i < size; i++)
-                Serial.printf(" %02x", payload[i]);
+    for (const zclAttributeStruct &attribute : ZCLAttributes(data, length))
+    {
+        if (!attributes->update(shortAddress, endpointId, clusterId, attribute))
+            continue;
 
-            Serial.printf("\n");
-        }
+        if (PRINT_DUMPS)
+            logger->dump(attribute.data, attribute.size, "Attribute 0x%04x (data type 0x%02x) data:", attribute.id, attribute.dataType);
 
-        parseAttribute(endpointId, clusterId, attributeId, payload, size);
-        offset += size + 3;
+        schema::decode(clusterId, attribute, printer);
     }
 }
 
 // there we receive ZCL message, look Zigbee Cluster Library Specification for more info
-static void zclMessage(uint8_t endpointId, uint16_t clusterId, uint8_t *data, size_t length)
+static void zclMessage(uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, uint8_t *data, size_t length)
 {
     uint8_t frameControl = data[0], commandId, *payload;
     size_t size;
 
     if (PRINT_DUMPS)
-    {
-        Serial.printf("Мessage raw data:");
-
-        for (size_t i = 0; i < length; i++)
-            Serial.printf(" %02x", data[i]);
-
-        Serial.printf("\n");
-    }
+        logger->dump(data, length, "Мessage raw data:");
 
     if (frameControl & FC_MANUFACTURER_SPECIFIC)
     {
@@ -196,124 +136,125 @@ static void zclMessage(uint8_t endpointId, uint16_t clusterId, uint8_t *data, si
         size = length - 3;
     }
 
-    Serial.printf("Endpoint ID: 0x%02x\n", endpointId);
-    Serial.printf("Cluster ID:  0x%04x\n", clusterId);
-    Serial.printf("Command ID:  0x%02x\n", commandId);
+    logger->print("Endpoint ID: 0x%02x\n", endpointId);
+    logger->print("Cluster ID:  0x%04x\n", clusterId);
+    logger->print("Command ID:  0x%02x\n", commandId);
 
     if (frameControl & FC_CLUSTER_SPECIFIC)
     {
-        Serial.printf("Cluster specific command 0x%02x received...\n", commandId);
+        logger->print("Cluster specific command 0x%02x received...\n", commandId);
         return;
     }
 
     switch(commandId)
     {
         case CMD_REPORT_ATTRIBUTES:
-            parseAttributesReport(endpointId, clusterId, payload, size);
+            parseAttributesReport(shortAddress, endpointId, clusterId, payload, size);
             break;
 
         case CMD_CONFIGURE_REPORTING_RESPONSE:
-            Serial.printf("Configure reporting response received, status: 0x%02x\n", payload[0]);
+            logger->print("Configure reporting response received, status: 0x%02x\n", payload[0]);
             break;
 
         case CMD_DEFAULT_RESPONSE:
-            Serial.printf("Default response received, commandId: 0x%02x, status: 0x%02x\n", payload[0], payload[1]);
+            logger->print("Default response received, commandId: 0x%02x, status: 0x%02x\n", payload[0], payload[1]);
             break;
 
         default:
-            Serial.printf("Global coommand 0x%02x not supported here...\n", commandId);
+            logger->print("Global coommand 0x%02x not supported here...\n", commandId);
             break;
     }
 }
 
-// configure reporting request example, look Zigbee Cluster Library Specification for more info
-static void configureReporting(uint16_t shortAddress, uint16_t endpointId, uint16_t clusterId, uint16_t attributeId, uint8_t dataType)
+// timeouts are reported from reader task, log ring has single producer (ZStack event task), so this one prints directly
+static void readCallback(const readResultStruct *result, void *)
 {
-    zclHeader header;
-    configureReportingStruct request;
-    uint8_t buffer[sizeof(header) + sizeof(request)];
+    if (result->status != STATUS_SUCCESS)
+    {
+        Serial.printf("ZStack read of cluster 0x%04x from 0x%04x failed with status 0x%02x\n", result->clusterId, result->shortAddress, result->status);
+        return;
+    }
 
-    header.frameControl = 0x00;
-    header.transationId = transactionId;
-    header.commandId    = CMD_CONFIGURE_REPORTING;
+    for (const zclAttributeStruct &attribute : ZCLAttributes(result->data, result->length, CMD_READ_ATTRIBUTES_RESPONSE))
+        if (attributes->update(result->shortAddress, result->endpointId, result->clusterId, attribute))
+            Serial.printf("ZStack attribute 0x%04x of cluster 0x%04x read as %.0f\n", attribute.id, result->clusterId, attribute.numericValue());
+}
 
-    request.direction   = 0x00;         // server to client
-    request.attributeId = attributeId;
-    request.dataType    = dataType;
-    request.minInterval = 0;            // 0 seconds
-    request.maxInterval = 3600;         // 1 hour
-    request.valueChange = 0;            // any change
+// runs in provisioning task, log ring has single producer (ZStack event task), so this one prints directly
+static void provisionCallback(uint64_t ieeeAddress, bool success)
+{
+    deviceStruct device;
 
-    memcpy(buffer, &header, sizeof(header));
-    memcpy(buffer + sizeof(header), &request, sizeof(request));
+    Serial.printf("ZStack device 0x%016llx provisioning finished %s!\n", ieeeAddress, success ? "successfully" : "with error");
 
-    zstack->dataRequest(transactionId++, shortAddress, endpointId, clusterId, buffer, sizeof(buffer));
+    if (zstack->devices()->findByIeeeAddress(ieeeAddress, &device))
+        reader->read(device.shortAddress, schema::profile.endpointId, CLUSTER_POWER_CONFIGURATION, batteryAttributes, 2, readCallback);
 }
 
-static void zstackCallback(ZStackEvent event, void *data, size_t length)
+static void zstackCallback(ZStack *, ZStackEvent event, void *data, size_t length)
 {
-    (void) data;
+    provisioning->parseEvent(event, data, length);
+    reader->parseEvent(event, data, length);
 
     switch (event)
     {
         case ZStackEvent::resetDetected:
-            Serial.printf("ZStack reset detected...\n");
+            logger->print("ZStack reset detected...\n");
             break;
 
         case ZStackEvent::configurationMismatch:
-            Serial.printf("ZStack NV item 0x%04x value mismatch, updating configuration...\n", *(reinterpret_cast <uint16_t*> (data)));
-            zstack->clear(); // or do something else?
+            logger->print("ZStack NV item 0x%04x value mismatch, updating configuration...\n", *(reinterpret_cast <uint16_t*> (data)));
+            zstack->update();
             break;
 
         case ZStackEvent::configurationUpdated:
-            Serial.printf("ZStack configuration updated...\n");
+            logger->print("ZStack configuration updated...\n");
             break;
 
         case ZStackEvent::configurationFailed:
-            Serial.printf("ZStack NV item 0x%04x configuration failed :(\n", *(reinterpret_cast <uint16_t*> (data)));
+            logger->print("ZStack NV item 0x%04x configuration failed :(\n", *(reinterpret_cast <uint16_t*> (data)));
             zstack->reset(); // or do something else?
             break;
 
         case ZStackEvent::statusChanged:
-            Serial.printf("ZStack state changed, new state is 0x%02x\n", *(reinterpret_cast <uint8_t*> (data)));
+            logger->print("ZStack state changed, new state is 0x%02x\n", *(reinterpret_cast <uint8_t*> (data)));
             break;
 
         case ZStackEvent::coordinatorStarting:
-            Serial.printf("ZStack coordinator starting...\n");
+            logger->print("ZStack coordinator starting...\n");
             break;
 
         case ZStackEvent::coordinatorReady:
-            Serial.printf("ZStack coordinator ready, address: 0x%016llx\n", *(reinterpret_cast <uint64_t*> (data)));
+        {
+            coordinatorStartupStruct *startup = reinterpret_cast <coordinatorStartupStruct*> (data);
+            logger->print("ZStack coordinator ready in %u ms, address: 0x%016llx\n", startup->startupTime, startup->ieeeAddress);
             zstack->permitJoin(true); // move it somewhere
+            zstack->addGroup(ZSTACK_GROUP_ID);
             break;
+        }
 
         case ZStackEvent::coordinatorFailed:
-            Serial.printf("ZStack coordinator startup failed :(\n");
+            logger->print("ZStack coordinator startup failed :(\n");
             break;
 
         case ZStackEvent::permitJoinChanged:
-            Serial.printf("ZStack permit join is now %s...\n", *(reinterpret_cast <bool*> (data)) ? "enabled" : "disabled");
+            logger->print("ZStack permit join is now %s...\n", *(reinterpret_cast <bool*> (data)) ? "enabled" : "disabled");
             break;
 
         case ZStackEvent::permitJoinFailed:
-            Serial.printf("ZStack permit join request failed :(\n");
+            logger->print("ZStack permit join request failed :(\n");
             break;
 
         case ZStackEvent::deviceJoinedNetwork:
         {
             deviceAnnounceStruct *announce = reinterpret_cast <deviceAnnounceStruct*> (data);
-            Serial.printf("ZStack device 0x%016llx joined network with short address 0x%04x!\n", announce->ieeeAddress, announce->shortAddress);
+            logger->print("ZStack device 0x%016llx joined network with short address 0x%04x!\n", announce->ieeeAddress, announce->shortAddress);
 
-            // bind clusters
-            zstack->bindRequest(announce->shortAddress, announce->ieeeAddress, 0x01, CLUSTER_POWER_CONFIGURATION);
-            zstack->bindRequest(announce->shortAddress, announce->ieeeAddress, 0x01, CLUSTER_TEMPERATURE_MEASUREMENT);
-            zstack->bindRequest(announce->shortAddress, announce->ieeeAddress, 0x01, CLUSTER_SOIL_MOISTURE);
+            // short address may belong to another device before, its cached values are not ours
+            attributes->remove(announce->shortAddress);
 
-            // configure reporting
-            configureReporting(announce->shortAddress, 0x01, CLUSTER_POWER_CONFIGURATION,     0x0020, DATA_TYPE_8BIT_UNSIGNED);
-            configureReporting(announce->shortAddress, 0x01, CLUSTER_POWER_CONFIGURATION,     0x0021, DATA_TYPE_8BIT_UNSIGNED);
-            configureReporting(announce->shortAddress, 0x01, CLUSTER_TEMPERATURE_MEASUREMENT, 0x0000, DATA_TYPE_16BIT_SIGNED);
-            configureReporting(announce->shortAddress, 0x01, CLUSTER_SOIL_MOISTURE,           0x0000, DATA_TYPE_16BIT_UNSIGNED);
+            // bind clusters and configure reporting, see profile above
+            provisioning->deviceJoined(announce->shortAddress, announce->ieeeAddress);
 
             break;
         }
@@ -321,45 +262,63 @@ static void zstackCallback(ZStackEvent event, void *data, size_t length)
         case ZStackEvent::deviceLeftNetwork:
         {
             deviceLeaveStruct *leave = reinterpret_cast <deviceLeaveStruct*> (data);
-            Serial.printf("ZStack device 0x%016llx left network...\n", leave->ieeeAddress);
+            logger->print("ZStack device 0x%016llx left network...\n", leave->ieeeAddress);
             break;
         }
 
         case ZStackEvent::requestEnqueued:
-            Serial.printf("ZStack data request was equeued...\n");
+            logger->print("ZStack data request %d was equeued...\n", reinterpret_cast <requestStatusStruct*> (data)->handle);
             break;
 
         case ZStackEvent::requestFailed:
-            Serial.printf("ZStack data request failed :(\n");
+            logger->print("ZStack data request %d failed :(\n", reinterpret_cast <requestStatusStruct*> (data)->handle);
             break;
 
         case ZStackEvent::requestFinished:
         {
-            dataConfirmStruct *confirm = reinterpret_cast <dataConfirmStruct*> (data);
-            Serial.printf("ZStack data request %d finished %s!\n", confirm->transactionId, confirm->status ? "with error" : "successfully");
+            requestStatusStruct *status = reinterpret_cast <requestStatusStruct*> (data);
+            logger->print("ZStack data request %d (transaction %d) finished %s!\n", status->handle, status->transactionId, status->status ? "with error" : "successfully");
             break;
         }
 
         case ZStackEvent::bindEnqueued:
-            Serial.printf("ZStack bind request was equeued...\n");
+            logger->print("ZStack bind request %d was equeued...\n", reinterpret_cast <requestStatusStruct*> (data)->handle);
             break;
 
         case ZStackEvent::bindFailed:
-            Serial.printf("ZStack bind request failed :(\n");
+            logger->print("ZStack bind request %d failed :(\n", reinterpret_cast <requestStatusStruct*> (data)->handle);
             break;
 
         case ZStackEvent::bindFinished:
         {
-            bindResponseStruct *response = reinterpret_cast <bindResponseStruct*> (data);
-            Serial.printf("ZStack bind request for 0x%04x finished %s!\n", response->shortAddress, response->status ? "with error" : "successfully");
+            requestStatusStruct *status = reinterpret_cast <requestStatusStruct*> (data);
+            logger->print("ZStack bind request %d for 0x%04x finished %s!\n", status->handle, status->shortAddress, status->status ? "with error" : "successfully");
+            break;
+        }
+
+        case ZStackEvent::requestTimeout:
+        {
+            requestStatusStruct *status = reinterpret_cast <requestStatusStruct*> (data);
+            logger->print("ZStack request %d (command 0x%04x) timed out :(\n", status->handle, status->command);
             break;
         }
 
+        case ZStackEvent::requestHeld:
+        {
+            requestStatusStruct *status = reinterpret_cast <requestStatusStruct*> (data);
+            logger->print("ZStack data request %d for sleeping device 0x%04x is held until it wakes up...\n", status->handle, status->shortAddress);
+            break;
+        }
+
+        case ZStackEvent::connectionChanged:
+            logger->print("ZStack connection to ZNP %s...\n", *(reinterpret_cast <bool*> (data)) ? "restored" : "lost");
+            break;
+
         case ZStackEvent::messageReceived:
         {
             incomingMessageStruct *message = reinterpret_cast <incomingMessageStruct*> (data);
-            Serial.printf("ZStack message received from 0x%04x with link quality = %d\n", message->srcAddress, message->linkQuality);
-            zclMessage(message->srcEndpointId, message->clusterId, reinterpret_cast <uint8_t*> (data) + sizeof(incomingMessageStruct), message->length);
+            logger->print("ZStack message received from 0x%04x with link quality = %d\n", message->srcAddress, message->linkQuality);
+            zclMessage(message->srcAddress, message->srcEndpointId, message->clusterId, reinterpret_cast <uint8_t*> (data) + sizeof(incomingMessageStruct), message->length);
             break;
         }
     }
@@ -370,12 +329,66 @@ void setup(void)
     pinMode(BLINK_PIN, OUTPUT);
     Serial.begin(9600);
 
-    zstack = new ZStack(zstackCallback, ZSTACK_CHANNEL, ZSTACK_PANID, ZSTACK_BSL_PIN, ZSTACK_RST_PIN, ZSTACK_RX_PIN, ZSTACK_TX_PIN);
+    // everything printed from ZStack callbacks goes through log ring, so slow serial never stalls event dispatch
+    logger = new ZStackLog(logOutput);
+    capture = new ZStackCapture();
+    attributes = new ZStackAttributes();
+    attributes->setDeadband(CLUSTER_TEMPERATURE_MEASUREMENT, 0x0000, TEMPERATURE_DEADBAND);
+    zstack = new ZStack(new ZStackCapturePort(&port, capture), zstackCallback, ZSTACK_CHANNEL, ZSTACK_PANID, 0, 1);
+    provisioning = new ZStackProvisioning(zstack, &schema::profile, provisionCallback);
+    reader = new ZStackReader(zstack);
+
+    // callback dispatches to provisioning and reader, so tasks start after they exist
+    if (!zstack->start())
+    {
+        logger->print("ZStack UART setup failed :(\n");
+        return;
+    }
+
     zstack->reset();
 }
 
+static void dumpMetrics(void)
+{
+    static metricsStruct metrics;
+
+    zstack->metrics(&metrics);
+    ZStackMetrics::dump(&metrics, logOutput);
+}
+
 void loop(void)
 {
+    static uint32_t metricsTime;
+
+    switch (Serial.available() ? Serial.read() : -1)
+    {
+        case CAPTURE_COMMAND:
+            capture->dump(captureOutput);
+            captureFlush();
+            break;
+
+        case METRICS_COMMAND:
+            dumpMetrics();
+            break;
+
+        case LINK_TEST_COMMAND:
+        {
+            linkTestStruct result;
+
+            if (!zstack->linkTest(LINK_TEST_DURATION, LINK_TEST_LENGTH, &result))
+                break;
+
+            Serial.printf("ZStack link test at %u baud: %u frames sent, %u lost, %u bytes/s\n", ZSTACK_BAUD_RATE, result.sent, result.lost, result.rate);
+            break;
+        }
+    }
+
+    if (millis() - metricsTime >= METRICS_INTERVAL)
+    {
+        metricsTime = millis();
+        dumpMetrics();
+    }
+
     digitalWrite (BLINK_PIN, HIGH);
     delay (500);
     digitalWrite (BLINK_PIN, LOW);
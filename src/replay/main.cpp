@@ -0,0 +1,131 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <zstack/ZStack.h>
+#include <zstack/ZStackCapture.h>
+
+#define REPLAY_CHANNEL                      11
+#define REPLAY_PANID                        0x1234
+#define REPLAY_EVENT_WAIT                   1000   // ms to wait for event workers after the last record
+
+// streams capture file through ZStack input parser, usage: replay [-r] capture.zscp
+// by default received bytes are fed as fast as possible, with -r at recorded timing,
+// frames ZStack sends in reply go to null port and are only counted
+
+class ReplayPort : public ZStackPort
+{
+    public:
+
+        std::atomic <size_t> written;
+
+        ReplayPort(void) : written(0) {}
+
+        bool begin(void) override
+        {
+            return true;
+        }
+
+        size_t read(uint8_t *, size_t, uint32_t timeout) override
+        {
+            zstackDelay(timeout < 100 ? timeout : 100);
+            return 0;
+        }
+
+        size_t write(const uint8_t *, size_t length) override
+        {
+            written += length;
+            return length;
+        }
+
+        bool reset(void) override
+        {
+            return true;
+        }
+
+};
+
+static std::atomic <uint32_t> events(0);
+
+static void zstackCallback(ZStack *, ZStackEvent, void *, size_t)
+{
+    events++;
+}
+
+int main(int argc, char **argv)
+{
+    bool realtime = argc > 2 && !strcmp(argv[1], "-r");
+    const char *path = argv[argc - 1];
+    size_t offset = sizeof(captureHeaderStruct), records = 0, received = 0, sent = 0;
+    uint64_t start, first = 0;
+    uint8_t *capture;
+    struct stat info;
+    int fd;
+
+    if (argc < 2 || (fd = open(path, O_RDONLY)) < 0 || fstat(fd, &info) || static_cast <size_t> (info.st_size) < sizeof(captureHeaderStruct))
+    {
+        fprintf(stderr, "usage: replay [-r] capture.zscp\n");
+        return EXIT_FAILURE;
+    }
+
+    capture = reinterpret_cast <uint8_t*> (mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+
+    if (capture == MAP_FAILED || reinterpret_cast <captureHeaderStruct*> (capture)->magic != ZSTACK_CAPTURE_MAGIC || reinterpret_cast <captureHeaderStruct*> (capture)->version != ZSTACK_CAPTURE_VERSION)
+    {
+        fprintf(stderr, "%s is not a capture file\n", path);
+        return EXIT_FAILURE;
+    }
+
+    // both stay alive until exit, ZStack tasks never return
+    ReplayPort *port = new ReplayPort;
+    ZStack *zstack = new ZStack(port, zstackCallback, REPLAY_CHANNEL, REPLAY_PANID);
+
+    zstack->start();
+
+    start = zstackMicros();
+
+    while (offset + sizeof(captureRecordStruct) <= static_cast <size_t> (info.st_size))
+    {
+        captureRecordStruct record;
+        uint8_t *data = capture + offset + sizeof(record);
+
+        memcpy(&record, capture + offset, sizeof(record));
+
+        if (offset + sizeof(record) + record.length > static_cast <size_t> (info.st_size))
+            break;
+
+        if (!records)
+            first = record.time;
+
+        if (realtime)
+        {
+            uint64_t now = zstackMicros() - start;
+
+            if (record.time - first > now)
+                usleep(record.time - first - now);
+        }
+
+        if (record.direction == captureReceived)
+        {
+            zstack->parseInput(data, record.length);
+            received += record.length;
+        }
+        else
+            sent += record.length;
+
+        offset += sizeof(record) + record.length;
+        records++;
+    }
+
+    start = zstackMicros() - start;
+    zstackDelay(REPLAY_EVENT_WAIT);
+
+    printf("{\"records\": %zu, \"received\": %zu, \"sent\": %zu, \"replySent\": %zu, \"events\": %u, \"dropped\": %u, \"truncated\": %s, \"time\": %.6f, \"rate\": %.0f}\n",
+        records, received, sent, port->written.load(), events.load(), zstack->droppedEvents(), offset < static_cast <size_t> (info.st_size) ? "true" : "false", start / 1e6, start ? received * 1e6 / start : 0.0);
+
+    munmap(capture, info.st_size);
+    close(fd);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,1304 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include <zstack/ZStack.h>
+#include <zstack/ZStackPosixPort.h>
+#include <zstack/ZStackShards.h>
+
+#define SIM_CHANNEL                         11
+#define SIM_PANID                           0x1234
+#define SIM_WAIT                            5000   // ms a check waits for ZStack to get where it is expected
+#define SIM_SETTLE                          500    // ms left for late frames before counters are compared
+#define SIM_JOINS                           7      // devices announced to shards, odd count leaves one network ahead
+#define SIM_CAPABILITIES                    0x8E   // router, mains powered, receiver on, so requests are never held
+#define SIM_END_DEVICE                      0x80   // battery end device with receiver off when idle, requests to it are held
+#define SIM_LONG_PAYLOAD                    235    // fits MT frame source routed over two relays, not over eight
+#define SIM_LINK_TEST_TIME                  1000   // ms of loopback traffic in each link test
+#define SIM_LINK_TEST_DROP                  7      // every that many echo is dropped in the lossy link test
+
+#define NV_OPER_FAILED                      0x0A
+#define NV_ITEM_UNINIT                      0x09
+
+// fake ZNP checks, usage: sim
+// every fake ZNP owns pty master and ZStack opens its slave with ZStackPosixPort, so the path from termios setup
+// to frame parser is the real one, fake answers the MT subset ZStack uses the way firmware does
+//
+// shards: two coordinators behind ZStackShards, every announce goes to the only ZNP permitting join, devices end up
+// split between networks and data requests by IEEE address reach the ZNP device is joined to, also after it moved
+//
+// nv: coordinator started on factory, configured, and configured but for ZDO_DIRECT_CB or channel list NV,
+// checks which items are written, whether network state is cleared and how many resets it takes
+//
+// hold: requests to end devices not heard from for ZSTACK_AWAKE_TIME stay in ZStack until the device sends something,
+// then go out in original order, held write attributes is replaced by newer one, requests over ZSTACK_HOLD_COUNT are
+// sent right away and MAC transaction expired confirm puts request on hold again
+//
+// requests: confirms answered newest first and bind responses finish the handles their requests got,
+// request never confirmed fails with requestTimeout after ZSTACK_REQUEST_TIMEOUT
+//
+// window: congestion window starts at one request, successful confirms open it, buffer full halves it,
+// destination takes at most ZSTACK_DESTINATION_WINDOW and only one after MAC no ack, others keep going
+//
+// routes: route discovery is asked for only without working route, route record makes requests source routed
+// with its relay list, request the relay list would push over MT frame limit goes out plain with route discovery
+//
+// link: link test over the pty reports nothing lost while every loopback frame is echoed, and about every
+// SIM_LINK_TEST_DROP one lost when fake drops them
+//
+// prints one line per check, exit status is failure if any of them failed
+
+struct dataFrameStruct
+{
+    uint16_t command;
+    uint16_t shortAddress;
+    uint8_t  transactionId;
+    uint8_t  options;
+    uint8_t  length;
+    std::vector <uint16_t> relays;
+};
+
+struct requestEventStruct
+{
+    ZStackEvent event;
+    requestStatusStruct status;
+};
+
+class FakeZnp
+{
+    public:
+
+        FakeZnp(uint64_t ieeeAddress);
+
+        const char *path(void);
+        void send(uint16_t command, const void *data, size_t length);
+        void announce(uint16_t shortAddress, uint64_t ieeeAddress, uint8_t capabilities = SIM_CAPABILITIES);
+        void message(uint16_t shortAddress);
+        void sourceRoute(uint16_t shortAddress, const std::vector <uint16_t> &relays);
+
+        // status of the next confirm for given destination, later ones are successful again
+        void setConfirm(uint16_t shortAddress, uint8_t status);
+
+        // deferred confirms wait until they are released with given status, newest or oldest first, or dropped
+        void deferConfirms(bool defer);
+        size_t deferredConfirms(void);
+        void releaseConfirms(size_t count, uint8_t status, bool newest);
+        void dropConfirms(void);
+
+        // every that many loopback echo is dropped, 0 echoes all of them
+        void dropEchoes(uint32_t every);
+
+        // counters since last clearCounters, NV and requests are copied under lock as task keeps answering
+        void clearCounters(void);
+        uint32_t resets(void);
+        uint32_t stateClears(void);
+        uint32_t markerInits(void);
+        std::vector <uint16_t> writes(void);
+        std::vector <dataFrameStruct> dataRequests(void);
+        std::map <uint16_t, std::vector <uint8_t>> nv(void);
+        void setNv(const std::map <uint16_t, std::vector <uint8_t>> &nv);
+        bool permitJoin(void);
+
+    private:
+
+        int m_fd;
+        uint64_t m_ieeeAddress;
+        ZStackMutex m_mutex;
+
+        std::map <uint16_t, std::vector <uint8_t>> m_nv;
+        std::map <uint16_t, uint8_t> m_confirms;
+        std::vector <dataConfirmStruct> m_deferred;
+        std::vector <uint16_t> m_writes;
+        std::vector <dataFrameStruct> m_dataRequests;
+        uint32_t m_resets, m_stateClears, m_markerInits;
+        bool m_permitJoin, m_defer;
+        uint32_t m_dropEvery, m_echoes;
+
+        static void task(void *data);
+        void parseFrame(uint16_t command, const uint8_t *data, size_t length);
+        void factoryNv(void);
+
+};
+
+struct instanceStruct
+{
+    ZStack *zstack;
+    FakeZnp *znp;
+    std::atomic <uint32_t> ready, mismatches, joins;
+
+    // request events in order of arrival, callback appends under lock
+    ZStackMutex mutex;
+    std::vector <requestEventStruct> events;
+};
+
+static instanceStruct instances[2];
+static uint8_t instanceCount;
+static ZStackShards *shards;
+static uint8_t failures;
+
+FakeZnp::FakeZnp(uint64_t ieeeAddress) : m_fd(posix_openpt(O_RDWR | O_NOCTTY)), m_ieeeAddress(ieeeAddress), m_resets(0), m_stateClears(0), m_markerInits(0), m_permitJoin(false), m_defer(false), m_dropEvery(0), m_echoes(0)
+{
+    if (m_fd < 0 || grantpt(m_fd) || unlockpt(m_fd))
+    {
+        perror("pty");
+        exit(EXIT_FAILURE);
+    }
+
+    factoryNv();
+    zstackCreateTask(task, "Fake ZNP", 4096, this, 0, -1);
+}
+
+const char *FakeZnp::path(void)
+{
+    return ptsname(m_fd);
+}
+
+void FakeZnp::send(uint16_t command, const void *data, size_t length)
+{
+    uint8_t frame[ZSTACK_TX_RING_SIZE];
+    frameSegmentStruct segment = {data, length};
+    size_t size = ZStack::encodeFrame(command, &segment, 1, frame, sizeof(frame), 0);
+
+    if (::write(m_fd, frame, size) != static_cast <ssize_t> (size))
+        perror("fake ZNP");
+}
+
+void FakeZnp::announce(uint16_t shortAddress, uint64_t ieeeAddress, uint8_t capabilities)
+{
+    uint8_t data[2 + sizeof(deviceAnnounceStruct)];
+    deviceAnnounceStruct announce = {shortAddress, ieeeAddress, capabilities};
+
+    memcpy(data, &shortAddress, 2);
+    memcpy(data + 2, &announce, sizeof(announce));
+    send(ZDO_END_DEVICE_ANNCE_IND, data, sizeof(data));
+}
+
+void FakeZnp::message(uint16_t shortAddress)
+{
+    uint8_t data[sizeof(incomingMessageStruct) + 3] = {0x00}, payload[] = {0x18, 0x00, 0x0B};
+    incomingMessageStruct *message = reinterpret_cast <incomingMessageStruct*> (data);
+
+    // default response from endpoint 1, any incoming frame tells ZStack the device is awake
+    message->clusterId = 0x0006;
+    message->srcAddress = shortAddress;
+    message->srcEndpointId = 0x01;
+    message->dstEndpointId = 0x01;
+    message->linkQuality = 0xC8;
+    message->length = sizeof(payload);
+
+    memcpy(data + sizeof(incomingMessageStruct), payload, sizeof(payload));
+    send(AF_INCOMING_MSG, data, sizeof(data));
+}
+
+void FakeZnp::sourceRoute(uint16_t shortAddress, const std::vector <uint16_t> &relays)
+{
+    std::vector <uint8_t> data(sizeof(sourceRouteStruct) + relays.size() * sizeof(uint16_t));
+    sourceRouteStruct route = {shortAddress, static_cast <uint8_t> (relays.size())};
+
+    // route record as concentrator gets it, relays listed from the device towards coordinator
+    memcpy(data.data(), &route, sizeof(route));
+    memcpy(data.data() + sizeof(route), relays.data(), relays.size() * sizeof(uint16_t));
+    send(ZDO_SRC_RTG_IND, data.data(), data.size());
+}
+
+void FakeZnp::setConfirm(uint16_t shortAddress, uint8_t status)
+{
+    m_mutex.lock();
+    m_confirms[shortAddress] = status;
+    m_mutex.unlock();
+}
+
+void FakeZnp::deferConfirms(bool defer)
+{
+    m_mutex.lock();
+    m_defer = defer;
+    m_mutex.unlock();
+}
+
+size_t FakeZnp::deferredConfirms(void)
+{
+    m_mutex.lock();
+    size_t result = m_deferred.size();
+    m_mutex.unlock();
+    return result;
+}
+
+void FakeZnp::releaseConfirms(size_t count, uint8_t status, bool newest)
+{
+    std::vector <dataConfirmStruct> confirms;
+
+    m_mutex.lock();
+
+    while (count-- && !m_deferred.empty())
+    {
+        confirms.push_back(newest ? m_deferred.back() : m_deferred.front());
+        m_deferred.erase(newest ? m_deferred.end() - 1 : m_deferred.begin());
+    }
+
+    m_mutex.unlock();
+
+    for (dataConfirmStruct &confirm : confirms)
+    {
+        confirm.status = status;
+        send(AF_DATA_CONFIRM, &confirm, sizeof(confirm));
+    }
+}
+
+void FakeZnp::dropConfirms(void)
+{
+    m_mutex.lock();
+    m_deferred.clear();
+    m_mutex.unlock();
+}
+
+void FakeZnp::dropEchoes(uint32_t every)
+{
+    m_mutex.lock();
+    m_dropEvery = every;
+    m_echoes = 0;
+    m_mutex.unlock();
+}
+
+void FakeZnp::clearCounters(void)
+{
+    m_mutex.lock();
+    m_writes.clear();
+    m_dataRequests.clear();
+    m_resets = 0;
+    m_stateClears = 0;
+    m_markerInits = 0;
+    m_mutex.unlock();
+}
+
+uint32_t FakeZnp::resets(void)
+{
+    m_mutex.lock();
+    uint32_t result = m_resets;
+    m_mutex.unlock();
+    return result;
+}
+
+uint32_t FakeZnp::stateClears(void)
+{
+    m_mutex.lock();
+    uint32_t result = m_stateClears;
+    m_mutex.unlock();
+    return result;
+}
+
+uint32_t FakeZnp::markerInits(void)
+{
+    m_mutex.lock();
+    uint32_t result = m_markerInits;
+    m_mutex.unlock();
+    return result;
+}
+
+std::vector <uint16_t> FakeZnp::writes(void)
+{
+    m_mutex.lock();
+    std::vector <uint16_t> result = m_writes;
+    m_mutex.unlock();
+    return result;
+}
+
+std::vector <dataFrameStruct> FakeZnp::dataRequests(void)
+{
+    m_mutex.lock();
+    std::vector <dataFrameStruct> result = m_dataRequests;
+    m_mutex.unlock();
+    return result;
+}
+
+std::map <uint16_t, std::vector <uint8_t>> FakeZnp::nv(void)
+{
+    m_mutex.lock();
+    std::map <uint16_t, std::vector <uint8_t>> result = m_nv;
+    m_mutex.unlock();
+    return result;
+}
+
+void FakeZnp::setNv(const std::map <uint16_t, std::vector <uint8_t>> &nv)
+{
+    m_mutex.lock();
+    m_nv = nv;
+    m_mutex.unlock();
+}
+
+bool FakeZnp::permitJoin(void)
+{
+    m_mutex.lock();
+    bool result = m_permitJoin;
+    m_mutex.unlock();
+    return result;
+}
+
+void FakeZnp::task(void *data)
+{
+    FakeZnp *znp = reinterpret_cast <FakeZnp*> (data);
+    std::vector <uint8_t> input;
+
+    while (1)
+    {
+        pollfd descriptor = {znp->m_fd, POLLIN, 0};
+        uint8_t buffer[256];
+        ssize_t length;
+
+        // master reports hangup till ZStack opens the slave
+        if (poll(&descriptor, 1, -1) <= 0 || !(descriptor.revents & POLLIN) || (length = ::read(znp->m_fd, buffer, sizeof(buffer))) <= 0)
+        {
+            zstackDelay(10);
+            continue;
+        }
+
+        input.insert(input.end(), buffer, buffer + length);
+
+        while (1)
+        {
+            size_t start = 0, size;
+            uint8_t fcs = 0;
+
+            while (start < input.size() && input[start] != ZSTACK_FRAME_FLAG)
+                start++;
+
+            input.erase(input.begin(), input.begin() + start);
+
+            if (input.size() < ZSTACK_MINIMAL_LENGTH || input.size() < (size = input[1] + ZSTACK_MINIMAL_LENGTH))
+                break;
+
+            for (size_t i = 1; i < size - 1; i++)
+                fcs ^= input[i];
+
+            if (fcs == input[size - 1])
+                znp->parseFrame(static_cast <uint16_t> (input[2] << 8 | input[3]), input.data() + 4, input[1]);
+
+            input.erase(input.begin(), input.begin() + (fcs == input[size - 1] ? size : 1));
+        }
+    }
+}
+
+void FakeZnp::parseFrame(uint16_t command, const uint8_t *data, size_t length)
+{
+    uint8_t status = 0x00;
+
+    m_mutex.lock();
+
+    switch (command)
+    {
+        case SYS_RESET_REQ:
+        {
+            uint8_t option = m_nv[ZCD_NV_STARTUP_OPTION][0], reply[] = {0x00, 0x02, 0x02, 0x00, 0x00, 0x00};
+
+            // firmware applies startup option on boot and clears it, clear config also drops state
+
+            if (option & ZCD_STARTUP_CLEAR_CONFIG)
+                factoryNv();
+
+            if (option & (ZCD_STARTUP_CLEAR_CONFIG | ZCD_STARTUP_CLEAR_STATE))
+                m_stateClears++;
+
+            m_nv[ZCD_NV_STARTUP_OPTION][0] = 0x00;
+            m_permitJoin = false;
+            m_resets++;
+
+            m_mutex.unlock();
+            send(SYS_RESET_IND, reply, sizeof(reply));
+            return;
+        }
+
+        case UTIL_GET_DEVICE_INFO:
+        {
+            uint8_t reply[14] = {0x00};
+
+            memcpy(reply + 1, &m_ieeeAddress, sizeof(m_ieeeAddress));
+            reply[11] = 0x07;
+            reply[12] = 0x09;
+
+            m_mutex.unlock();
+            send(command | 0x4000, reply, sizeof(reply));
+            return;
+        }
+
+        case SYS_OSAL_NV_ITEM_INIT:
+        {
+            const nvInitRequestStruct *request = reinterpret_cast <const nvInitRequestStruct*> (data);
+
+            if (request->id == ZCD_NV_MARKER)
+                m_markerInits++;
+
+            if (m_nv.count(request->id))
+                break;
+
+            m_nv[request->id].assign(data + sizeof(nvInitRequestStruct), data + sizeof(nvInitRequestStruct) + request->dataLength);
+            m_nv[request->id].resize(request->itemLength);
+            status = NV_ITEM_UNINIT;
+            break;
+        }
+
+        case SYS_OSAL_NV_READ:
+        {
+            const nvReadRequestStruct *request = reinterpret_cast <const nvReadRequestStruct*> (data);
+            std::vector <uint8_t> reply = {NV_OPER_FAILED, 0x00};
+
+            if (m_nv.count(request->id))
+            {
+                reply = {0x00, static_cast <uint8_t> (m_nv[request->id].size())};
+                reply.insert(reply.end(), m_nv[request->id].begin(), m_nv[request->id].end());
+            }
+
+            m_mutex.unlock();
+            send(command | 0x4000, reply.data(), reply.size());
+            return;
+        }
+
+        case SYS_OSAL_NV_WRITE:
+        {
+            const nvWriteRequestStruct *request = reinterpret_cast <const nvWriteRequestStruct*> (data);
+
+            // items have to exist, firmware does not create them on write
+            if (!m_nv.count(request->id) || request->offset + request->length > m_nv[request->id].size())
+            {
+                status = NV_OPER_FAILED;
+                break;
+            }
+
+            memcpy(m_nv[request->id].data() + request->offset, data + sizeof(nvWriteRequestStruct), request->length);
+
+            if (request->id != ZCD_NV_STARTUP_OPTION)
+                m_writes.push_back(request->id);
+
+            break;
+        }
+
+        case ZDO_STARTUP_FROM_APP:
+        {
+            uint8_t state = 0x09, notification[] = {0x00, 0x02, 0x00};
+
+            m_mutex.unlock();
+            send(command | 0x4000, &status, sizeof(status));
+            send(ZDO_STATE_CHANGE_IND, &state, sizeof(state));
+            send(APP_CNF_BDB_COMMISSIONING_NOTIFICATION, notification, sizeof(notification));
+            return;
+        }
+
+        case ZDO_MGMT_PERMIT_JOIN_REQ:
+        {
+            m_permitJoin = reinterpret_cast <const permitJoinRequestStruct*> (data)->duration != 0x00;
+            break;
+        }
+
+        case AF_DATA_REQUEST:
+        case AF_DATA_REQUEST_SRC_RTG:
+        {
+            dataRequestStruct request;
+            dataConfirmStruct confirm;
+            size_t offset = offsetof(dataRequestStruct, length);
+            std::vector <uint16_t> relays;
+
+            // source routed frame has relay count and list between radius and payload length
+            memcpy(&request, data, offset);
+
+            if (command == AF_DATA_REQUEST_SRC_RTG)
+            {
+                relays.resize(data[offset]);
+                memcpy(relays.data(), data + offset + 1, relays.size() * sizeof(uint16_t));
+                offset += 1 + relays.size() * sizeof(uint16_t);
+            }
+
+            request.length = data[offset];
+            confirm = {ZSTATUS_SUCCESS, request.srcEndpointId, request.transactionId};
+
+            // confirm carries source endpoint, ZStack matches it with transaction id
+            if (m_confirms.count(request.shortAddress))
+            {
+                confirm.status = m_confirms[request.shortAddress];
+                m_confirms.erase(request.shortAddress);
+            }
+
+            m_dataRequests.push_back({command, request.shortAddress, request.transactionId, request.options, request.length, relays});
+
+            if (m_defer)
+                m_deferred.push_back(confirm);
+
+            m_mutex.unlock();
+            send(command | 0x4000, &status, sizeof(status));
+
+            if (!m_defer)
+                send(AF_DATA_CONFIRM, &confirm, sizeof(confirm));
+
+            return;
+        }
+
+        case UTIL_LOOPBACK:
+        {
+            // firmware echoes the whole request payload in SRSP
+            bool drop = m_dropEvery && !(++m_echoes % m_dropEvery);
+
+            m_mutex.unlock();
+
+            if (!drop)
+                send(command | 0x4000, data, length);
+
+            return;
+        }
+
+        case ZDO_BIND_REQ:
+        {
+            bindResponseStruct response = {reinterpret_cast <const bindRequestStruct*> (data)->shortAddress, ZSTATUS_SUCCESS};
+
+            m_mutex.unlock();
+            send(command | 0x4000, &status, sizeof(status));
+            send(ZDO_BIND_RSP, &response, sizeof(response));
+            return;
+        }
+    }
+
+    m_mutex.unlock();
+
+    // every other request gets success, asynchronous ones nothing else
+    if ((command & 0xF000) == 0x2000)
+        send(command | 0x4000, &status, sizeof(status));
+
+    (void) length;
+}
+
+// freshly flashed coordinator firmware, configuration items hold defaults and marker is missing
+void FakeZnp::factoryNv(void)
+{
+    m_nv.clear();
+    m_nv[ZCD_NV_STARTUP_OPTION] = {0x00};
+    m_nv[ZCD_NV_PRECFGKEY] = std::vector <uint8_t> (16, 0x00);
+    m_nv[ZCD_NV_PRECFGKEYS_ENABLE] = {0x00};
+    m_nv[ZCD_NV_PANID] = {0xFF, 0xFF};
+    m_nv[ZCD_NV_CHANLIST] = {0x00, 0x08, 0x00, 0x00};
+    m_nv[ZCD_NV_LOGICAL_TYPE] = {0x00};
+    m_nv[ZCD_NV_ZDO_DIRECT_CB] = {0x00};
+    m_nv[ZCD_NV_CONCENTRATOR_ENABLE] = {0x00};
+    m_nv[ZCD_NV_CONCENTRATOR_DISCOVERY] = {0x78};
+    m_nv[ZCD_NV_CONCENTRATOR_RC] = {0x00};
+}
+
+static void zstackCallback(ZStack *zstack, ZStackEvent event, void *data, size_t)
+{
+    instanceStruct *instance = NULL;
+
+    // instances of finished checks keep running, their events are ignored
+    for (uint8_t i = 0; i < instanceCount; i++)
+        if (instances[i].zstack == zstack)
+            instance = &instances[i];
+
+    if (!instance)
+        return;
+
+    if (shards)
+        shards->parseEvent(zstack, event, NULL, 0);
+
+    switch (event)
+    {
+        case ZStackEvent::configurationMismatch:
+            instance->mismatches++;
+            zstack->update();
+            break;
+
+        case ZStackEvent::coordinatorReady:
+            instance->ready++;
+
+            if (shards)
+                shards->permitJoin(true);
+
+            break;
+
+        case ZStackEvent::deviceJoinedNetwork:
+            instance->joins++;
+            break;
+
+        case ZStackEvent::requestHeld:
+        case ZStackEvent::requestFailed:
+        case ZStackEvent::requestFinished:
+        case ZStackEvent::requestTimeout:
+        case ZStackEvent::bindFinished:
+            instance->mutex.lock();
+            instance->events.push_back({event, *reinterpret_cast <requestStatusStruct*> (data)});
+            instance->mutex.unlock();
+            break;
+
+        default:
+            break;
+    }
+}
+
+static bool waitFor(bool (*condition)(void *), void *context, uint32_t time = SIM_WAIT)
+{
+    uint32_t start = zstackMillis();
+
+    while (!condition(context))
+    {
+        if (zstackMillis() - start > time)
+            return false;
+
+        zstackDelay(5);
+    }
+
+    return true;
+}
+
+static bool check(bool success, const char *name, const char *format, ...)
+{
+    va_list arguments;
+
+    printf("%s %s: ", success ? "PASS" : "FAIL", name);
+    va_start(arguments, format);
+    vprintf(format, arguments);
+    va_end(arguments);
+    printf("\n");
+    fflush(stdout);
+
+    if (!success)
+        failures++;
+
+    return success;
+}
+
+static bool allReady(void *)
+{
+    for (uint8_t i = 0; i < instanceCount; i++)
+        if (!instances[i].ready)
+            return false;
+
+    return true;
+}
+
+static void startInstances(uint8_t count, const std::map <uint16_t, std::vector <uint8_t>> *nv)
+{
+    shards = NULL;
+    instanceCount = 0;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        instanceStruct *instance = &instances[i];
+
+        instance->znp = new FakeZnp(0x00124B0000000001 + i);
+        instance->ready = 0;
+        instance->mismatches = 0;
+        instance->joins = 0;
+        instance->events.clear();
+
+        if (nv)
+            instance->znp->setNv(*nv);
+
+        // never deleted, ZStack tasks never return
+        instance->zstack = new ZStack(new ZStackPosixPort(instance->znp->path()), zstackCallback, SIM_CHANNEL + i * 5, SIM_PANID + i);
+    }
+}
+
+static void runInstances(uint8_t count)
+{
+    instanceCount = count;
+
+    // tasks start only here, after the check created shards callback may use
+    for (uint8_t i = 0; i < count; i++)
+    {
+        if (!instances[i].zstack->start())
+        {
+            perror(instances[i].znp->path());
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    for (uint8_t i = 0; i < count; i++)
+        instances[i].zstack->reset();
+}
+
+// one fake coordinator started from given NV, configured NV comes back for the next check
+static std::map <uint16_t, std::vector <uint8_t>> checkNv(const char *name, const std::map <uint16_t, std::vector <uint8_t>> *nv, const std::vector <uint16_t> &writes, uint32_t resets, uint32_t stateClears)
+{
+    FakeZnp *znp;
+    std::vector <uint16_t> written;
+    std::string list;
+
+    startInstances(1, nv);
+    runInstances(1);
+    znp = instances[0].znp;
+
+    if (!check(waitFor(allReady, NULL), name, "coordinator ready"))
+        return znp->nv();
+
+    zstackDelay(SIM_SETTLE);
+    written = znp->writes();
+
+    for (uint16_t id : written)
+    {
+        char text[8];
+        snprintf(text, sizeof(text), " %04x", id);
+        list += text;
+    }
+
+    check(written == writes && znp->resets() == resets && znp->stateClears() == stateClears && instances[0].ready == 1, name, "writes%s, %u resets, %u state clears, %u mismatch events", list.empty() ? " none" : list.c_str(), znp->resets(), znp->stateClears(), static_cast <uint32_t> (instances[0].mismatches));
+
+    return znp->nv();
+}
+
+static void checkNvScenarios(void)
+{
+    std::map <uint16_t, std::vector <uint8_t>> configured, nv;
+
+    // marker is initialized, every item differing from defaults written, network ones need state clear
+    configured = checkNv("nvEmpty", NULL, {ZCD_NV_MARKER, ZCD_NV_PRECFGKEY, ZCD_NV_PRECFGKEYS_ENABLE, ZCD_NV_PANID, ZCD_NV_ZDO_DIRECT_CB, ZCD_NV_CONCENTRATOR_ENABLE, ZCD_NV_CONCENTRATOR_DISCOVERY, ZCD_NV_CONCENTRATOR_RC}, 2, 1);
+    check(instances[0].znp->markerInits() == 1, "nvEmpty", "marker initialized %u times", instances[0].znp->markerInits());
+
+    checkNv("nvWarmBoot", &configured, {}, 1, 0);
+
+    nv = configured;
+    nv[ZCD_NV_ZDO_DIRECT_CB] = {0x00};
+    checkNv("nvDirectCallback", &nv, {ZCD_NV_ZDO_DIRECT_CB}, 2, 0);
+
+    nv = configured;
+    nv[ZCD_NV_CHANLIST] = {0x00, 0x10, 0x00, 0x00};
+    checkNv("nvChannelList", &nv, {ZCD_NV_CHANLIST}, 2, 1);
+}
+
+static bool joinSettled(void *count)
+{
+    int8_t target = shards->joinInstance();
+    uint32_t joins = 0;
+
+    for (uint8_t i = 0; i < instanceCount; i++)
+    {
+        joins += instances[i].joins;
+
+        if (instances[i].znp->permitJoin() != (i == target))
+            return false;
+    }
+
+    return target >= 0 && joins == *reinterpret_cast <uint32_t*> (count);
+}
+
+static bool requestsDelivered(void *count)
+{
+    size_t requests = 0;
+
+    for (uint8_t i = 0; i < instanceCount; i++)
+        requests += instances[i].znp->dataRequests().size();
+
+    return requests == *reinterpret_cast <size_t*> (count);
+}
+
+static bool devicesKnown(void *count)
+{
+    return instances[0].zstack->devices()->count() == *reinterpret_cast <size_t*> (count);
+}
+
+static bool deviceAwake(void *shortAddress)
+{
+    deviceStruct device;
+    return instances[0].zstack->devices()->findByShortAddress(*reinterpret_cast <uint16_t*> (shortAddress), &device) && zstackMillis() - device.lastSeen < ZSTACK_AWAKE_TIME;
+}
+
+// request events of the first instance with given event type
+static std::vector <requestStatusStruct> requestEvents(ZStackEvent event)
+{
+    std::vector <requestStatusStruct> result;
+
+    instances[0].mutex.lock();
+
+    for (const requestEventStruct &item : instances[0].events)
+        if (item.event == event)
+            result.push_back(item.status);
+
+    instances[0].mutex.unlock();
+    return result;
+}
+
+static bool handleEvent(ZStackEvent event, uint16_t handle, uint8_t status)
+{
+    for (const requestStatusStruct &item : requestEvents(event))
+        if (item.handle == handle && item.status == status)
+            return true;
+
+    return false;
+}
+
+static bool eventPosted(void *expected)
+{
+    const requestEventStruct *item = reinterpret_cast <requestEventStruct*> (expected);
+    return handleEvent(item->event, item->status.handle, item->status.status);
+}
+
+static bool waitEvent(ZStackEvent event, uint16_t handle, uint8_t status, uint32_t time = SIM_WAIT)
+{
+    requestEventStruct expected = {event, {handle, 0x0000, 0x0000, 0x00, status}};
+    return waitFor(eventPosted, &expected, time);
+}
+
+static std::string transactions(const std::vector <dataFrameStruct> &frames)
+{
+    std::string list;
+
+    for (const dataFrameStruct &frame : frames)
+    {
+        char text[8];
+        snprintf(text, sizeof(text), " %02x", frame.transactionId);
+        list += text;
+    }
+
+    return list.empty() ? " none" : list;
+}
+
+static void checkShards(void)
+{
+    ZStack *zstack[2];
+    uint8_t placed[SIM_JOINS], data[] = {0x11, 0x00, 0x02}, moved;
+    uint32_t joins = 0;
+    size_t requests = 0;
+    bool single = true, routed = true;
+    std::string order;
+    std::vector <dataFrameStruct> received;
+
+    startInstances(2, NULL);
+
+    for (uint8_t i = 0; i < 2; i++)
+        zstack[i] = instances[i].zstack;
+
+    shards = new ZStackShards(zstack, 2);
+    runInstances(2);
+
+    if (!check(waitFor(allReady, NULL), "shardsReady", "both coordinators ready"))
+        return;
+
+    // every device is announced by the ZNP permitting join, there has to be exactly one
+    for (uint8_t i = 0; i < SIM_JOINS; i++)
+    {
+        if (!waitFor(joinSettled, &joins))
+        {
+            single = false;
+            break;
+        }
+
+        placed[i] = static_cast <uint8_t> (shards->joinInstance());
+        order += static_cast <char> ('0' + placed[i]);
+        instances[placed[i]].znp->announce(static_cast <uint16_t> (0x1000 + i), 0x00158D0000000000 + i);
+        joins++;
+    }
+
+    if (!check(single && waitFor(joinSettled, &joins), "shardsJoin", "permit join on one instance at a time, joins went to %s", order.c_str()))
+        return;
+
+    check(abs(static_cast <int> (zstack[0]->devices()->count()) - static_cast <int> (zstack[1]->devices()->count())) <= 1, "shardsBalance", "devices split %zu/%zu", zstack[0]->devices()->count(), zstack[1]->devices()->count());
+
+    for (uint8_t i = 0; i < 2; i++)
+        instances[i].znp->clearCounters();
+
+    for (uint8_t i = 0; i < SIM_JOINS; i++)
+    {
+        ZStack *instance = NULL;
+
+        data[1] = i;
+        routed &= shards->dataRequest(0x00158D0000000000 + i, 0x01, 0x0006, data, sizeof(data), &instance) && instance == zstack[placed[i]];
+        requests++;
+
+        if (!waitFor(requestsDelivered, &requests))
+        {
+            routed = false;
+            break;
+        }
+
+        received = instances[placed[i]].znp->dataRequests();
+        routed &= received.back().shortAddress == 0x1000 + i;
+    }
+
+    check(routed && requestsDelivered(&requests), "shardsRouting", "%zu data requests by IEEE address reached ZNP device joined to", requests);
+
+    // device rejoined the other network later, its new entry is the one seen last
+    moved = placed[0] ^ 1;
+    zstackDelay(10);
+    instances[moved].znp->announce(0x2000, 0x00158D0000000000);
+    joins++;
+
+    if (!check(waitFor(joinSettled, &joins), "shardsMove", "device 0 announced on instance %u", moved))
+        return;
+
+    for (uint8_t i = 0; i < 2; i++)
+        instances[i].znp->clearCounters();
+
+    requests = 1;
+    routed = shards->find(0x00158D0000000000) == zstack[moved] && shards->dataRequest(0x00158D0000000000, 0x01, 0x0006, data, sizeof(data)) && waitFor(requestsDelivered, &requests);
+    received = instances[moved].znp->dataRequests();
+    check(routed && received.size() == 1 && received[0].shortAddress == 0x2000, "shardsMove", "request for device moved to instance %u used its new short address", moved);
+}
+
+// end devices announced at once and left asleep, each part of the check uses its own one
+static void checkHold(void)
+{
+    FakeZnp *znp;
+    ZStack *zstack;
+    uint8_t data[] = {0x11, 0x00, 0x02}, write[] = {0x00, 0x00, 0x02, 0x00, 0x00, 0x20, 0x00};
+    uint16_t handle = 0, first, expired = 0x3004;
+    size_t count = 4, requests;
+    std::vector <dataFrameStruct> sent;
+
+    startInstances(1, NULL);
+    runInstances(1);
+    znp = instances[0].znp;
+    zstack = instances[0].zstack;
+
+    if (!check(waitFor(allReady, NULL), "holdReady", "coordinator ready"))
+        return;
+
+    for (uint16_t i = 0; i < count; i++)
+        znp->announce(0x3001 + i, 0x00158D0000001001 + i, SIM_END_DEVICE);
+
+    if (!check(waitFor(devicesKnown, &count), "holdReady", "%zu end devices announced", count))
+        return;
+
+    zstackDelay(ZSTACK_AWAKE_TIME);
+    znp->clearCounters();
+
+    // cluster specific commands, nothing to replace, every one of them waits
+    for (uint8_t i = 1; i <= 3; i++)
+    {
+        data[1] = i;
+        handle = zstack->dataRequest(i, static_cast <uint16_t> (0x3001), 0x01, 0x0006, data, sizeof(data));
+    }
+
+    waitEvent(ZStackEvent::requestHeld, handle, ZSTATUS_SUCCESS);
+    zstackDelay(SIM_SETTLE);
+
+    if (!check(requestEvents(ZStackEvent::requestHeld).size() == 3 && znp->dataRequests().empty(), "holdUntilHeard", "%zu requests held, %zu sent to ZNP", requestEvents(ZStackEvent::requestHeld).size(), znp->dataRequests().size()))
+        return;
+
+    znp->message(0x3001);
+    requests = 3;
+    waitFor(requestsDelivered, &requests);
+    sent = znp->dataRequests();
+    check(sent.size() == 3 && sent[0].transactionId == 1 && sent[1].transactionId == 2 && sent[2].transactionId == 3, "holdRelease", "device heard from, requests sent as%s", transactions(sent).c_str());
+
+    // the same attribute written twice while device sleeps, only the second value goes out
+    znp->clearCounters();
+    write[1] = 0x04;
+    write[6] = 0x01;
+    first = zstack->dataRequest(0x04, static_cast <uint16_t> (0x3002), 0x01, 0x0006, write, sizeof(write));
+    write[1] = 0x05;
+    write[6] = 0x02;
+    handle = zstack->dataRequest(0x05, static_cast <uint16_t> (0x3002), 0x01, 0x0006, write, sizeof(write));
+
+    waitEvent(ZStackEvent::requestFailed, first, ZSTATUS_REPLACED);
+    znp->message(0x3002);
+    waitEvent(ZStackEvent::requestFinished, handle, ZSTATUS_SUCCESS);
+    zstackDelay(SIM_SETTLE);
+    sent = znp->dataRequests();
+    check(handleEvent(ZStackEvent::requestFailed, first, ZSTATUS_REPLACED) && handleEvent(ZStackEvent::requestFinished, handle, ZSTATUS_SUCCESS) && sent.size() == 1 && sent[0].transactionId == 0x05, "holdReplace", "first write failed with replaced status, sent%s", transactions(sent).c_str());
+
+    // held requests take at most ZSTACK_HOLD_COUNT slots, the rest goes to ZNP indirect queue right away
+    znp->clearCounters();
+
+    for (uint8_t i = 0; i < ZSTACK_HOLD_COUNT + 2; i++)
+    {
+        data[1] = 0x10 + i;
+        zstack->dataRequest(0x10 + i, static_cast <uint16_t> (0x3003), 0x01, 0x0006, data, sizeof(data));
+    }
+
+    requests = 2;
+    waitFor(requestsDelivered, &requests);
+    zstackDelay(SIM_SETTLE);
+    sent = znp->dataRequests();
+
+    if (!check(sent.size() == 2 && sent[0].transactionId == 0x10 + ZSTACK_HOLD_COUNT, "holdSpill", "2 over the limit sent right away as%s", transactions(sent).c_str()))
+        return;
+
+    znp->message(0x3003);
+    requests = ZSTACK_HOLD_COUNT + 2;
+    waitFor(requestsDelivered, &requests);
+    check(znp->dataRequests().size() == requests, "holdSpill", "%zu held sent once device was heard from", znp->dataRequests().size() - 2);
+
+    // device heard from just now gets request at once, ZNP drops it from indirect queue unpolled
+    znp->clearCounters();
+    znp->message(expired);
+    waitFor(deviceAwake, &expired);
+    znp->setConfirm(expired, ZSTATUS_MAC_TRANSACTION_EXPIRED);
+    handle = zstack->dataRequest(0x30, expired, 0x01, 0x0006, data, sizeof(data));
+
+    if (!check(waitEvent(ZStackEvent::requestHeld, handle, ZSTATUS_MAC_TRANSACTION_EXPIRED) && znp->dataRequests().size() == 1, "holdExpired", "request held again after transaction expired confirm"))
+        return;
+
+    znp->message(expired);
+    requests = 2;
+    check(waitFor(requestsDelivered, &requests) && waitEvent(ZStackEvent::requestFinished, handle, ZSTATUS_SUCCESS), "holdExpired", "sent again once device was heard from and finished");
+}
+
+// destinations are routers missing in device index, so nothing is held, every confirm is under test control
+static void checkRequests(void)
+{
+    FakeZnp *znp;
+    ZStack *zstack;
+    uint8_t data[] = {0x11, 0x00, 0x02}, status[] = {ZSTATUS_SUCCESS, ZSTATUS_SUCCESS, ZSTATUS_APS_NO_ACK};
+    uint16_t handles[3] = {}, handle = 0;
+    size_t requests = 16;
+    uint32_t start;
+    bool matched = true;
+    std::vector <requestStatusStruct> finished;
+
+    startInstances(1, NULL);
+    runInstances(1);
+    znp = instances[0].znp;
+    zstack = instances[0].zstack;
+
+    if (!check(waitFor(allReady, NULL), "requestsReady", "coordinator ready"))
+        return;
+
+    // successful confirms open congestion window, so several requests wait for confirm at once
+    znp->clearCounters();
+
+    for (uint8_t i = 0; i < requests; i++)
+    {
+        data[1] = i;
+        handle = zstack->dataRequest(i, static_cast <uint16_t> (0x4000 + i % 8), 0x01, 0x0006, data, sizeof(data));
+    }
+
+    matched = waitFor(requestsDelivered, &requests) && waitEvent(ZStackEvent::requestFinished, handle, ZSTATUS_SUCCESS);
+
+    if (!check(matched && zstack->congestionWindow() >= 3, "requestsReady", "window opened to %u by %zu confirms", zstack->congestionWindow(), requests))
+        return;
+
+    znp->clearCounters();
+    znp->deferConfirms(true);
+
+    for (uint8_t i = 0; i < 3; i++)
+    {
+        data[1] = 0x50 + i;
+        handles[i] = zstack->dataRequest(0x50 + i, static_cast <uint16_t> (0x4000 + i), 0x01, 0x0006, data, sizeof(data));
+    }
+
+    requests = 3;
+    waitFor(requestsDelivered, &requests);
+
+    znp->releaseConfirms(1, ZSTATUS_APS_NO_ACK, true);
+    znp->releaseConfirms(2, ZSTATUS_SUCCESS, true);
+
+    for (uint8_t i = 0; i < 3; i++)
+        matched &= waitEvent(ZStackEvent::requestFinished, handles[i], status[i]);
+
+    // events follow the confirms, so the newest request finished first
+    finished = requestEvents(ZStackEvent::requestFinished);
+    matched &= finished.size() >= 3 && finished[finished.size() - 3].handle == handles[2] && finished.back().handle == handles[0];
+
+    check(matched, "requestHandles", "confirms answered newest first finished handles %u %u %u with statuses %02x %02x %02x", handles[0], handles[1], handles[2], status[0], status[1], status[2]);
+
+    handles[0] = zstack->bindRequest(static_cast <uint16_t> (0x4001), 0x00158D0000004001, 0x01, 0x0006);
+    handles[1] = zstack->bindRequest(static_cast <uint16_t> (0x4002), 0x00158D0000004002, 0x01, 0x0402);
+    check(waitEvent(ZStackEvent::bindFinished, handles[0], ZSTATUS_SUCCESS) && waitEvent(ZStackEvent::bindFinished, handles[1], ZSTATUS_SUCCESS), "requestHandles", "bind responses finished handles %u %u", handles[0], handles[1]);
+
+    // confirm never comes, request table gives up on its own
+    requests = 4;
+    data[1] = 0x53;
+    handle = zstack->dataRequest(0x53, static_cast <uint16_t> (0x4003), 0x01, 0x0006, data, sizeof(data));
+    waitFor(requestsDelivered, &requests);
+    znp->dropConfirms();
+    start = zstackMillis();
+
+    matched = waitEvent(ZStackEvent::requestTimeout, handle, ZSTATUS_TIMEOUT, ZSTACK_REQUEST_TIMEOUT + SIM_WAIT);
+    start = zstackMillis() - start;
+    check(matched && start >= ZSTACK_REQUEST_TIMEOUT - SIM_SETTLE, "requestTimeout", "unconfirmed request %u timed out after %u ms", handle, start);
+    znp->deferConfirms(false);
+}
+
+static bool confirmsDeferred(void *count)
+{
+    return instances[0].znp->deferredConfirms() == *reinterpret_cast <size_t*> (count);
+}
+
+// every request sent with confirm deferred, then all confirmed successfully, queued ones go out with immediate confirm
+static uint16_t sendDeferred(ZStack *zstack, const std::vector <uint16_t> &destinations, uint8_t transactionId)
+{
+    uint8_t data[] = {0x11, 0x00, 0x02};
+    uint16_t handle = 0;
+
+    instances[0].znp->clearCounters();
+    instances[0].znp->deferConfirms(true);
+
+    for (uint16_t shortAddress : destinations)
+    {
+        data[1] = transactionId;
+        handle = zstack->dataRequest(transactionId++, shortAddress, 0x01, 0x0006, data, sizeof(data));
+    }
+
+    zstackDelay(SIM_SETTLE);
+    return handle;
+}
+
+static bool confirmDeferred(uint16_t handle)
+{
+    instances[0].znp->deferConfirms(false);
+    instances[0].znp->releaseConfirms(ZSTACK_REQUEST_QUEUE_SIZE, ZSTATUS_SUCCESS, false);
+    return waitEvent(ZStackEvent::requestFinished, handle, ZSTATUS_SUCCESS);
+}
+
+static void checkWindow(void)
+{
+    ZStack *zstack;
+    FakeZnp *znp;
+    std::vector <uint16_t> routers;
+    std::vector <dataFrameStruct> sent;
+    uint16_t handle, first;
+    uint8_t window;
+    size_t waiting;
+
+    startInstances(1, NULL);
+    runInstances(1);
+    znp = instances[0].znp;
+    zstack = instances[0].zstack;
+
+    if (!check(waitFor(allReady, NULL), "windowReady", "coordinator ready"))
+        return;
+
+    for (uint16_t i = 0; i < 8; i++)
+        routers.push_back(0x4000 + i);
+
+    // nothing confirmed yet, only one request waits for confirm
+    handle = sendDeferred(zstack, std::vector <uint16_t> (routers.begin(), routers.begin() + 4), 0x60);
+    waiting = znp->deferredConfirms();
+    window = zstack->congestionWindow();
+
+    if (!check(waiting == 1 && window == 1 && confirmDeferred(handle), "windowStart", "%zu of 4 requests sent with window %u", waiting, window))
+        return;
+
+    for (uint8_t i = 0; i < 2; i++)
+    {
+        handle = sendDeferred(zstack, routers, 0x70 + i * 8);
+
+        if (!confirmDeferred(handle))
+            break;
+    }
+
+    handle = sendDeferred(zstack, routers, 0x80);
+    waiting = znp->deferredConfirms();
+    window = zstack->congestionWindow();
+
+    if (!check(window > 1 && window <= ZSTACK_PIPELINE_DEPTH && waiting == window, "windowGrow", "%zu of 8 requests sent with window %u after 20 confirms", waiting, window))
+        return;
+
+    // ZNP out of buffers, window halves and requests left in flight are over it already
+    first = handle - 7;
+    znp->releaseConfirms(1, ZSTATUS_BUFFER_FULL, false);
+    waitEvent(ZStackEvent::requestFinished, first, ZSTATUS_BUFFER_FULL);
+    zstackDelay(SIM_SETTLE);
+    waiting = znp->deferredConfirms();
+
+    if (!check(zstack->congestionWindow() == (window > 1 ? window >> 1 : 1) && waiting == window - 1u, "windowShrink", "buffer full halved window %u to %u, %zu still waiting", window, zstack->congestionWindow(), waiting) || !confirmDeferred(handle))
+        return;
+
+    // one router gets two requests, the rest waits without holding up request to the other one
+    handle = sendDeferred(zstack, {0x4000, 0x4000, 0x4000, 0x4000, 0x4001}, 0x90);
+    sent = znp->dataRequests();
+
+    if (!check(sent.size() == 3 && sent[0].shortAddress == 0x4000 && sent[1].shortAddress == 0x4000 && sent[2].shortAddress == 0x4001, "windowDestination", "%zu of 5 sent, two to the busy router, then one to the other", sent.size()))
+        return;
+
+    znp->releaseConfirms(1, ZSTATUS_MAC_NO_ACK, false);
+    waitEvent(ZStackEvent::requestFinished, handle - 4, ZSTATUS_MAC_NO_ACK);
+    zstackDelay(SIM_SETTLE);
+    waiting = 2;
+
+    check(confirmsDeferred(&waiting) && znp->dataRequests().size() == 3 && confirmDeferred(handle), "windowDestination", "router window dropped to one after MAC no ack, queued requests sent once confirmed");
+}
+
+// single request of given payload length, frame as fake ZNP received it comes back once it finished with given status
+static bool routeRequest(uint16_t shortAddress, uint8_t transactionId, size_t length, uint8_t status, dataFrameStruct *frame)
+{
+    uint8_t data[ZSTACK_BUFFER_SIZE] = {0x11, 0x00, 0x02};
+    uint16_t handle;
+
+    data[1] = transactionId;
+    handle = instances[0].zstack->dataRequest(transactionId, shortAddress, 0x01, 0x0006, data, length);
+
+    if (!handle || !waitEvent(ZStackEvent::requestFinished, handle, status))
+        return false;
+
+    *frame = instances[0].znp->dataRequests().back();
+    return true;
+}
+
+static void checkRoutes(void)
+{
+    FakeZnp *znp;
+    dataFrameStruct frames[4];
+    std::vector <uint16_t> relays = {0x1111, 0x2222}, longRelays;
+    uint8_t status[] = {ZSTATUS_SUCCESS, ZSTATUS_SUCCESS, ZSTATUS_NWK_NO_ROUTE, ZSTATUS_SUCCESS};
+    bool finished = true;
+
+    startInstances(1, NULL);
+    runInstances(1);
+    znp = instances[0].znp;
+
+    if (!check(waitFor(allReady, NULL), "routesReady", "coordinator ready"))
+        return;
+
+    // unknown, delivered, delivered but failed with no route, unknown again
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        if (status[i])
+            znp->setConfirm(0x5001, status[i]);
+
+        finished &= routeRequest(0x5001, 0xA0 + i, 3, status[i], &frames[i]);
+    }
+
+    check(finished && frames[0].options & AF_DISCV_ROUTE && !(frames[1].options & AF_DISCV_ROUTE) && !(frames[2].options & AF_DISCV_ROUTE) && frames[3].options & AF_DISCV_ROUTE, "routeDiscovery", "options %02x, %02x after delivery, %02x, %02x after no route", frames[0].options, frames[1].options, frames[2].options, frames[3].options);
+
+    // route records are parsed by input task, nothing tells when, so give it a moment
+    for (uint8_t i = 0; i < ZSTACK_ROUTE_RELAYS; i++)
+        longRelays.push_back(0x3000 + i);
+
+    znp->sourceRoute(0x5002, relays);
+    znp->sourceRoute(0x5003, longRelays);
+    zstackDelay(SIM_SETTLE);
+
+    finished = routeRequest(0x5002, 0xB0, 3, ZSTATUS_SUCCESS, &frames[0]) && routeRequest(0x5002, 0xB1, SIM_LONG_PAYLOAD, ZSTATUS_SUCCESS, &frames[1]);
+    check(finished && frames[0].command == AF_DATA_REQUEST_SRC_RTG && frames[0].relays == relays && !(frames[0].options & AF_DISCV_ROUTE) && frames[0].length == 3 && frames[1].command == AF_DATA_REQUEST_SRC_RTG && frames[1].length == SIM_LONG_PAYLOAD, "routeSource", "%u and %u byte payloads sent source routed over %zu relays", frames[0].length, frames[1].length, frames[0].relays.size());
+
+    finished = routeRequest(0x5003, 0xB2, 3, ZSTATUS_SUCCESS, &frames[0]) && routeRequest(0x5003, 0xB3, SIM_LONG_PAYLOAD, ZSTATUS_SUCCESS, &frames[1]);
+    check(finished && frames[0].command == AF_DATA_REQUEST_SRC_RTG && frames[0].relays == longRelays && frames[1].command == AF_DATA_REQUEST && frames[1].options & AF_DISCV_ROUTE && frames[1].length == SIM_LONG_PAYLOAD, "routeSourceLimit", "%zu relays used for %u byte payload, %u byte one sent as %04x with options %02x", frames[0].relays.size(), frames[0].length, frames[1].length, frames[1].command, frames[1].options);
+}
+
+static void checkLink(void)
+{
+    FakeZnp *znp;
+    ZStack *zstack;
+    linkTestStruct result;
+    bool success;
+
+    startInstances(1, NULL);
+    runInstances(1);
+    znp = instances[0].znp;
+    zstack = instances[0].zstack;
+
+    if (!check(waitFor(allReady, NULL), "linkReady", "coordinator ready"))
+        return;
+
+    zstackDelay(SIM_SETTLE);
+    success = zstack->linkTest(SIM_LINK_TEST_TIME, 64, &result);
+    check(success && result.sent && result.received == result.sent && !result.lost, "linkTest", "%u sent, %u received, %u lost, %u bytes/s", result.sent, result.received, result.lost, result.rate);
+
+    // lost ones are counted from gaps in echoed sequence, so the count is exact up to the frames in flight at the end
+    znp->dropEchoes(SIM_LINK_TEST_DROP);
+    success = zstack->linkTest(SIM_LINK_TEST_TIME, 64, &result);
+    znp->dropEchoes(0);
+    check(success && result.received + result.lost == result.sent && abs(static_cast <int> (result.lost) - static_cast <int> (result.sent / SIM_LINK_TEST_DROP)) <= ZSTACK_LINK_TEST_WINDOW, "linkTestDrop", "%u sent, %u lost with one in %u echoes dropped", result.sent, result.lost, SIM_LINK_TEST_DROP);
+}
+
+int main(void)
+{
+    checkNvScenarios();
+    checkShards();
+    checkHold();
+    checkRequests();
+    checkWindow();
+    checkRoutes();
+    checkLink();
+
+    printf("%u checks failed\n", failures);
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
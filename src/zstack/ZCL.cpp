@@ -0,0 +1,244 @@
+#include <math.h>
+#include "ZCL.h"
+
+#define TYPE_FIXED(size)                    (0x40 | (size))
+#define TYPE_ANALOG(size)                   (0x60 | (size))
+#define TYPE_STRING(prefix)                 (0x80 | (prefix))
+#define TYPE_COLLECTION                     0xC0
+
+#define TYPE_KIND(entry)                    ((entry) & 0xC0)
+#define TYPE_SIZE(entry)                    ((entry) & 0x1F)
+#define TYPE_IS_ANALOG(entry)               (((entry) & 0xE0) == 0x60)
+
+#define MAXIMAL_NESTING                     4
+
+// look Zigbee Cluster Library Specification for all data types, zero entry is reserved type
+static constexpr uint8_t dataTypes[256] =
+{
+    TYPE_FIXED(0),  0,              0,              0,              0,              0,              0,              0,              TYPE_FIXED(1),  TYPE_FIXED(2),  TYPE_FIXED(3),  TYPE_FIXED(4),  TYPE_FIXED(5),  TYPE_FIXED(6),  TYPE_FIXED(7),  TYPE_FIXED(8),  // 0x00 no data, data
+    TYPE_FIXED(1),  0,              0,              0,              0,              0,              0,              0,              TYPE_FIXED(1),  TYPE_FIXED(2),  TYPE_FIXED(3),  TYPE_FIXED(4),  TYPE_FIXED(5),  TYPE_FIXED(6),  TYPE_FIXED(7),  TYPE_FIXED(8),  // 0x10 boolean, bitmap
+    TYPE_ANALOG(1), TYPE_ANALOG(2), TYPE_ANALOG(3), TYPE_ANALOG(4), TYPE_ANALOG(5), TYPE_ANALOG(6), TYPE_ANALOG(7), TYPE_ANALOG(8), TYPE_ANALOG(1), TYPE_ANALOG(2), TYPE_ANALOG(3), TYPE_ANALOG(4), TYPE_ANALOG(5), TYPE_ANALOG(6), TYPE_ANALOG(7), TYPE_ANALOG(8), // 0x20 unsigned, signed
+    TYPE_FIXED(1),  TYPE_FIXED(2),  0,              0,              0,              0,              0,              0,              TYPE_ANALOG(2), TYPE_ANALOG(4), TYPE_ANALOG(8), 0,              0,              0,              0,              0,              // 0x30 enum, float
+    0,              TYPE_STRING(1), TYPE_STRING(1), TYPE_STRING(2), TYPE_STRING(2), 0,              0,              0,              TYPE_COLLECTION,0,              0,              0,              TYPE_COLLECTION,0,              0,              0,              // 0x40 string, array, structure
+    TYPE_COLLECTION,TYPE_COLLECTION,0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              // 0x50 set, bag
+    0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              // 0x60
+    0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              // 0x70
+    0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              // 0x80
+    0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              // 0x90
+    0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              // 0xA0
+    0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              // 0xB0
+    0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              // 0xC0
+    0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              // 0xD0
+    TYPE_ANALOG(4), TYPE_ANALOG(4), TYPE_ANALOG(4), 0,              0,              0,              0,              0,              TYPE_FIXED(2),  TYPE_FIXED(2),  TYPE_FIXED(4),  0,              0,              0,              0,              0,              // 0xE0 time, identifiers
+    TYPE_FIXED(8),  TYPE_FIXED(16), 0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              0,              TYPE_FIXED(0)   // 0xF0 ieee address, security key, unknown
+};
+
+static_assert(TYPE_SIZE(dataTypes[DATA_TYPE_DOUBLE_PRECISION]) == 8 && TYPE_KIND(dataTypes[DATA_TYPE_STRUCTURE]) == TYPE_COLLECTION, "ZCL data type table is broken");
+
+static uint64_t readValue(const uint8_t *data, size_t size)
+{
+    uint64_t value = 0;
+
+    for (size_t i = size < 8 ? size : 8; i; i--)
+        value = value << 8 | data[i - 1];
+
+    return value;
+}
+
+static bool valueSize(uint8_t dataType, const uint8_t *data, size_t length, size_t *size, uint8_t depth)
+{
+    uint8_t entry = dataTypes[dataType];
+
+    switch (TYPE_KIND(entry))
+    {
+        case TYPE_FIXED(0):
+        {
+            *size = TYPE_SIZE(entry);
+            return *size <= length;
+        }
+
+        case TYPE_STRING(0):
+        {
+            uint8_t prefix = TYPE_SIZE(entry);
+            uint16_t count;
+
+            if (length < prefix)
+                return false;
+
+            // all ones length means invalid value without content
+
+            count = static_cast <uint16_t> (readValue(data, prefix));
+
+            if (count == (prefix == 1 ? 0xFF : 0xFFFF))
+                count = 0;
+
+            *size = prefix + count;
+            return *size <= length;
+        }
+
+        case TYPE_COLLECTION:
+        {
+            bool structure = dataType == DATA_TYPE_STRUCTURE;
+            size_t offset = structure ? 2 : 3;
+            uint16_t count;
+
+            if (depth >= MAXIMAL_NESTING || length < offset)
+                return false;
+
+            count = static_cast <uint16_t> (readValue(data + offset - 2, 2));
+
+            if (count == 0xFFFF)
+                count = 0;
+
+            // array, set and bag share one element type, every structure element carries its own type
+
+            for (uint16_t i = 0; i < count; i++)
+            {
+                uint8_t elementType = data[0];
+                size_t elementSize;
+
+                if (structure)
+                {
+                    if (offset >= length)
+                        return false;
+
+                    elementType = data[offset++];
+                }
+
+                if (!valueSize(elementType, data + offset, length - offset, &elementSize, depth + 1))
+                    return false;
+
+                offset += elementSize;
+            }
+
+            *size = offset;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+uint8_t zclDataSize(uint8_t dataType)
+{
+    uint8_t entry = dataTypes[dataType];
+    return TYPE_KIND(entry) == TYPE_FIXED(0) ? TYPE_SIZE(entry) : 0;
+}
+
+// only analog data types carry reportable change field in configure reporting records
+bool zclAnalogDataType(uint8_t dataType)
+{
+    return TYPE_IS_ANALOG(dataTypes[dataType]);
+}
+
+bool zclValueSize(uint8_t dataType, const uint8_t *data, size_t length, size_t *size)
+{
+    return valueSize(dataType, data, length, size, 0);
+}
+
+uint64_t zclAttributeStruct::unsignedValue(void) const
+{
+    return readValue(data, size);
+}
+
+int64_t zclAttributeStruct::signedValue(void) const
+{
+    uint64_t value = readValue(data, size);
+
+    if (size && size < 8 && (value >> (size * 8 - 1) & 1))
+        value |= ~0ULL << (size * 8);
+
+    return static_cast <int64_t> (value);
+}
+
+double zclAttributeStruct::numericValue(void) const
+{
+    switch (dataType)
+    {
+        case DATA_TYPE_SEMI_PRECISION:
+        {
+            uint16_t value = static_cast <uint16_t> (readValue(data, size));
+            int exponent = value >> 10 & 0x1F;
+            double mantissa = value & 0x3FF, result;
+
+            if (exponent == 0x1F)
+                result = mantissa ? NAN : INFINITY;
+            else if (exponent)
+                result = ldexp(mantissa + 1024, exponent - 25);
+            else
+                result = ldexp(mantissa, -24);
+
+            return value & 0x8000 ? -result : result;
+        }
+
+        case DATA_TYPE_SINGLE_PRECISION:
+        {
+            uint32_t value = static_cast <uint32_t> (readValue(data, size));
+            float result;
+
+            memcpy(&result, &value, sizeof(result));
+            return result;
+        }
+
+        case DATA_TYPE_DOUBLE_PRECISION:
+        {
+            uint64_t value = readValue(data, size);
+            double result;
+
+            memcpy(&result, &value, sizeof(result));
+            return result;
+        }
+    }
+
+    if (dataType >= DATA_TYPE_8BIT_SIGNED && dataType <= DATA_TYPE_64BIT_SIGNED)
+        return static_cast <double> (signedValue());
+
+    return static_cast <double> (unsignedValue());
+}
+
+bool zclAttributeStruct::booleanValue(void) const
+{
+    return unsignedValue() != 0;
+}
+
+ZCLAttributeIterator::ZCLAttributeIterator(const uint8_t *data, size_t length, bool status) : m_data(data), m_end(data + length), m_status(status)
+{
+    parse();
+}
+
+ZCLAttributeIterator &ZCLAttributeIterator::operator ++ (void)
+{
+    m_data = m_attribute.data + m_attribute.size;
+    parse();
+    return *this;
+}
+
+void ZCLAttributeIterator::parse(void)
+{
+    size_t header = m_status ? 3 : 2, length = m_end - m_data;
+
+    // read response record without success status has no data type and value
+
+    if (m_status && length >= header && m_data[2] != STATUS_SUCCESS)
+    {
+        m_attribute.id = static_cast <uint16_t> (readValue(m_data, 2));
+        m_attribute.status = m_data[2];
+        m_attribute.dataType = DATA_TYPE_NO_DATA;
+        m_attribute.data = m_data + header;
+        m_attribute.size = 0;
+        return;
+    }
+
+    if (length > header)
+    {
+        m_attribute.id = static_cast <uint16_t> (readValue(m_data, 2));
+        m_attribute.status = STATUS_SUCCESS;
+        m_attribute.dataType = m_data[header];
+        m_attribute.data = m_data + header + 1;
+
+        if (zclValueSize(m_attribute.dataType, m_attribute.data, m_end - m_attribute.data, &m_attribute.size))
+            return;
+    }
+
+    m_data = m_end;
+}
@@ -0,0 +1,169 @@
+#ifndef ZCL_H
+#define ZCL_H
+
+#include "ZStackPlatform.h"
+
+// few ZCL definitions here, look Zigbee Cluster Library Specification for more info
+
+#define FC_DISABLE_DEFAULT_RESPONSE         0x10
+#define FC_SERVER_TO_CLIENT                 0x08
+#define FC_MANUFACTURER_SPECIFIC            0x04
+#define FC_CLUSTER_SPECIFIC                 0x01
+#define CMD_READ_ATTRIBUTES                 0x00
+#define CMD_READ_ATTRIBUTES_RESPONSE        0x01
+#define CMD_WRITE_ATTRIBUTES                0x02
+#define CMD_WRITE_ATTRIBUTES_UNDIVIDED      0x03
+#define CMD_WRITE_ATTRIBUTES_NO_RESPONSE    0x05
+#define CMD_CONFIGURE_REPORTING             0x06
+#define CMD_CONFIGURE_REPORTING_RESPONSE    0x07
+#define CMD_REPORT_ATTRIBUTES               0x0A
+#define CMD_DEFAULT_RESPONSE                0x0B
+
+#define GROUPS_ADD_GROUP                    0x00
+#define GROUPS_REMOVE_GROUP                 0x03
+
+#define OTA_IMAGE_NOTIFY                    0x00
+#define OTA_QUERY_NEXT_IMAGE_REQUEST        0x01
+#define OTA_QUERY_NEXT_IMAGE_RESPONSE       0x02
+#define OTA_IMAGE_BLOCK_REQUEST             0x03
+#define OTA_IMAGE_BLOCK_RESPONSE            0x05
+#define OTA_UPGRADE_END_REQUEST             0x06
+#define OTA_UPGRADE_END_RESPONSE            0x07
+
+#define STATUS_SUCCESS                      0x00
+#define STATUS_FAILURE                      0x01
+#define STATUS_MALFORMED_COMMAND            0x80
+#define STATUS_UNSUPPORTED_ATTRIBUTE        0x86
+#define STATUS_UNREPORTABLE_ATTRIBUTE       0x8C
+#define STATUS_TIMEOUT                      0x94
+#define STATUS_ABORT                        0x95
+#define STATUS_WAIT_FOR_DATA                0x97
+#define STATUS_NO_IMAGE_AVAILABLE           0x98
+
+#define DATA_TYPE_NO_DATA                   0x00
+#define DATA_TYPE_BOOLEAN                   0x10
+#define DATA_TYPE_8BIT_BITMAP               0x18
+#define DATA_TYPE_16BIT_BITMAP              0x19
+#define DATA_TYPE_8BIT_UNSIGNED             0x20
+#define DATA_TYPE_16BIT_UNSIGNED            0x21
+#define DATA_TYPE_24BIT_UNSIGNED            0x22
+#define DATA_TYPE_32BIT_UNSIGNED            0x23
+#define DATA_TYPE_40BIT_UNSIGNED            0x24
+#define DATA_TYPE_48BIT_UNSIGNED            0x25
+#define DATA_TYPE_56BIT_UNSIGNED            0x26
+#define DATA_TYPE_64BIT_UNSIGNED            0x27
+#define DATA_TYPE_8BIT_SIGNED               0x28
+#define DATA_TYPE_16BIT_SIGNED              0x29
+#define DATA_TYPE_24BIT_SIGNED              0x2A
+#define DATA_TYPE_32BIT_SIGNED              0x2B
+#define DATA_TYPE_40BIT_SIGNED              0x2C
+#define DATA_TYPE_48BIT_SIGNED              0x2D
+#define DATA_TYPE_56BIT_SIGNED              0x2E
+#define DATA_TYPE_64BIT_SIGNED              0x2F
+#define DATA_TYPE_8BIT_ENUM                 0x30
+#define DATA_TYPE_16BIT_ENUM                0x31
+#define DATA_TYPE_SEMI_PRECISION            0x38
+#define DATA_TYPE_SINGLE_PRECISION          0x39
+#define DATA_TYPE_DOUBLE_PRECISION          0x3A
+#define DATA_TYPE_OCTET_STRING              0x41
+#define DATA_TYPE_CHARACTER_STRING          0x42
+#define DATA_TYPE_LONG_OCTET_STRING         0x43
+#define DATA_TYPE_LONG_CHARACTER_STRING     0x44
+#define DATA_TYPE_ARRAY                     0x48
+#define DATA_TYPE_STRUCTURE                 0x4C
+#define DATA_TYPE_SET                       0x50
+#define DATA_TYPE_BAG                       0x51
+#define DATA_TYPE_IEEE_ADDRESS              0xF0
+
+#define CLUSTER_POWER_CONFIGURATION         0x0001
+#define CLUSTER_GROUPS                      0x0004
+#define CLUSTER_OTA_UPGRADE                 0x0019
+#define CLUSTER_TEMPERATURE_MEASUREMENT     0x0402
+#define CLUSTER_SOIL_MOISTURE               0x0408
+
+#pragma pack(push, 1)
+
+struct zclHeader // simplified header without "manufacturer core" field
+{
+    uint8_t  frameControl;
+    uint8_t  transationId;
+    uint8_t  commandId;
+};
+
+struct configureReportingStruct // followed by reportable change field for analog data types only
+{
+    uint8_t  direction;
+    uint16_t attributeId;
+    uint8_t  dataType;
+    uint16_t minInterval;
+    uint16_t maxInterval;
+};
+
+struct configureReportingStatusStruct
+{
+    uint8_t  status;
+    uint8_t  direction;
+    uint16_t attributeId;
+};
+
+#pragma pack(pop)
+
+struct zclAttributeStruct
+{
+    uint16_t id;
+    uint8_t  status;
+    uint8_t  dataType;
+    const uint8_t *data;
+    size_t   size;
+
+    // values are assembled byte by byte from the message, so there is no unaligned access and no copy of the record
+    uint64_t unsignedValue(void) const;
+    int64_t signedValue(void) const;
+    double numericValue(void) const;
+    bool booleanValue(void) const;
+};
+
+class ZCLAttributeIterator
+{
+    public:
+
+        ZCLAttributeIterator(const uint8_t *data, size_t length, bool status);
+
+        const zclAttributeStruct &operator * (void) const { return m_attribute; }
+        const zclAttributeStruct *operator -> (void) const { return &m_attribute; }
+        ZCLAttributeIterator &operator ++ (void);
+        bool operator != (const ZCLAttributeIterator &other) const { return m_data != other.m_data; }
+
+    private:
+
+        const uint8_t *m_data, *m_end;
+        bool m_status;
+        zclAttributeStruct m_attribute;
+
+        void parse(void);
+
+};
+
+// attribute records of report attributes or read attributes response payload, iteration stops at first malformed record
+class ZCLAttributes
+{
+    public:
+
+        ZCLAttributes(const uint8_t *data, size_t length, uint8_t commandId = CMD_REPORT_ATTRIBUTES) : m_data(data), m_length(length), m_status(commandId == CMD_READ_ATTRIBUTES_RESPONSE) {}
+
+        ZCLAttributeIterator begin(void) const { return ZCLAttributeIterator(m_data, m_length, m_status); }
+        ZCLAttributeIterator end(void) const { return ZCLAttributeIterator(m_data + m_length, 0, m_status); }
+
+    private:
+
+        const uint8_t *m_data;
+        size_t m_length;
+        bool m_status;
+
+};
+
+uint8_t zclDataSize(uint8_t dataType);
+bool zclAnalogDataType(uint8_t dataType);
+bool zclValueSize(uint8_t dataType, const uint8_t *data, size_t length, size_t *size);
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef ZCL_SCHEMA_H
+#define ZCL_SCHEMA_H
+
+#include <ratio>
+#include <type_traits>
+#include "ZCL.h"
+#include "ZStackProvisioning.h"
+
+// compile time description of clusters and attributes an application works with, each attribute is declared once
+// with its data type, scale and reporting parameters:
+//
+//     typedef ZCLAttribute <0x0000, DATA_TYPE_16BIT_SIGNED, std::ratio <1, 100>> temperature;
+//     typedef ZCLCluster <CLUSTER_TEMPERATURE_MEASUREMENT, true, temperature> temperatureMeasurement;
+//     typedef ZCLSchema <0x01, temperatureMeasurement> schema;
+//
+// schema gives provisioning profile for configure reporting and typed decoder of reported or read attributes,
+// decoder calls handler(cluster(), attribute(), value) with the value already scaled, so handler needs an overload
+// for every declared attribute or a template catching the rest, and a missing or mistyped one does not build
+//
+// lookup is a chain of comparisons against constant ids unrolled by templates, there is no table to search at runtime,
+// reportable change beyond data type range, scaled booleans and repeated ids are rejected by static asserts
+
+template <uint8_t dataType> struct ZCLType; // data types without specialization can not be declared
+
+#define ZCL_TYPE(dataType, valueType, maximalChange, accessor) \
+    template <> struct ZCLType <dataType> \
+    { \
+        typedef valueType type; \
+        static constexpr uint32_t maxChange = maximalChange; \
+        static type value(const zclAttributeStruct &attribute) { return static_cast <type> (attribute.accessor()); } \
+    };
+
+// reportable change is encoded as integer by provisioning, so discrete and floating point types accept zero only
+ZCL_TYPE(DATA_TYPE_BOOLEAN,          bool,     0,          booleanValue)
+ZCL_TYPE(DATA_TYPE_8BIT_BITMAP,      uint8_t,  0,          unsignedValue)
+ZCL_TYPE(DATA_TYPE_16BIT_BITMAP,     uint16_t, 0,          unsignedValue)
+ZCL_TYPE(DATA_TYPE_8BIT_UNSIGNED,    uint8_t,  0xFF,       unsignedValue)
+ZCL_TYPE(DATA_TYPE_16BIT_UNSIGNED,   uint16_t, 0xFFFF,     unsignedValue)
+ZCL_TYPE(DATA_TYPE_24BIT_UNSIGNED,   uint32_t, 0xFFFFFF,   unsignedValue)
+ZCL_TYPE(DATA_TYPE_32BIT_UNSIGNED,   uint32_t, 0xFFFFFFFF, unsignedValue)
+ZCL_TYPE(DATA_TYPE_8BIT_SIGNED,      int8_t,   0x7F,       signedValue)
+ZCL_TYPE(DATA_TYPE_16BIT_SIGNED,     int16_t,  0x7FFF,     signedValue)
+ZCL_TYPE(DATA_TYPE_24BIT_SIGNED,     int32_t,  0x7FFFFF,   signedValue)
+ZCL_TYPE(DATA_TYPE_32BIT_SIGNED,     int32_t,  0x7FFFFFFF, signedValue)
+ZCL_TYPE(DATA_TYPE_8BIT_ENUM,        uint8_t,  0,          unsignedValue)
+ZCL_TYPE(DATA_TYPE_16BIT_ENUM,       uint16_t, 0,          unsignedValue)
+ZCL_TYPE(DATA_TYPE_SEMI_PRECISION,   float,    0,          numericValue)
+ZCL_TYPE(DATA_TYPE_SINGLE_PRECISION, float,    0,          numericValue)
+ZCL_TYPE(DATA_TYPE_DOUBLE_PRECISION, double,   0,          numericValue)
+
+#undef ZCL_TYPE
+
+template <uint16_t id, uint16_t... ids> struct ZCLContains : std::false_type {};
+template <uint16_t id, uint16_t first, uint16_t... rest> struct ZCLContains <id, first, rest...> : std::integral_constant <bool, id == first || ZCLContains <id, rest...>::value> {};
+
+template <uint16_t... ids> struct ZCLUnique : std::true_type {};
+template <uint16_t first, uint16_t... rest> struct ZCLUnique <first, rest...> : std::integral_constant <bool, !ZCLContains <first, rest...>::value && ZCLUnique <rest...>::value> {};
+
+// scale converts raw value to units, e.g. std::ratio <1, 10> for battery voltage in 100 mV, scaled values are double,
+// unscaled ones keep data type value type, reporting parameters are in raw units as they go to device unchanged
+template <uint16_t attributeId, uint8_t dataType, typename scale = std::ratio <1>, uint16_t minimalInterval = 0, uint16_t maximalInterval = 3600, uint32_t reportableChange = 0>
+struct ZCLAttribute
+{
+    typedef ZCLType <dataType> traits;
+    typedef typename std::conditional <std::ratio_equal <scale, std::ratio <1>>::value, typename traits::type, double>::type value;
+
+    static constexpr uint16_t id = attributeId;
+    static constexpr uint8_t type = dataType;
+    static constexpr uint16_t minInterval = minimalInterval;
+    static constexpr uint16_t maxInterval = maximalInterval;
+    static constexpr uint32_t valueChange = reportableChange;
+
+    static_assert(reportableChange <= traits::maxChange, "reportable change does not fit attribute data type");
+    static_assert(!std::is_same <typename traits::type, bool>::value || std::ratio_equal <scale, std::ratio <1>>::value, "boolean attribute can not be scaled");
+    static_assert(!maximalInterval || minimalInterval <= maximalInterval, "minimal reporting interval is over maximal one");
+
+    static value decode(const zclAttributeStruct &attribute)
+    {
+        return static_cast <value> (std::ratio_equal <scale, std::ratio <1>>::value ? traits::value(attribute) : traits::value(attribute) * static_cast <double> (scale::num) / scale::den);
+    }
+};
+
+template <typename cluster, typename... attributes>
+struct ZCLAttributeDispatch
+{
+    template <typename handler> static bool decode(const zclAttributeStruct &, handler &) { return false; }
+};
+
+template <typename cluster, typename attribute, typename... rest>
+struct ZCLAttributeDispatch <cluster, attribute, rest...>
+{
+    template <typename handler> static bool decode(const zclAttributeStruct &data, handler &callback)
+    {
+        if (data.id != attribute::id)
+            return ZCLAttributeDispatch <cluster, rest...>::decode(data, callback);
+
+        // device does not follow the schema, its value means something else
+        if (data.dataType != attribute::type)
+            return false;
+
+        callback(cluster(), attribute(), attribute::decode(data));
+        return true;
+    }
+};
+
+// attribute count is limited by provisioning, which keeps pending attributes of a cluster in 16 bit mask
+template <uint16_t clusterId, bool bindCluster, typename... attributes>
+struct ZCLCluster
+{
+    static constexpr uint16_t id = clusterId;
+    static constexpr bool bind = bindCluster;
+    static constexpr uint8_t attributeCount = sizeof...(attributes);
+    static constexpr provisionAttributeStruct provisionAttributes[] = {{attributes::id, attributes::type, attributes::minInterval, attributes::maxInterval, attributes::valueChange}...};
+
+    static_assert(sizeof...(attributes) && sizeof...(attributes) <= 16, "cluster must have 1 to 16 attributes");
+    static_assert(ZCLUnique <attributes::id...>::value, "attribute is declared twice in cluster");
+
+    template <typename handler> static bool decode(const zclAttributeStruct &attribute, handler &callback)
+    {
+        return ZCLAttributeDispatch <ZCLCluster, attributes...>::decode(attribute, callback);
+    }
+};
+
+template <uint16_t clusterId, bool bindCluster, typename... attributes>
+constexpr provisionAttributeStruct ZCLCluster <clusterId, bindCluster, attributes...>::provisionAttributes[];
+
+template <typename... clusters>
+struct ZCLClusterDispatch
+{
+    template <typename handler> static bool decode(uint16_t, const zclAttributeStruct &, handler &) { return false; }
+};
+
+template <typename cluster, typename... rest>
+struct ZCLClusterDispatch <cluster, rest...>
+{
+    template <typename handler> static bool decode(uint16_t clusterId, const zclAttributeStruct &attribute, handler &callback)
+    {
+        return clusterId == cluster::id ? cluster::decode(attribute, callback) : ZCLClusterDispatch <rest...>::decode(clusterId, attribute, callback);
+    }
+};
+
+template <uint8_t endpointId, typename... clusters>
+struct ZCLSchema
+{
+    static constexpr provisionClusterStruct provisionClusters[] = {{clusters::id, clusters::bind, clusters::attributeCount, clusters::provisionAttributes}...};
+    static constexpr provisionProfileStruct profile = {endpointId, sizeof...(clusters), provisionClusters};
+
+    static_assert(sizeof...(clusters) && sizeof...(clusters) <= ZSTACK_PROVISION_CLUSTERS, "schema must have 1 to ZSTACK_PROVISION_CLUSTERS clusters");
+    static_assert(ZCLUnique <clusters::id...>::value, "cluster is declared twice in schema");
+
+    // false for attributes not in schema, failed read records and data types other than declared
+    template <typename handler> static bool decode(uint16_t clusterId, const zclAttributeStruct &attribute, handler &callback)
+    {
+        return attribute.status == STATUS_SUCCESS && ZCLClusterDispatch <clusters...>::decode(clusterId, attribute, callback);
+    }
+};
+
+template <uint8_t endpointId, typename... clusters>
+constexpr provisionClusterStruct ZCLSchema <endpointId, clusters...>::provisionClusters[];
+
+template <uint8_t endpointId, typename... clusters>
+constexpr provisionProfileStruct ZCLSchema <endpointId, clusters...>::profile;
+
+#endif
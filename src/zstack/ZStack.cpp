@@ -1,69 +1,123 @@
+#include "ZCL.h"
 #include "ZStack.h"
 
-ZStack::ZStack(ZStackCallback callback, uint8_t channel, uint16_t panId, int8_t bslPin, int8_t rstPin, int8_t rxPin, int8_t txPin, int8_t core) : m_callback(callback), m_bslPin(bslPin), m_rstPin(rstPin), m_clear(false), m_permitJoin(false), m_status(0x00)
+static void ringCopy(uint8_t *ring, size_t size, size_t position, const uint8_t *data, size_t length)
+{
+    size_t offset = position & (size - 1), part = size - offset < length ? size - offset : length;
+
+    memcpy(ring + offset, data, part);
+    memcpy(ring, data + part, length - part);
+}
+
+ZStack::ZStack(ZStackPort *port, ZStackCallback callback, uint8_t channel, uint16_t panId, int8_t core, int8_t eventCore) : m_port(port), m_callback(callback), m_core(core), m_eventCore(eventCore), m_eventPool(ZSTACK_EVENT_POOL_SIZE), m_eventQueue(ZSTACK_EVENT_POOL_SIZE), m_droppedEvents(0), m_pendingEvents(0), m_txSignal(1), m_txSpace(1), m_txHead(0), m_txTail(0), m_linkQueue(ZSTACK_LINK_TEST_WINDOW), m_linkTest(false), m_permitJoin(false), m_resetRequested(false), m_status(0x00), m_resetTime(0), m_nvIndex(0), m_nvMismatch(0), m_nvUpdate(false), m_startupOption(0x00), m_ringHead(0), m_ringTail(0), m_requestHandle(0), m_transactionId(0), m_pipelineDepth(ZSTACK_PIPELINE_DEPTH), m_heldCount(0), m_window(16)
 {
     uint32_t channelList = static_cast <uint32_t> (1 << channel);
 
-    m_nvData[0] = {ZCD_NV_MARKER,            0x01, {ZSTACK_CONFIGURATION_MARKER}};
-    m_nvData[1] = {ZCD_NV_PRECFGKEY,         0x10, {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f}};
-    m_nvData[2] = {ZCD_NV_PRECFGKEYS_ENABLE, 0x01, {0x01}};
-    m_nvData[3] = {ZCD_NV_PANID,             0x02, {static_cast <uint8_t> (panId), static_cast <uint8_t> (panId >> 8)}};
-    m_nvData[4] = {ZCD_NV_CHANLIST,          0x04, {static_cast <uint8_t> (channelList), static_cast <uint8_t> (channelList >> 8), static_cast <uint8_t> (channelList >> 16), static_cast <uint8_t> (channelList >> 24)}};
-    m_nvData[5] = {ZCD_NV_LOGICAL_TYPE,      0x01, {0x00}};
-    m_nvData[6] = {ZCD_NV_ZDO_DIRECT_CB,     0x01, {0x01}};
-    m_nvData[7] = {0x0000};
+    // items marked as network ones are restored from network state on startup, so changing them needs state clear
+    m_nvData[0] = {ZCD_NV_MARKER,                 false, 0x01, {ZSTACK_CONFIGURATION_MARKER}};
+    m_nvData[1] = {ZCD_NV_PRECFGKEY,              true,  0x10, {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f}};
+    m_nvData[2] = {ZCD_NV_PRECFGKEYS_ENABLE,      false, 0x01, {0x01}};
+    m_nvData[3] = {ZCD_NV_PANID,                  true,  0x02, {static_cast <uint8_t> (panId), static_cast <uint8_t> (panId >> 8)}};
+    m_nvData[4] = {ZCD_NV_CHANLIST,               true,  0x04, {static_cast <uint8_t> (channelList), static_cast <uint8_t> (channelList >> 8), static_cast <uint8_t> (channelList >> 16), static_cast <uint8_t> (channelList >> 24)}};
+    m_nvData[5] = {ZCD_NV_LOGICAL_TYPE,           true,  0x01, {0x00}};
+    m_nvData[6] = {ZCD_NV_ZDO_DIRECT_CB,          false, 0x01, {0x01}};
+    m_nvData[7] = {ZCD_NV_CONCENTRATOR_ENABLE,    false, 0x01, {0x01}};
+    m_nvData[8] = {ZCD_NV_CONCENTRATOR_DISCOVERY, false, 0x01, {ZSTACK_CONCENTRATOR_DISCOVERY}};
+    m_nvData[9] = {ZCD_NV_CONCENTRATOR_RC,        false, 0x01, {0x01}};
+    m_nvData[10] = {0x0000};
+
+    memset(&m_startup, 0, sizeof(m_startup));
+    memset(m_requests, 0, sizeof(m_requests));
+    memset(m_destinations, 0, sizeof(m_destinations));
+
+    for (uint8_t i = 0; i < ZSTACK_EVENT_POOL_SIZE; i++)
+        m_eventPool.send(&m_events[i], 0);
+}
 
-    pinMode(m_bslPin, OUTPUT);
-    pinMode(m_rstPin, OUTPUT);
+bool ZStack::start(void)
+{
+    if (!m_port->begin())
+        return false;
 
-    digitalWrite(m_bslPin, HIGH);
+    zstackCreateTask(outputTask, "ZStack Output", 2048, this, ZSTACK_INPUT_PRIORITY, m_core);
 
-    ZSTACK_PORT.begin(115200, SERIAL_8N1, rxPin, txPin);
-    ZSTACK_PORT.setTimeout(10);
+    for (uint8_t i = 0; i < ZSTACK_EVENT_WORKERS; i++)
+        zstackCreateTask(eventTask, "ZStack Event", 4096, this, ZSTACK_EVENT_PRIORITY, m_eventCore);
 
-    xTaskCreatePinnedToCore(inputTask, "ZStack Input", 4096, this, 0, NULL, core);
+    zstackCreateTask(inputTask, "ZStack Input", 4096, this, ZSTACK_INPUT_PRIORITY, m_core);
+    return true;
 }
 
 void ZStack::reset(void)
 {
-    digitalWrite(m_rstPin, LOW);
-    delay(10);
-    digitalWrite(m_rstPin, HIGH);
+    uint8_t type = 0x01;
+
+    m_resetTime = zstackMillis();
+    m_resetRequested = true;
+
+    if (m_port->reset())
+        return;
+
+    sendFrame(SYS_RESET_REQ, &type, sizeof(type));
 }
 
 void ZStack::clear(void)
 {
-    nvWriteRequestStruct request;
-    uint8_t buffer[sizeof(request) + 1];
+    writeStartupOption(ZCD_STARTUP_CLEAR_CONFIG | ZCD_STARTUP_CLEAR_STATE);
+}
 
-    request.id = ZCD_NV_STARTUP_OPTION;
-    request.offset = 0x00;
-    request.length = 0x01;
+void ZStack::update(void)
+{
+    if (!m_nvMismatch)
+        return;
+
+    m_nvUpdate = true;
+    m_nvIndex = 0;
 
-    memcpy(buffer, &request, sizeof(request));
-    buffer[sizeof(request)] = 0x03;
+    if (m_nvMismatch & 1 << m_nvIndex)
+    {
+        initNvMarker();
+        return;
+    }
 
-    m_clear = true;
-    sendFrame(SYS_OSAL_NV_WRITE, buffer, sizeof(buffer));
+    nextNvItem();
+    writeNvItem();
 }
 
-void ZStack::permitJoin(bool enabled)
+uint16_t ZStack::permitJoin(bool enabled)
 {
     permitJoinRequestStruct request;
 
     request.mode = 0x0F;
-    request.dstAddress = 0xFFFC;
+    request.dstAddress = BROADCAST_ROUTERS;
     request.duration = enabled ? 0xFF : 0x00;
     request.significance = 0x00;
 
-    m_permitJoin = enabled;
-    sendFrame(ZDO_MGMT_PERMIT_JOIN_REQ, reinterpret_cast <uint8_t*> (&request), sizeof(request));
+    frameSegmentStruct segment = {&request, sizeof(request)};
+
+    return enqueueRequest(ZDO_MGMT_PERMIT_JOIN_REQ, &segment, 1, request.dstAddress, 0x00, 0x00);
+}
+
+uint16_t ZStack::dataRequest(uint8_t id, uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, uint8_t *data, size_t length)
+{
+    frameSegmentStruct segment = {data, length};
+    return dataRequest(id, shortAddress, endpointId, clusterId, &segment, 1);
 }
 
-void ZStack::dataRequest(uint8_t id, uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, uint8_t *data, size_t length)
+uint16_t ZStack::dataRequest(uint8_t id, uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, const frameSegmentStruct *segments, uint8_t count)
 {
     dataRequestStruct request;
-    uint8_t buffer[sizeof(request) + length];
+    frameSegmentStruct all[ZSTACK_REQUEST_SEGMENTS + 1] = {{&request, sizeof(request)}};
+    size_t length = 0;
+
+    if (count > ZSTACK_REQUEST_SEGMENTS)
+        return 0;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        all[i + 1] = segments[i];
+        length += segments[i].length;
+    }
 
     request.shortAddress = shortAddress;
     request.dstEndpointId = endpointId;
@@ -74,13 +128,10 @@ void ZStack::dataRequest(uint8_t id, uint16_t shortAddress, uint8_t endpointId,
     request.radius = AF_DEFAULT_RADIUS;
     request.length = static_cast <uint8_t> (length);
 
-    memcpy(buffer, &request, sizeof(request));
-    memcpy(buffer + sizeof(request), data, length);
-
-    sendFrame(AF_DATA_REQUEST, reinterpret_cast <uint8_t*> (&buffer), sizeof(buffer));
+    return enqueueRequest(AF_DATA_REQUEST, all, count + 1, shortAddress, endpointId, id, sleeping(shortAddress));
 }
 
-void ZStack::bindRequest(uint16_t shortAddress, uint64_t ieeeAddress, uint8_t endpointId, uint16_t clusterId)
+uint16_t ZStack::bindRequest(uint16_t shortAddress, uint64_t ieeeAddress, uint8_t endpointId, uint16_t clusterId)
 {
     bindRequestStruct request;
 
@@ -89,38 +140,218 @@ void ZStack::bindRequest(uint16_t shortAddress, uint64_t ieeeAddress, uint8_t en
     request.srcEndpointId = endpointId;
     request.clusterId = clusterId;
     request.dstAddressMode = ADDRESS_MODE_64_BIT;
-    request.dstAddress = m_ieeeAddress;
+    request.dstAddress = m_startup.ieeeAddress;
     request.dstEndpointId = 0x01;
 
-    sendFrame(ZDO_BIND_REQ, reinterpret_cast <uint8_t*> (&request), sizeof(request));
+    frameSegmentStruct segment = {&request, sizeof(request)};
+
+    return enqueueRequest(ZDO_BIND_REQ, &segment, 1, shortAddress, endpointId, 0x00);
 }
 
-void ZStack::parseInput(uint8_t *buffer, size_t length)
+uint16_t ZStack::dataRequestExt(uint8_t id, uint8_t addressMode, uint64_t address, uint8_t endpointId, uint16_t clusterId, uint8_t *data, size_t length)
+{
+    dataRequestExtStruct request;
+    frameSegmentStruct segments[] = {{&request, sizeof(request)}, {data, length}};
+    uint16_t shortAddress = static_cast <uint16_t> (address);
+    deviceStruct device;
+
+    if (addressMode == ADDRESS_MODE_64_BIT)
+        shortAddress = m_devices.findByIeeeAddress(address, &device) ? device.shortAddress : 0xFFFE;
+
+    request.dstAddressMode = addressMode;
+    request.dstAddress = address;
+    request.dstEndpointId = addressMode == ADDRESS_MODE_GROUP ? 0xFF : endpointId;
+    request.dstPanId = 0x0000;
+    request.srcEndpointId = 0x01;
+    request.clusterId = clusterId;
+    request.transactionId = id;
+    request.options = AF_DISCV_ROUTE;
+    request.radius = AF_DEFAULT_RADIUS;
+    request.length = static_cast <uint16_t> (length);
+
+    return enqueueRequest(AF_DATA_REQUEST_EXT, segments, 2, shortAddress, endpointId, id);
+}
+
+uint16_t ZStack::addGroup(uint16_t groupId, uint8_t endpointId)
+{
+    addGroupRequestStruct request;
+
+    request.endpointId = endpointId;
+    request.groupId = groupId;
+    memset(request.name, 0, sizeof(request.name));
+
+    frameSegmentStruct segment = {&request, sizeof(request)};
+
+    return enqueueRequest(ZDO_EXT_ADD_GROUP, &segment, 1, groupId, endpointId, 0x00);
+}
+
+uint16_t ZStack::dataRequest(uint8_t id, uint64_t ieeeAddress, uint8_t endpointId, uint16_t clusterId, uint8_t *data, size_t length)
+{
+    deviceStruct device;
+
+    if (!m_devices.findByIeeeAddress(ieeeAddress, &device))
+        return 0;
+
+    return dataRequest(id, device.shortAddress, endpointId, clusterId, data, length);
+}
+
+uint16_t ZStack::bindRequest(uint64_t ieeeAddress, uint8_t endpointId, uint16_t clusterId)
+{
+    deviceStruct device;
+
+    if (!m_devices.findByIeeeAddress(ieeeAddress, &device))
+        return 0;
+
+    return bindRequest(device.shortAddress, ieeeAddress, endpointId, clusterId);
+}
+
+void ZStack::holdEvent(void *data)
+{
+    eventStruct *event = findEvent(data);
+
+    if (!event)
+        return;
+
+    event->references++;
+}
+
+void ZStack::releaseEvent(void *data)
+{
+    eventStruct *event = findEvent(data);
+
+    if (!event || --event->references)
+        return;
+
+    m_pendingEvents--;
+    m_eventPool.send(event, 0);
+}
+
+uint32_t ZStack::droppedEvents(void)
 {
-    size_t offset = 0;
+    return m_droppedEvents;
+}
+
+uint8_t ZStack::pendingEvents(void)
+{
+    return m_pendingEvents;
+}
+
+void ZStack::metrics(metricsStruct *snapshot)
+{
+    m_metrics.snapshot(snapshot);
+    snapshot->droppedEvents = m_droppedEvents;
+}
+
+ZStackDevices *ZStack::devices(void)
+{
+    return &m_devices;
+}
+
+uint8_t ZStack::transactionId(void)
+{
+    uint8_t id;
+
+    m_requestMutex.lock();
+    id = m_transactionId++;
+    m_requestMutex.unlock();
+
+    return id;
+}
+
+uint32_t ZStack::startupTime(void)
+{
+    return m_startup.startupTime;
+}
+
+void ZStack::setPipelineDepth(uint8_t depth)
+{
+    m_requestMutex.lock();
+    m_pipelineDepth = depth ? depth : 1;
+
+    if (m_window > m_pipelineDepth << 4)
+        m_window = m_pipelineDepth << 4;
+
+    m_requestMutex.unlock();
+
+    sendRequests();
+}
+
+uint8_t ZStack::congestionWindow(void)
+{
+    return static_cast <uint8_t> (m_window >> 4);
+}
+
+bool ZStack::linkTest(uint32_t duration, uint8_t length, linkTestStruct *result)
+{
+    uint8_t data[ZSTACK_BUFFER_SIZE - ZSTACK_MINIMAL_LENGTH];
+    loopbackRequestStruct *request = reinterpret_cast <loopbackRequestStruct*> (data);
+    uint32_t start = zstackMillis(), sequence = 0, oldest = 0;
+    void *item;
+
+    if (length < sizeof(loopbackRequestStruct) || length > sizeof(data))
+        return false;
+
+    for (uint8_t i = sizeof(loopbackRequestStruct); i < length; i++)
+        data[i] = i;
+
+    while (m_linkQueue.receive(&item, 0));
 
-    while (length >= offset + ZSTACK_MINIMAL_LENGTH)
+    memset(result, 0, sizeof(linkTestStruct));
+    request->repeats = 0;
+    request->interval = 0;
+    m_linkTest = true;
+
+    while (zstackMillis() - start < duration || sequence != oldest)
     {
-        uint8_t *data = buffer + offset, size = data[1], fcs = 0;
-        uint16_t command = data[2] << 8 | data[3];
+        uint32_t echoed;
 
-        if (data[0] != ZSTACK_FRAME_FLAG)
+        while (sequence - oldest < ZSTACK_LINK_TEST_WINDOW && zstackMillis() - start < duration)
+        {
+            request->sequence = sequence++;
+            sendFrame(UTIL_LOOPBACK, data, length);
+            result->sent++;
+        }
+
+        if (!m_linkQueue.receive(&item, ZSTACK_LINK_TEST_TIMEOUT))
         {
-            offset++;
+            result->lost += sequence - oldest;
+            oldest = sequence;
             continue;
         }
 
-        if (length + offset < size + 5)
-            return;
+        echoed = static_cast <uint32_t> (reinterpret_cast <uintptr_t> (item));
 
-        for (size_t i = 1; i < size + 4; i++)
-            fcs ^= data[i];
+        // echoes come in order, skipped ones are lost, late ones were already counted as lost
+        if (echoed - oldest >= sequence - oldest)
+            continue;
+
+        result->lost += echoed - oldest;
+        result->received++;
+        oldest = echoed + 1;
+    }
+
+    m_linkTest = false;
+
+    result->time = zstackMillis() - start;
+    result->rate = result->time ? static_cast <uint32_t> (static_cast <uint64_t> (result->received) * (length + ZSTACK_MINIMAL_LENGTH) * 1000 / result->time) : 0;
+    return true;
+}
+
+void ZStack::parseInput(uint8_t *buffer, size_t length)
+{
+    while (length)
+    {
+        uint8_t *data;
+        size_t size = ringSpace(&data);
 
-        if (fcs != data[size + 4])
-            return;
+        if (size > length)
+            size = length;
 
-        parseFrame(command, data + 4, size);
-        offset += size + 5;
+        memcpy(data, buffer, size);
+        ringWritten(size);
+
+        buffer += size;
+        length -= size;
     }
 }
 
@@ -134,7 +365,7 @@ void ZStack::parseFrame(uint16_t command, uint8_t *data, size_t length)
 
             if (data[0] && data[0] != 0x09)
             {
-                m_callback(ZStackEvent::configurationFailed, &id, sizeof(id));
+                postEvent(ZStackEvent::configurationFailed, &id, sizeof(id));
                 break;
             }
 
@@ -147,20 +378,28 @@ void ZStack::parseFrame(uint16_t command, uint8_t *data, size_t length)
             nvReadReplyStruct *reply = reinterpret_cast <nvReadReplyStruct*> (data);
             nvDataStruct *item = &m_nvData[m_nvIndex];
 
-            if (reply->status || reply->length != item->length || memcmp(data + sizeof(nvReadReplyStruct), item->value, item->length))
-            {
-                m_callback(ZStackEvent::configurationMismatch, &item->id, sizeof(item->id));
+            if (!item->id)
                 break;
-            }
 
-            m_nvIndex++;
+            if (reply->status || reply->length != item->length || memcmp(data + sizeof(nvReadReplyStruct), item->value, item->length))
+                m_nvMismatch |= 1 << m_nvIndex;
 
-            if (!m_nvData[m_nvIndex].id)
+            item = &m_nvData[++m_nvIndex];
+
+            if (item->id)
+                break;
+
+            if (m_nvMismatch)
+            {
+                for (item = m_nvData; !(m_nvMismatch & 1 << (item - m_nvData)); item++);
+                postEvent(ZStackEvent::configurationMismatch, &item->id, sizeof(item->id));
+            }
+            else
             {
                 afRegisterRequestStruct request;
                 uint8_t buffer[sizeof(request) + 2];
 
-                m_callback(ZStackEvent::coordinatorStarting, &item->id, sizeof(item->id));
+                postEvent(ZStackEvent::coordinatorStarting, &item->id, sizeof(item->id));
 
                 request.endpointId = ZSTACK_ENDPOINT_ID;
                 request.profileId = ZSTACK_ENDPOINT_PROFILE_ID;
@@ -172,29 +411,40 @@ void ZStack::parseFrame(uint16_t command, uint8_t *data, size_t length)
                 memcpy(buffer, &request, sizeof(request));
 
                 sendFrame(AF_REGISTER, buffer, sizeof(buffer));
-                break;
             }
 
-            readNvItem();
             break;
         }
 
         case SYS_OSAL_NV_WRITE:
         {
-            nvDataStruct *item = &m_nvData[m_nvIndex];
+            nvDataStruct *item = m_startupOption ? NULL : &m_nvData[m_nvIndex];
+            uint16_t id = item ? item->id : ZCD_NV_STARTUP_OPTION;
 
             if (data[0])
             {
-                m_callback(ZStackEvent::configurationFailed, &item->id, sizeof(item->id));;
+                postEvent(ZStackEvent::configurationFailed, &id, sizeof(id));
+                break;
+            }
+
+            if (m_startupOption)
+            {
+                reset();
                 break;
             }
 
             m_nvIndex++;
+            nextNvItem();
 
-            if (m_clear || !m_nvData[m_nvIndex].id)
+            if (!m_nvData[m_nvIndex].id)
             {
-                if (!m_clear)
-                    m_callback(ZStackEvent::configurationUpdated, NULL, 0);
+                postEvent(ZStackEvent::configurationUpdated, NULL, 0);
+
+                if (m_nvUpdate && networkMismatch())
+                {
+                    writeStartupOption(ZCD_STARTUP_CLEAR_STATE);
+                    break;
+                }
 
                 reset();
                 break;
@@ -210,7 +460,7 @@ void ZStack::parseFrame(uint16_t command, uint8_t *data, size_t length)
 
             if (data[0])
             {
-                m_callback(ZStackEvent::coordinatorFailed, NULL, 0);
+                postEvent(ZStackEvent::coordinatorFailed, NULL, 0);
                 break;
             }
 
@@ -219,28 +469,36 @@ void ZStack::parseFrame(uint16_t command, uint8_t *data, size_t length)
         }
 
         case AF_DATA_REQUEST:
+        case AF_DATA_REQUEST_EXT:
+        case ZDO_BIND_REQ:
+        case ZDO_MGMT_PERMIT_JOIN_REQ:
+        case ZDO_EXT_ADD_GROUP:
         {
-            m_callback(data[0] ? ZStackEvent::requestFailed : ZStackEvent::requestEnqueued, NULL, 0);
+            requestResponse(command, data[0]);
             break;
         }
 
-        case ZDO_BIND_REQ:
+        case AF_DATA_REQUEST_SRC_RTG:
         {
-            m_callback(data[0] ? ZStackEvent::bindFailed : ZStackEvent::bindEnqueued, NULL, 0);
+            // source routed frame is the same queued data request, only sent in another form
+            requestResponse(AF_DATA_REQUEST, data[0]);
             break;
         }
 
-        case ZDO_MGMT_PERMIT_JOIN_REQ:
+        case ZDO_STARTUP_FROM_APP:
         {
-            m_callback(data[0] ? ZStackEvent::permitJoinFailed : ZStackEvent::permitJoinChanged, &m_permitJoin, sizeof(m_permitJoin));
+            if (data[0] == 0x02)
+                postEvent(ZStackEvent::coordinatorFailed, NULL, 0);
+
             break;
         }
 
-        case ZDO_STARTUP_FROM_APP:
+        case UTIL_LOOPBACK:
         {
-            if (data[0] == 0x02)
-                m_callback(ZStackEvent::coordinatorFailed, NULL, 0);
+            if (!m_linkTest || length < sizeof(loopbackRequestStruct))
+                break;
 
+            m_linkQueue.send(reinterpret_cast <void*> (static_cast <uintptr_t> (reinterpret_cast <loopbackRequestStruct*> (data)->sequence)), 0);
             break;
         }
 
@@ -248,138 +506,1033 @@ void ZStack::parseFrame(uint16_t command, uint8_t *data, size_t length)
         {
             if (data[0])
             {
-                m_callback(ZStackEvent::coordinatorFailed, NULL, 0);
+                postEvent(ZStackEvent::coordinatorFailed, NULL, 0);
                 break;
             }
 
-            memcpy(&m_ieeeAddress, data + 1, sizeof(m_ieeeAddress));
-            readNvItem();
+            memcpy(&m_startup.ieeeAddress, data + 1, sizeof(m_startup.ieeeAddress));
+            readNvItems();
             break;
         }
 
         case SYS_RESET_IND:
         {
-            m_callback(ZStackEvent::resetDetected, NULL, 0);
-            m_nvIndex = 0;
+            postEvent(ZStackEvent::resetDetected, NULL, 0);
 
-            if (m_clear)
-            {
-                nvInitRequestStruct request;
-                uint8_t buffer[sizeof(request) + 1];
-
-                request.id = ZCD_NV_MARKER;
-                request.itemLength = 0x01;
-                request.dataLength = 0x01;
+            if (!m_resetRequested)
+                m_resetTime = zstackMillis();
 
-                memcpy(buffer, &request, sizeof(request));
-                buffer[sizeof(request)] = ZSTACK_CONFIGURATION_MARKER;
+            m_resetRequested = false;
+            m_nvIndex = 0;
+            m_nvMismatch = 0;
+            m_nvUpdate = false;
 
-                m_clear = false;
-                sendFrame(SYS_OSAL_NV_ITEM_INIT, buffer, sizeof(buffer));
+            if (m_startupOption & ZCD_STARTUP_CLEAR_CONFIG)
+            {
+                m_startupOption = 0x00;
+                initNvMarker();
                 break;
             }
 
-            sendFrame(UTIL_GET_DEVICE_INFO, NULL, 0);
+            m_startupOption = 0x00;
+            sendFrame(UTIL_GET_DEVICE_INFO);
             break;
         }
 
         case AF_DATA_CONFIRM:
         {
-            m_callback(ZStackEvent::requestFinished, data, length);
+            dataConfirmStruct *confirm = reinterpret_cast <dataConfirmStruct*> (data);
+            requestFinished(ZStackEvent::requestFinished, AF_DATA_REQUEST, 0x0000, confirm->endpointId, confirm->transactionId, confirm->status);
             break;
         }
 
         case AF_INCOMING_MSG:
         {
-            m_callback(ZStackEvent::messageReceived, data, length);
+            incomingMessageStruct *message = reinterpret_cast <incomingMessageStruct*> (data);
+            m_devices.seen(message->srcAddress, message->linkQuality);
+            releaseRequests(message->srcAddress);
+            postEvent(ZStackEvent::messageReceived, data, length);
             break;
         }
 
         case ZDO_BIND_RSP:
         {
-            m_callback(ZStackEvent::bindFinished, data, length);
+            bindResponseStruct *response = reinterpret_cast <bindResponseStruct*> (data);
+            requestFinished(ZStackEvent::bindFinished, ZDO_BIND_REQ, response->shortAddress, 0x00, 0x00, response->status);
             break;
         }
 
         case ZDO_STATE_CHANGE_IND:
         {
             m_status = data[0];
-            m_callback(ZStackEvent::statusChanged, &m_status, sizeof(m_status));
+            postEvent(ZStackEvent::statusChanged, &m_status, sizeof(m_status));
             break;
         }
 
         case ZDO_END_DEVICE_ANNCE_IND:
         {
-            m_callback(ZStackEvent::deviceJoinedNetwork, data + 2, length);
+            deviceAnnounceStruct *announce = reinterpret_cast <deviceAnnounceStruct*> (data + 2);
+            m_devices.update(announce->ieeeAddress, announce->shortAddress, announce->capabilities);
+            m_routes.remove(announce->shortAddress);
+            releaseRequests(announce->shortAddress);
+            postEvent(ZStackEvent::deviceJoinedNetwork, data + 2, length);
+            break;
+        }
+
+        case ZDO_SRC_RTG_IND:
+        {
+            sourceRouteStruct *route = reinterpret_cast <sourceRouteStruct*> (data);
+
+            if (length >= sizeof(sourceRouteStruct) + route->relayCount * sizeof(uint16_t))
+                m_routes.record(route->shortAddress, data + sizeof(sourceRouteStruct), route->relayCount);
+
             break;
         }
 
         case ZDO_LEAVE_IND:
         {
-            m_callback(ZStackEvent::deviceLeftNetwork, data, length);
+            deviceLeaveStruct *leave = reinterpret_cast <deviceLeaveStruct*> (data);
+
+            if (!leave->rejoin)
+                m_devices.remove(leave->ieeeAddress);
+
+            m_routes.remove(leave->shortAddress);
+
+            postEvent(ZStackEvent::deviceLeftNetwork, data, length);
             break;
         }
 
         case APP_CNF_BDB_COMMISSIONING_NOTIFICATION:
         {
-            if (data[1] == 0x02 && m_status == 0x09)
-                m_callback(data[2] ? ZStackEvent::coordinatorFailed : ZStackEvent::coordinatorReady, reinterpret_cast <uint8_t*> (&m_ieeeAddress), sizeof(m_ieeeAddress));
+            if (data[1] != 0x02 || m_status != 0x09)
+                break;
 
+            m_startup.startupTime = zstackMillis() - m_resetTime;
+            m_metrics.latency(latencyStartup, m_startup.startupTime * 1000);
+            postEvent(data[2] ? ZStackEvent::coordinatorFailed : ZStackEvent::coordinatorReady, &m_startup, sizeof(m_startup));
             break;
         }
     }
 }
 
-void ZStack::sendFrame(uint16_t command, uint8_t *data, size_t length)
+size_t ZStack::encodeFrame(uint16_t command, const frameSegmentStruct *segments, uint8_t count, uint8_t *ring, size_t size, size_t position)
+{
+    uint8_t header[4] = {ZSTACK_FRAME_FLAG, 0x00, static_cast <uint8_t> (command >> 8), static_cast <uint8_t> (command)}, fcs;
+    size_t length = 0;
+
+    for (uint8_t i = 0; i < count; i++)
+        length += segments[i].length;
+
+    header[1] = static_cast <uint8_t> (length);
+    fcs = header[1] ^ header[2] ^ header[3];
+
+    ringCopy(ring, size, position, header, sizeof(header));
+    position += sizeof(header);
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        const uint8_t *data = reinterpret_cast <const uint8_t*> (segments[i].data);
+
+        if (!segments[i].length)
+            continue;
+
+        for (size_t j = 0; j < segments[i].length; j++)
+            fcs ^= data[j];
+
+        ringCopy(ring, size, position, data, segments[i].length);
+        position += segments[i].length;
+    }
+
+    ringCopy(ring, size, position, &fcs, sizeof(fcs));
+    return length + ZSTACK_MINIMAL_LENGTH;
+}
+
+bool ZStack::sendFrame(uint16_t command, const void *data, size_t length)
+{
+    frameSegmentStruct segment = {data, length};
+    return sendFrame(command, &segment, 1);
+}
+
+bool ZStack::sendFrame(uint16_t command, const frameSegmentStruct *segments, uint8_t count)
+{
+    uint32_t start = zstackMillis();
+    size_t length = 0;
+
+    for (uint8_t i = 0; i < count; i++)
+        length += segments[i].length;
+
+    if (length > ZSTACK_MAXIMAL_LENGTH - ZSTACK_MINIMAL_LENGTH)
+    {
+        m_metrics.rejectedFrame();
+        return false;
+    }
+
+    m_txMutex.lock();
+
+    while (ZSTACK_TX_RING_SIZE - (m_txHead - m_txTail) < length + ZSTACK_MINIMAL_LENGTH)
+    {
+        void *item;
+
+        m_txMutex.unlock();
+
+        if (zstackMillis() - start >= ZSTACK_TX_TIMEOUT)
+        {
+            m_metrics.rejectedFrame();
+            return false;
+        }
+
+        m_txSpace.receive(&item, ZSTACK_TX_TIMEOUT / 10);
+        m_txMutex.lock();
+    }
+
+    m_txHead += encodeFrame(command, segments, count, m_txRing, ZSTACK_TX_RING_SIZE, m_txHead);
+    m_metrics.level(levelOutput, static_cast <uint32_t> (m_txHead - m_txTail));
+    m_txMutex.unlock();
+
+    m_metrics.frameSent(command);
+
+    m_txSignal.send(NULL, 0);
+    return true;
+}
+
+void ZStack::readNvItems(void)
+{
+    for (nvDataStruct *item = m_nvData; item->id; item++)
+    {
+        nvReadRequestStruct request;
+
+        request.id = item->id;
+        request.offset = 0x00;
+
+        sendFrame(SYS_OSAL_NV_READ, &request, sizeof(request));
+    }
+}
+
+void ZStack::initNvMarker(void)
 {
-    uint8_t buffer[ZSTACK_BUFFER_SIZE] = {ZSTACK_FRAME_FLAG, static_cast <uint8_t> (length), static_cast <uint8_t> (command >> 8), static_cast <uint8_t> (command)}, fcs = 0;
+    nvInitRequestStruct request;
+    uint8_t marker = ZSTACK_CONFIGURATION_MARKER;
+    frameSegmentStruct segments[] = {{&request, sizeof(request)}, {&marker, sizeof(marker)}};
+
+    request.id = ZCD_NV_MARKER;
+    request.itemLength = 0x01;
+    request.dataLength = 0x01;
+
+    m_nvIndex = 0;
+    sendFrame(SYS_OSAL_NV_ITEM_INIT, segments, 2);
+}
 
-    memcpy(buffer + 4, data, length);
+void ZStack::nextNvItem(void)
+{
+    while (m_nvUpdate && m_nvData[m_nvIndex].id && !(m_nvMismatch & 1 << m_nvIndex))
+        m_nvIndex++;
+}
 
-    for (size_t i = 1; i < length + 4; i++)
-        fcs ^= buffer[i];
+bool ZStack::networkMismatch(void)
+{
+    for (uint8_t i = 0; m_nvData[i].id; i++)
+        if (m_nvData[i].network && m_nvMismatch & 1 << i)
+            return true;
 
-    buffer[length + 4] = fcs;
-    ZSTACK_PORT.write(buffer, length + 5);
+    return false;
 }
 
-void ZStack::readNvItem(void)
+void ZStack::writeStartupOption(uint8_t option)
 {
-    nvReadRequestStruct request;
+    nvWriteRequestStruct request;
+    frameSegmentStruct segments[] = {{&request, sizeof(request)}, {&option, sizeof(option)}};
 
-    request.id = m_nvData[m_nvIndex].id;
+    request.id = ZCD_NV_STARTUP_OPTION;
     request.offset = 0x00;
+    request.length = 0x01;
 
-    sendFrame(SYS_OSAL_NV_READ, reinterpret_cast <uint8_t*> (&request), sizeof(request));
+    m_startupOption = option;
+    sendFrame(SYS_OSAL_NV_WRITE, segments, 2);
 }
 
 void ZStack::writeNvItem(void)
 {
     nvWriteRequestStruct request;
     nvDataStruct *item = &m_nvData[m_nvIndex];
-    uint8_t buffer[sizeof(request) + item->length];
+    frameSegmentStruct segments[] = {{&request, sizeof(request)}, {item->value, item->length}};
 
     request.id = item->id;
     request.offset = 0x00;
     request.length = item->length;
 
-    memcpy(buffer, &request, sizeof(request));
-    memcpy(buffer + sizeof(request), item->value, item->length);
-
-    sendFrame(SYS_OSAL_NV_WRITE, reinterpret_cast <uint8_t*> (&buffer), sizeof(buffer));
+    sendFrame(SYS_OSAL_NV_WRITE, segments, 2);
 }
 
-void ZStack::inputTask(void *data)
+uint16_t ZStack::enqueueRequest(uint16_t command, const frameSegmentStruct *segments, uint8_t count, uint16_t shortAddress, uint8_t endpointId, uint8_t transactionId, bool hold)
 {
-    ZStack *zstack = reinterpret_cast <ZStack*> (data);
-    uint8_t buffer[ZSTACK_BUFFER_SIZE];
+    requestStatusStruct replaced[ZSTACK_REQUEST_QUEUE_SIZE], info;
+    requestStruct *held = NULL;
+    uint16_t handle = 0;
+    uint8_t replacedCount = 0, used = 0;
+    size_t length = 0;
 
-    while (1)
+    for (uint8_t i = 0; i < count; i++)
+        length += segments[i].length;
+
+    if (length > sizeof(m_requests[0].data))
+        return 0;
+
+    m_requestMutex.lock();
+
+    // held requests never take all slots, requests to awake devices would have nowhere to go,
+    // over the limit request is sent right away and left to ZNP indirect queue
+
+    if (hold && m_heldCount >= ZSTACK_HOLD_COUNT)
+        hold = false;
+
+    for (uint8_t i = 0; i < ZSTACK_REQUEST_QUEUE_SIZE; i++)
     {
-        if (ZSTACK_PORT.available())
+        requestStruct *request = &m_requests[i];
+
+        if (request->state != requestFree)
+            continue;
+
+        if (!++m_requestHandle)
+            m_requestHandle++;
+
+        handle = m_requestHandle;
+
+        request->handle = handle;
+        request->command = command;
+        request->shortAddress = shortAddress;
+        request->transactionId = transactionId;
+        request->endpointId = endpointId;
+        request->state = hold ? requestHeld : requestQueued;
+        request->time = zstackMillis();
+        request->length = static_cast <uint8_t> (length);
+        length = 0;
+
+        for (uint8_t j = 0; j < count; j++)
+        {
+            if (!segments[j].length)
+                continue;
+
+            memcpy(request->data + length, segments[j].data, segments[j].length);
+            length += segments[j].length;
+        }
+
+        if (hold)
         {
-            size_t length = ZSTACK_PORT.read(buffer, sizeof(buffer));
-            zstack->parseInput(buffer, length);
+            held = request;
+            m_heldCount++;
+            m_metrics.level(levelHeldRequests, m_heldCount);
         }
+
+        break;
+    }
+
+    for (uint8_t i = 0; handle && i < ZSTACK_REQUEST_QUEUE_SIZE; i++)
+        if (m_requests[i].state != requestFree)
+            used++;
+
+    m_metrics.level(levelRequests, used);
+
+    // device gets only the latest value of attributes written while it sleeps
+
+    for (uint8_t i = 0; held && i < ZSTACK_REQUEST_QUEUE_SIZE; i++)
+    {
+        requestStruct *request = &m_requests[i];
+
+        if (request == held || request->state != requestHeld || !replaces(held, request))
+            continue;
+
+        replaced[replacedCount++] = {request->handle, request->command, request->shortAddress, request->transactionId, ZSTATUS_REPLACED};
+        request->state = requestFree;
+        m_heldCount--;
+    }
+
+    m_requestMutex.unlock();
+
+    if (!handle)
+        return 0;
+
+    if (!held)
+    {
+        sendRequests();
+        return handle;
+    }
+
+    info = {handle, command, shortAddress, transactionId, ZSTATUS_SUCCESS};
+    postEvent(ZStackEvent::requestHeld, &info, sizeof(info));
+
+    for (uint8_t i = 0; i < replacedCount; i++)
+        postEvent(ZStackEvent::requestFailed, &replaced[i], sizeof(replaced[i]));
+
+    return handle;
+}
+
+void ZStack::sendRequests(void)
+{
+    requestStruct *request;
+
+    // rejected frame fails its request like ZNP refusal would, so the queue moves on to the next one
+
+    while ((request = nextRequest()) && !sendRequest(request))
+        answerRequest(request->command, ZSTATUS_REJECTED);
+}
+
+ZStack::requestStruct *ZStack::nextRequest(void)
+{
+    requestStruct *next = NULL;
+    uint8_t count = 0;
+    bool spare = false;
+
+    m_requestMutex.lock();
+
+    // destination is created for the chosen request only, scan just needs to know one can be
+
+    for (uint8_t i = 0; i < ZSTACK_DESTINATION_COUNT && !spare; i++)
+        spare = !m_destinations[i].count;
+
+    for (uint8_t i = 0; i < ZSTACK_REQUEST_QUEUE_SIZE; i++)
+    {
+        requestStruct *request = &m_requests[i];
+
+        switch (request->state)
+        {
+            case requestFree:
+            case requestHeld:
+                break;
+
+            case requestQueued:
+
+                if (next && static_cast <int16_t> (request->handle - next->handle) > 0)
+                    break;
+
+                // requests to a congested destination wait without blocking other destinations
+
+                if (request->command == AF_DATA_REQUEST)
+                {
+                    destinationStruct *destination = findDestination(request->shortAddress, false);
+
+                    if (destination ? destination->count >= destination->window : !spare)
+                        break;
+                }
+
+                next = request;
+                break;
+
+            case requestSent:
+                m_requestMutex.unlock();
+                return NULL;
+
+            default:
+                count++;
+                break;
+        }
+    }
+
+    if (!next || count >= m_window >> 4)
+    {
+        m_requestMutex.unlock();
+        return NULL;
+    }
+
+    if (next->command == AF_DATA_REQUEST)
+        findDestination(next->shortAddress, true)->count++;
+
+    next->state = requestSent;
+    next->time = zstackMillis();
+    next->sent = static_cast <uint32_t> (zstackMicros());
+
+    m_requestMutex.unlock();
+    return next;
+}
+
+bool ZStack::sendRequest(requestStruct *request)
+{
+    dataRequestStruct *header = reinterpret_cast <dataRequestStruct*> (request->data);
+    size_t offset = offsetof(dataRequestStruct, length);
+    routeStruct route;
+
+    if (request->command != AF_DATA_REQUEST)
+        return sendFrame(request->command, request->data, request->length);
+
+    // route is chosen when the frame goes out, so records that arrived while it was queued are used already
+
+    switch (m_routes.find(request->shortAddress, &route))
+    {
+        case routeSource:
+        {
+            // relay list makes the frame longer, request it would push over MT frame limit goes out with route discovery
+
+            if (request->length + sizeof(route.relayCount) + route.relayCount * sizeof(uint16_t) > ZSTACK_MAXIMAL_LENGTH - ZSTACK_MINIMAL_LENGTH)
+            {
+                header->options |= AF_DISCV_ROUTE;
+                break;
+            }
+
+            frameSegmentStruct segments[] = {{request->data, offset}, {&route.relayCount, sizeof(route.relayCount)}, {route.relays, route.relayCount * sizeof(uint16_t)}, {request->data + offset, request->length - offset}};
+
+            header->options &= ~AF_DISCV_ROUTE;
+            return sendFrame(AF_DATA_REQUEST_SRC_RTG, segments, 4);
+        }
+
+        case routeDirect:
+            header->options &= ~AF_DISCV_ROUTE;
+            break;
+
+        default:
+            header->options |= AF_DISCV_ROUTE;
+            break;
+    }
+
+    return sendFrame(request->command, request->data, request->length);
+}
+
+bool ZStack::sleeping(uint16_t shortAddress)
+{
+    deviceStruct device;
+
+    // routers and devices missing in device index get their requests right away
+
+    if (!m_devices.findByShortAddress(shortAddress, &device) || device.capabilities & CAPABILITY_RX_ON_WHEN_IDLE)
+        return false;
+
+    return zstackMillis() - device.lastSeen >= ZSTACK_AWAKE_TIME;
+}
+
+void ZStack::releaseRequests(uint16_t shortAddress)
+{
+    uint8_t count = 0;
+
+    m_requestMutex.lock();
+
+    // device just sent something, so it polls for a while, held requests go out in their original order
+
+    for (uint8_t i = 0; m_heldCount && i < ZSTACK_REQUEST_QUEUE_SIZE; i++)
+    {
+        requestStruct *request = &m_requests[i];
+
+        if (request->state != requestHeld || request->shortAddress != shortAddress)
+            continue;
+
+        request->state = requestQueued;
+        m_heldCount--;
+        count++;
+    }
+
+    m_requestMutex.unlock();
+
+    if (count)
+        sendRequests();
+}
+
+bool ZStack::replaces(const requestStruct *request, const requestStruct *held)
+{
+    const dataRequestStruct *a = reinterpret_cast <const dataRequestStruct*> (request->data), *b = reinterpret_cast <const dataRequestStruct*> (held->data);
+    const uint8_t *newer = request->data + sizeof(dataRequestStruct), *older = held->data + sizeof(dataRequestStruct);
+    size_t offset;
+
+    if (request->command != AF_DATA_REQUEST || held->command != AF_DATA_REQUEST || request->shortAddress != held->shortAddress || a->dstEndpointId != b->dstEndpointId || a->clusterId != b->clusterId || a->length < sizeof(zclHeader) || b->length < sizeof(zclHeader))
+        return false;
+
+    // same kind of write attributes command with the same manufacturer code, only transaction id may differ
+
+    offset = newer[0] & FC_MANUFACTURER_SPECIFIC ? 5 : 3;
+
+    if (newer[0] & FC_CLUSTER_SPECIFIC || newer[0] != older[0] || a->length < offset || b->length < offset || memcmp(newer + 1, older + 1, offset - 3) || newer[offset - 1] != older[offset - 1])
+        return false;
+
+    switch (newer[offset - 1])
+    {
+        case CMD_WRITE_ATTRIBUTES:
+        case CMD_WRITE_ATTRIBUTES_UNDIVIDED:
+        case CMD_WRITE_ATTRIBUTES_NO_RESPONSE:
+            break;
+
+        default:
+            return false;
+    }
+
+    // every attribute of the held command is written by the newer one too
+
+    for (size_t i = offset, next; i < b->length; i = next)
+    {
+        bool found = false;
+
+        if (!(next = writeRecord(older, b->length, i)))
+            return false;
+
+        for (size_t j = offset, following; j < a->length && !found; j = following)
+        {
+            if (!(following = writeRecord(newer, a->length, j)))
+                return false;
+
+            found = newer[j] == older[i] && newer[j + 1] == older[i + 1];
+        }
+
+        if (!found)
+            return false;
+    }
+
+    return true;
+}
+
+size_t ZStack::writeRecord(const uint8_t *data, size_t length, size_t offset)
+{
+    size_t size;
+
+    // attribute id, data type and value, returns offset of the next record or 0 if this one is malformed
+
+    if (length - offset < 3 || !zclValueSize(data[offset + 2], data + offset + 3, length - offset - 3, &size))
+        return 0;
+
+    return offset + 3 + size;
+}
+
+void ZStack::requestResponse(uint16_t command, uint8_t status)
+{
+    answerRequest(command, status);
+    sendRequests();
+}
+
+void ZStack::answerRequest(uint16_t command, uint8_t status)
+{
+    requestStatusStruct info = {0x0000, command, 0x0000, 0x00, status};
+    ZStackEvent event;
+
+    m_requestMutex.lock();
+
+    for (uint8_t i = 0; i < ZSTACK_REQUEST_QUEUE_SIZE; i++)
+    {
+        requestStruct *request = &m_requests[i];
+
+        if (request->state != requestSent || request->command != command)
+            continue;
+
+        info.handle = request->handle;
+        info.shortAddress = request->shortAddress;
+        info.transactionId = request->transactionId;
+
+        m_metrics.latency(latencyResponse, static_cast <uint32_t> (zstackMicros()) - request->sent);
+
+        // permit join and group registration have no confirm to wait for, they are finished right here
+
+        if (command == ZDO_MGMT_PERMIT_JOIN_REQ && !status)
+            m_permitJoin = reinterpret_cast <permitJoinRequestStruct*> (request->data)->duration != 0x00;
+
+        if (status || command == ZDO_MGMT_PERMIT_JOIN_REQ || command == ZDO_EXT_ADD_GROUP)
+        {
+            updateWindow(request, status);
+            request->state = requestFree;
+        }
+        else
+        {
+            request->state = requestEnqueued;
+            request->time = zstackMillis();
+        }
+
+        break;
+    }
+
+    m_requestMutex.unlock();
+
+    switch (command)
+    {
+        case AF_DATA_REQUEST:
+        case AF_DATA_REQUEST_EXT:
+            event = status ? ZStackEvent::requestFailed : ZStackEvent::requestEnqueued;
+            break;
+
+        case ZDO_EXT_ADD_GROUP:
+            event = status ? ZStackEvent::requestFailed : ZStackEvent::requestFinished;
+            break;
+
+        case ZDO_BIND_REQ:
+            event = status ? ZStackEvent::bindFailed : ZStackEvent::bindEnqueued;
+            break;
+
+        default:
+            event = status ? ZStackEvent::permitJoinFailed : ZStackEvent::permitJoinChanged;
+            break;
+    }
+
+    if (command == ZDO_MGMT_PERMIT_JOIN_REQ)
+        postEvent(event, &m_permitJoin, sizeof(m_permitJoin));
+    else
+        postEvent(event, &info, sizeof(info));
+}
+
+void ZStack::requestFinished(ZStackEvent event, uint16_t command, uint16_t shortAddress, uint8_t endpointId, uint8_t transactionId, uint8_t status)
+{
+    requestStatusStruct info = {0x0000, command, shortAddress, transactionId, status};
+    requestStruct *match = NULL;
+
+    m_requestMutex.lock();
+
+    // data confirm carries source endpoint and transaction id, bind response carries only device short address,
+    // extended data requests get the same confirm, their source endpoint sits at another offset
+
+    for (uint8_t i = 0; i < ZSTACK_REQUEST_QUEUE_SIZE; i++)
+    {
+        requestStruct *request = &m_requests[i];
+
+        if (request->state != requestEnqueued || (request->command != command && (command != AF_DATA_REQUEST || request->command != AF_DATA_REQUEST_EXT)))
+            continue;
+
+        if (command == AF_DATA_REQUEST)
+        {
+            uint8_t srcEndpointId = request->command == AF_DATA_REQUEST_EXT ? reinterpret_cast <dataRequestExtStruct*> (request->data)->srcEndpointId : reinterpret_cast <dataRequestStruct*> (request->data)->srcEndpointId;
+
+            if (srcEndpointId != endpointId || request->transactionId != transactionId)
+                continue;
+        }
+        else if (request->shortAddress != shortAddress)
+            continue;
+
+        if (!match || static_cast <int16_t> (request->handle - match->handle) < 0)
+            match = request;
+    }
+
+    if (match)
+    {
+        info.handle = match->handle;
+        info.command = match->command;
+        info.shortAddress = match->shortAddress;
+        updateWindow(match, status);
+
+        if (command == AF_DATA_REQUEST)
+            m_metrics.latency(latencyConfirm, static_cast <uint32_t> (zstackMicros()) - match->sent);
+
+        match->state = requestFree;
+
+        // end device did not poll before ZNP dropped the frame, it waits for the device to show up again instead of retry
+
+        if (status == ZSTATUS_MAC_TRANSACTION_EXPIRED && match->command == AF_DATA_REQUEST && m_heldCount < ZSTACK_HOLD_COUNT)
+        {
+            match->state = requestHeld;
+            match->time = zstackMillis();
+            m_heldCount++;
+            event = ZStackEvent::requestHeld;
+        }
+    }
+
+    m_requestMutex.unlock();
+
+    postEvent(event, &info, sizeof(info));
+    sendRequests();
+}
+
+uint32_t ZStack::checkRequests(void)
+{
+    requestStatusStruct expired[ZSTACK_REQUEST_QUEUE_SIZE];
+    uint32_t now = zstackMillis(), timeout = ZSTACK_REQUEST_TIMEOUT;
+    uint8_t count = 0;
+
+    m_requestMutex.lock();
+
+    for (uint8_t i = 0; i < ZSTACK_REQUEST_QUEUE_SIZE; i++)
+    {
+        requestStruct *request = &m_requests[i];
+        uint32_t time = now - request->time, limit = request->state == requestHeld ? ZSTACK_HOLD_TIMEOUT : ZSTACK_REQUEST_TIMEOUT;
+
+        if (request->state != requestSent && request->state != requestEnqueued && request->state != requestHeld)
+            continue;
+
+        if (time < limit)
+        {
+            if (timeout > limit - time)
+                timeout = limit - time;
+
+            continue;
+        }
+
+        expired[count++] = {request->handle, request->command, request->shortAddress, request->transactionId, ZSTATUS_TIMEOUT};
+        updateWindow(request, ZSTATUS_TIMEOUT);
+
+        if (request->state == requestHeld)
+            m_heldCount--;
+
+        request->state = requestFree;
+    }
+
+    m_requestMutex.unlock();
+
+    for (uint8_t i = 0; i < count; i++)
+        postEvent(ZStackEvent::requestTimeout, &expired[i], sizeof(expired[i]));
+
+    if (count)
+        sendRequests();
+
+    return timeout;
+}
+
+ZStack::destinationStruct *ZStack::findDestination(uint16_t shortAddress, bool create)
+{
+    destinationStruct *idle = NULL;
+
+    for (uint8_t i = 0; i < ZSTACK_DESTINATION_COUNT; i++)
+    {
+        destinationStruct *destination = &m_destinations[i];
+
+        if (destination->window && destination->shortAddress == shortAddress)
+            return destination;
+
+        if (destination->count || (idle && static_cast <int32_t> (destination->time - idle->time) >= 0))
+            continue;
+
+        idle = destination;
+    }
+
+    if (!create || !idle)
+        return NULL;
+
+    // least recently used idle destination is recycled, new one starts with full window
+
+    idle->shortAddress = shortAddress;
+    idle->window = ZSTACK_DESTINATION_WINDOW;
+    idle->count = 0;
+    idle->time = zstackMillis();
+
+    return idle;
+}
+
+void ZStack::updateWindow(requestStruct *request, uint8_t status)
+{
+    destinationStruct *destination;
+
+    // extended requests count in global window only, their destinations are groups or broadcasts mostly
+
+    if (request->state == requestQueued || request->state == requestHeld || (request->command != AF_DATA_REQUEST && request->command != AF_DATA_REQUEST_EXT))
+        return;
+
+    switch (status)
+    {
+        case ZSTATUS_SUCCESS:
+
+            if (m_window < m_pipelineDepth << 4)
+                m_window += 256 / m_window ? 256 / m_window : 1;
+
+            if (m_window > m_pipelineDepth << 4)
+                m_window = m_pipelineDepth << 4;
+
+            break;
+
+        case ZSTATUS_MEM_ERROR:
+        case ZSTATUS_BUFFER_FULL:
+        case ZSTATUS_MAC_CHANNEL_ACCESS_FAILURE:
+        case ZSTATUS_MAC_TRANSACTION_OVERFLOW:
+        case ZSTATUS_TIMEOUT:
+            m_window = m_window > 32 ? m_window >> 1 : 16;
+            break;
+    }
+
+    if (request->command != AF_DATA_REQUEST)
+        return;
+
+    m_routes.delivered(request->shortAddress, status);
+
+    if (!(destination = findDestination(request->shortAddress, false)))
+        return;
+
+    if (destination->count)
+        destination->count--;
+
+    destination->time = zstackMillis();
+
+    switch (status)
+    {
+        case ZSTATUS_SUCCESS:
+
+            if (destination->window < ZSTACK_DESTINATION_WINDOW)
+                destination->window++;
+
+            break;
+
+        case ZSTATUS_APS_NO_ACK:
+        case ZSTATUS_NWK_NO_ROUTE:
+        case ZSTATUS_MAC_NO_ACK:
+        case ZSTATUS_MAC_TRANSACTION_EXPIRED:
+        case ZSTATUS_TIMEOUT:
+            destination->window = 1;
+            break;
+    }
+}
+
+ZStack::eventStruct *ZStack::findEvent(void *data)
+{
+    uint8_t *pointer = reinterpret_cast <uint8_t*> (data), *begin = reinterpret_cast <uint8_t*> (m_events);
+    size_t offset = pointer - begin;
+
+    if (pointer < begin || offset >= sizeof(m_events) || offset % sizeof(eventStruct))
+        return NULL;
+
+    return &m_events[offset / sizeof(eventStruct)];
+}
+
+void ZStack::postEvent(ZStackEvent event, const void *data, size_t length)
+{
+    eventStruct *item;
+
+    if (!m_eventPool.receive(reinterpret_cast <void**> (&item), 0))
+    {
+        m_droppedEvents++;
+        return;
+    }
+
+    if (length > sizeof(item->data))
+        length = sizeof(item->data);
+
+    if (length)
+        memcpy(item->data, data, length);
+
+    item->length = length;
+    item->event = event;
+    item->references = 1;
+
+    m_metrics.level(levelEvents, ++m_pendingEvents);
+
+    m_eventQueue.send(item, 0);
+}
+
+size_t ZStack::ringSpace(uint8_t **buffer)
+{
+    size_t offset = m_ringTail & (ZSTACK_RING_SIZE - 1), space = ZSTACK_RING_SIZE - (m_ringTail - m_ringHead);
+
+    // unparsed data never exceeds one partial frame, so there is always room here
+
+    *buffer = m_ring + offset;
+    return ZSTACK_RING_SIZE - offset < space ? ZSTACK_RING_SIZE - offset : space;
+}
+
+void ZStack::ringWritten(size_t length)
+{
+    size_t offset = m_ringTail & (ZSTACK_RING_SIZE - 1);
+
+    if (offset < ZSTACK_MAXIMAL_LENGTH)
+        memcpy(m_ring + ZSTACK_RING_SIZE + offset, m_ring + offset, (offset + length < ZSTACK_MAXIMAL_LENGTH ? offset + length : ZSTACK_MAXIMAL_LENGTH) - offset);
+
+    m_ringTail += length;
+    m_metrics.level(levelInput, static_cast <uint32_t> (m_ringTail - m_ringHead));
+    parseRing();
+}
+
+void ZStack::parseRing(void)
+{
+    size_t skipped = 0;
+
+    // clean stream costs one compare and one xor per byte, each false frame flag costs at most ZSTACK_MAXIMAL_LENGTH xors
+
+    while (m_ringTail - m_ringHead >= ZSTACK_MINIMAL_LENGTH)
+    {
+        uint8_t *data = m_ring + (m_ringHead & (ZSTACK_RING_SIZE - 1)), fcs = 0;
+        size_t size = data[1] + ZSTACK_MINIMAL_LENGTH;
+
+        if (data[0] != ZSTACK_FRAME_FLAG)
+        {
+            m_ringHead++;
+            skipped++;
+            continue;
+        }
+
+        if (m_ringTail - m_ringHead < size)
+            break;
+
+        for (size_t i = 1; i < size - 1; i++)
+            fcs ^= data[i];
+
+        if (fcs != data[size - 1])
+        {
+            m_metrics.fcsError();
+            m_ringHead++;
+            skipped++;
+            continue;
+        }
+
+        m_metrics.frameReceived(data[2] << 8 | data[3]);
+        parseFrame(data[2] << 8 | data[3], data + 4, data[1]);
+        m_ringHead += size;
+    }
+
+    // skipped bytes are added once per read, so noise on the line does not cost an atomic per byte
+
+    if (skipped)
+        m_metrics.skippedBytes(skipped);
+}
+
+void ZStack::inputTask(void *data)
+{
+    ZStack *zstack = reinterpret_cast <ZStack*> (data);
+    bool connected = true;
+
+    while (1)
+    {
+        uint8_t *buffer;
+        size_t space = zstack->ringSpace(&buffer), length = zstack->m_port->read(buffer, space, zstack->checkRequests());
+
+        if (length)
+            zstack->ringWritten(length);
+
+        // requests keep timing out while the transport is gone, application learns why
+
+        if (zstack->m_port->connected() == connected)
+            continue;
+
+        connected = !connected;
+        zstack->postEvent(ZStackEvent::connectionChanged, &connected, sizeof(connected));
+    }
+}
+
+void ZStack::outputTask(void *data)
+{
+    ZStack *zstack = reinterpret_cast <ZStack*> (data);
+
+    while (1)
+    {
+        void *item;
+
+        if (!zstack->m_txSignal.receive(&item, ZSTACK_WAIT_FOREVER))
+            continue;
+
+        // frames queued while previous write was in progress go out together
+        while (1)
+        {
+            size_t head, tail, offset, length;
+
+            zstack->m_txMutex.lock();
+            head = zstack->m_txHead;
+            tail = zstack->m_txTail;
+            zstack->m_txMutex.unlock();
+
+            if (head == tail)
+                break;
+
+            offset = tail & (ZSTACK_TX_RING_SIZE - 1);
+            length = ZSTACK_TX_RING_SIZE - offset < head - tail ? ZSTACK_TX_RING_SIZE - offset : head - tail;
+
+            // bytes port failed to take are dropped, ZNP resyncs on next frame flag
+            zstack->m_port->write(zstack->m_txRing + offset, length);
+
+            zstack->m_txMutex.lock();
+            zstack->m_txTail += length;
+            zstack->m_txMutex.unlock();
+
+            zstack->m_txSpace.send(NULL, 0);
+        }
+    }
+}
+
+void ZStack::eventTask(void *data)
+{
+    ZStack *zstack = reinterpret_cast <ZStack*> (data);
+
+    while (1)
+    {
+        eventStruct *event;
+        uint32_t start;
+
+        if (!zstack->m_eventQueue.receive(reinterpret_cast <void**> (&event), ZSTACK_WAIT_FOREVER))
+            continue;
+
+        start = static_cast <uint32_t> (zstackMicros());
+        zstack->m_callback(zstack, event->event, event->length ? event->data : NULL, event->length);
+        zstack->m_metrics.latency(latencyCallback, static_cast <uint32_t> (zstackMicros()) - start);
+        zstack->releaseEvent(event->data);
     }
 }
@@ -6,21 +6,44 @@
 #define ZSTACK_ENDPOINT_PROFILE_ID                  0x0104 // ZigBee Home Automation Profile
 #define ZSTACK_ENDPOINT_DEVICE_ID                   0x0005 // default for ZigBee Home Automation devices
 
-#define ZSTACK_PORT                                 Serial2
 #define ZSTACK_FRAME_FLAG                           0xFE
 #define ZSTACK_BUFFER_SIZE                          256
 #define ZSTACK_MINIMAL_LENGTH                       5
+#define ZSTACK_MAXIMAL_LENGTH                       260    // flag + length + command + 255 bytes of data + fcs
+#define ZSTACK_RING_SIZE                            1024   // input ring size, must be power of two
+#define ZSTACK_INPUT_PRIORITY                       5      // input task blocks in the port, so it can preempt application tasks
 #define ZSTACK_REQUEST_TIMEOUT                      10000
-
+#define ZSTACK_REQUEST_QUEUE_SIZE                   32     // queued and in-flight requests
+#define ZSTACK_REQUEST_SEGMENTS                     4      // payload segments of one data request
+#define ZSTACK_PIPELINE_DEPTH                       8      // default in-flight requests limit, see setPipelineDepth
+#define ZSTACK_DESTINATION_COUNT                    32     // destinations with own congestion window
+#define ZSTACK_DESTINATION_WINDOW                   2      // maximal in-flight data requests for one destination
+#define ZSTACK_HOLD_COUNT                           16     // request slots data requests for sleeping end devices may take
+#define ZSTACK_HOLD_TIMEOUT                         3600000 // ms held request waits for its device to be heard from
+#define ZSTACK_CONCENTRATOR_DISCOVERY               60     // seconds between many-to-one route requests, devices send route record with next frame to coordinator
+#define ZSTACK_AWAKE_TIME                           3000   // ms after last message end device still polls, requests to it are sent
+#define ZSTACK_EVENT_POOL_SIZE                      32     // event buffers, events are dropped while all of them are in use
+#define ZSTACK_EVENT_WORKERS                        1      // event dispatch tasks, events are delivered in order only with one worker
+#define ZSTACK_EVENT_PRIORITY                       4      // below input task, so slow callbacks never delay parsing
+#define ZSTACK_TX_RING_SIZE                         1024   // output ring size, must be power of two
+#define ZSTACK_TX_TIMEOUT                           1000   // ms to wait for output ring space before frame is rejected
+#define ZSTACK_LINK_TEST_WINDOW                     4      // loopback frames in flight during link test
+#define ZSTACK_LINK_TEST_TIMEOUT                    500    // ms without echo after which in-flight loopback frames are lost
+
+#define SYS_RESET_REQ                               0x4100
 #define SYS_OSAL_NV_ITEM_INIT                       0x2107
 #define SYS_OSAL_NV_READ                            0x2108
 #define SYS_OSAL_NV_WRITE                           0x2109
 #define AF_REGISTER                                 0x2400
 #define AF_DATA_REQUEST                             0x2401
+#define AF_DATA_REQUEST_EXT                         0x2402
+#define AF_DATA_REQUEST_SRC_RTG                     0x2403
 #define ZDO_BIND_REQ                                0x2521
 #define ZDO_MGMT_PERMIT_JOIN_REQ                    0x2536
 #define ZDO_STARTUP_FROM_APP                        0x2540
+#define ZDO_EXT_ADD_GROUP                           0x254B
 #define UTIL_GET_DEVICE_INFO                        0x2700
+#define UTIL_LOOPBACK                               0x2710
 
 #define SYS_RESET_IND                               0x4180
 #define AF_DATA_CONFIRM                             0x4480
@@ -29,6 +52,7 @@
 #define ZDO_MGMT_PERMIT_JOIN_RSP                    0x45B6
 #define ZDO_STATE_CHANGE_IND                        0x45C0
 #define ZDO_END_DEVICE_ANNCE_IND                    0x45C1
+#define ZDO_SRC_RTG_IND                             0x45C4
 #define ZDO_LEAVE_IND                               0x45C9
 #define APP_CNF_BDB_COMMISSIONING_NOTIFICATION      0x4F80
 
@@ -40,18 +64,47 @@
 #define ZCD_NV_CHANLIST                             0x0084
 #define ZCD_NV_LOGICAL_TYPE                         0x0087
 #define ZCD_NV_ZDO_DIRECT_CB                        0x008F
+#define ZCD_NV_CONCENTRATOR_ENABLE                  0x00A1
+#define ZCD_NV_CONCENTRATOR_DISCOVERY               0x00A2
+#define ZCD_NV_CONCENTRATOR_RC                      0x00A5
 #define ZCD_NV_TCLK_TABLE                           0x0101
 
+#define ZCD_STARTUP_CLEAR_CONFIG                    0x01
+#define ZCD_STARTUP_CLEAR_STATE                     0x02
+
+#define ZSTATUS_SUCCESS                             0x00
+#define ZSTATUS_MEM_ERROR                           0x10
+#define ZSTATUS_BUFFER_FULL                         0x11
+#define ZSTATUS_APS_NO_ACK                          0xB7
+#define ZSTATUS_NWK_NO_ROUTE                        0xCD
+#define ZSTATUS_MAC_CHANNEL_ACCESS_FAILURE          0xE1
+#define ZSTATUS_MAC_NO_ACK                          0xE9
+#define ZSTATUS_MAC_TRANSACTION_EXPIRED             0xF0
+#define ZSTATUS_MAC_TRANSACTION_OVERFLOW            0xF1
+#define ZSTATUS_REJECTED                            0xFD   // not ZNP status, frame too long or output ring stayed full, reported like failed SRSP
+#define ZSTATUS_REPLACED                            0xFE   // not ZNP status, held write replaced by newer one, reported with requestFailed event
+#define ZSTATUS_TIMEOUT                             0xFF   // not ZNP status, reported with requestTimeout event
+
 #define AF_DISCV_ROUTE                              0x20
 #define AF_DEFAULT_RADIUS                           0x0F
 
+#define CAPABILITY_RX_ON_WHEN_IDLE                  0x08
+
 #define ADDRESS_MODE_NOT_PRESENT                    0x00
 #define ADDRESS_MODE_GROUP                          0x01
 #define ADDRESS_MODE_16_BIT                         0x02
 #define ADDRESS_MODE_64_BIT                         0x03
 #define ADDRESS_MODE_BROADCAST                      0xFF
 
-#include "Arduino.h"
+#define BROADCAST_ALL                               0xFFFF
+#define BROADCAST_RX_ON_WHEN_IDLE                   0xFFFD
+#define BROADCAST_ROUTERS                           0xFFFC
+
+#include <atomic>
+#include "ZStackDevices.h"
+#include "ZStackMetrics.h"
+#include "ZStackPort.h"
+#include "ZStackRoutes.h"
 
 enum ZStackEvent
 {
@@ -73,10 +126,16 @@ enum ZStackEvent
     bindEnqueued,
     bindFailed,
     bindFinished,
-    messageReceived
+    messageReceived,
+    requestTimeout,
+    requestHeld,
+    connectionChanged
 };
 
-typedef void (*ZStackCallback) (ZStackEvent event, void *data, size_t length);
+class ZStack;
+
+// zstack is the instance that raised the event, so one callback can serve several coordinators
+typedef void (*ZStackCallback) (ZStack *zstack, ZStackEvent event, void *data, size_t length);
 
 #pragma pack(push, 1)
 
@@ -109,6 +168,7 @@ struct nvReadReplyStruct
 struct nvDataStruct
 {
     uint16_t id;
+    bool     network;
     uint8_t  length;
     uint8_t  value[16];
 };
@@ -134,6 +194,27 @@ struct dataRequestStruct
     uint8_t  length;
 };
 
+struct dataRequestExtStruct
+{
+    uint8_t  dstAddressMode;
+    uint64_t dstAddress;
+    uint8_t  dstEndpointId;
+    uint16_t dstPanId;
+    uint8_t  srcEndpointId;
+    uint16_t clusterId;
+    uint8_t  transactionId;
+    uint8_t  options;
+    uint8_t  radius;
+    uint16_t length;
+};
+
+struct addGroupRequestStruct
+{
+    uint8_t  endpointId;
+    uint16_t groupId;
+    uint8_t  name[16];                              // length prefixed, MT takes the whole field, no group names here
+};
+
 struct bindRequestStruct
 {
     uint16_t shortAddress;
@@ -160,6 +241,12 @@ struct deviceAnnounceStruct
     uint8_t  capabilities;
 };
 
+struct sourceRouteStruct                            // followed by relay list
+{
+    uint16_t shortAddress;
+    uint8_t  relayCount;
+};
+
 struct deviceLeaveStruct
 {
     uint16_t shortAddress;
@@ -197,40 +284,249 @@ struct bindResponseStruct
     uint8_t  status;
 };
 
+struct loopbackRequestStruct                        // followed by test pattern, whole payload is echoed in SRSP
+{
+    uint8_t  repeats;
+    uint32_t interval;
+    uint32_t sequence;
+};
+
+struct linkTestStruct
+{
+    uint32_t sent;
+    uint32_t received;
+    uint32_t lost;
+    uint32_t time;                                  // ms
+    uint32_t rate;                                  // frame bytes per second in each direction
+};
+
+struct coordinatorStartupStruct
+{
+    uint64_t ieeeAddress;
+    uint32_t startupTime;                           // ms from reset to coordinator ready or failed
+};
+
+struct requestStatusStruct
+{
+    uint16_t handle;
+    uint16_t command;
+    uint16_t shortAddress;
+    uint8_t  transactionId;
+    uint8_t  status;
+};
+
 #pragma pack(pop)
 
+struct frameSegmentStruct
+{
+    const void *data;
+    size_t length;
+};
+
 class ZStack
 {
     public:
 
-        ZStack(ZStackCallback callback, uint8_t channel, uint16_t panId, int8_t bsl, int8_t rst, int8_t tx, int8_t rx, int8_t core = 0);
+        // callback runs in event worker tasks pinned to event core, -1 lets scheduler choose
+        ZStack(ZStackPort *port, ZStackCallback callback, uint8_t channel, uint16_t panId, int8_t core = 0, int8_t eventCore = -1);
+
+        // begins the port and starts tasks, called once, false if port could not be opened or configured
+        bool start(void);
 
         void reset(void);
+
+        // clear wipes configuration and network state and rewrites every item with two resets,
+        // update writes only items reported as mismatching and clears network state only if one of them needs it
         void clear(void);
-        void permitJoin(bool permit);
-        void dataRequest(uint8_t id, uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, uint8_t *data, size_t length);
-        void bindRequest(uint16_t shortAddress, uint64_t ieeeAddress, uint8_t endpointId, uint16_t clusterId);
+        void update(void);
+
+        // requests are queued and return handle reported back with request events, 0 if queue is full
+        uint16_t permitJoin(bool permit);
+        uint16_t dataRequest(uint8_t id, uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, uint8_t *data, size_t length);
+        uint16_t bindRequest(uint16_t shortAddress, uint64_t ieeeAddress, uint8_t endpointId, uint16_t clusterId);
+
+        // payload gathered from up to ZSTACK_REQUEST_SEGMENTS segments, e.g. header and flash resident data, without staging buffer
+        //
+        // requests to end devices without receiver on when idle and not heard from for ZSTACK_AWAKE_TIME are held
+        // (requestHeld event) until the device sends something, held write attributes command is replaced by newer one
+        // writing the same attributes
+        uint16_t dataRequest(uint8_t id, uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, const frameSegmentStruct *segments, uint8_t count);
+
+        // same requests for devices known from announce, short address is taken from device index, 0 if device is unknown
+        uint16_t dataRequest(uint8_t id, uint64_t ieeeAddress, uint8_t endpointId, uint16_t clusterId, uint8_t *data, size_t length);
+        uint16_t bindRequest(uint64_t ieeeAddress, uint8_t endpointId, uint16_t clusterId);
+
+        // one frame to a group, a broadcast address or a 64-bit address (device may be missing in device index),
+        // endpoint is ignored for groups, request events carry group id or broadcast address as short address
+        uint16_t dataRequestExt(uint8_t id, uint8_t addressMode, uint64_t address, uint8_t endpointId, uint16_t clusterId, uint8_t *data, size_t length);
+
+        // coordinator endpoint membership, so group addressed messages are delivered to it, finished on SRSP
+        uint16_t addGroup(uint16_t groupId, uint8_t endpointId = ZSTACK_ENDPOINT_ID);
+
+        ZStackDevices *devices(void);
+        uint8_t transactionId(void);
+        uint32_t startupTime(void);
+
+        // upper limit of the congestion window, number of requests waiting for confirm at the same time
+        void setPipelineDepth(uint8_t depth);
+        uint8_t congestionWindow(void);
+
+        // event data is valid until callback returns, hold it to keep the buffer and release it when done
+        void holdEvent(void *data);
+        void releaseEvent(void *data);
+        uint32_t droppedEvents(void);
+
+        // events posted and not released yet, zero once event workers are idle
+        uint8_t pendingEvents(void);
+
+        // counters, high-water marks and latency histograms since start, cheap enough to take every second
+        void metrics(metricsStruct *snapshot);
+
+        // echoes UTIL_LOOPBACK frames with length bytes of payload for duration ms, blocks caller,
+        // run it while there is no other traffic, e.g. before reset or after coordinator is ready
+        bool linkTest(uint32_t duration, uint8_t length, linkTestStruct *result);
+
+        // input stream may be split at any byte, partial frames are kept in the input ring until the rest arrives
         void parseInput(uint8_t *buffer, size_t length);
 
+        // builds MT frame with FCS from segments at position of power of two sized ring, wrapping at its end,
+        // ring must have room for payload + 5 bytes, returns frame length, TX path writes every frame with it
+        static size_t encodeFrame(uint16_t command, const frameSegmentStruct *segments, uint8_t count, uint8_t *ring, size_t size, size_t position);
+
     private:
 
+        enum requestState
+        {
+            requestFree,
+            requestQueued,
+            requestHeld,
+            requestSent,
+            requestEnqueued
+        };
+
+        struct requestStruct
+        {
+            uint16_t handle;
+            uint16_t command;
+            uint16_t shortAddress;
+            uint8_t  transactionId;
+            uint8_t  endpointId;
+            uint8_t  state;
+            uint32_t time;
+            uint32_t sent;                          // µs, for latency metrics only
+            uint8_t  length;
+            uint8_t  data[ZSTACK_BUFFER_SIZE - ZSTACK_MINIMAL_LENGTH];
+        };
+
+        struct eventStruct
+        {
+            uint8_t  data[ZSTACK_BUFFER_SIZE];
+            size_t   length;
+            ZStackEvent event;
+            std::atomic <uint8_t> references;
+        };
+
+        struct destinationStruct
+        {
+            uint16_t shortAddress;
+            uint8_t  window;
+            uint8_t  count;
+            uint32_t time;
+        };
+
+        ZStackPort *m_port;
         ZStackCallback m_callback;
-        int8_t m_bslPin, m_rstPin;
-
-        bool m_clear, m_permitJoin;
-        uint64_t m_ieeeAddress;
+        int8_t m_core, m_eventCore;
+        ZStackDevices m_devices;
+        ZStackMetrics m_metrics;
+        ZStackRoutes m_routes;
+
+        // input task copies events to pooled buffers, workers return them to the pool after the last release
+        eventStruct m_events[ZSTACK_EVENT_POOL_SIZE];
+        ZStackQueue m_eventPool, m_eventQueue;
+        std::atomic <uint32_t> m_droppedEvents;
+        std::atomic <uint8_t> m_pendingEvents;
+
+        // frames from any task are encoded into output ring, output task is the only port writer
+        uint8_t m_txRing[ZSTACK_TX_RING_SIZE];
+        ZStackMutex m_txMutex;
+        ZStackQueue m_txSignal, m_txSpace;
+        size_t m_txHead, m_txTail;
+
+        // input task passes echoed sequence numbers to link test
+        ZStackQueue m_linkQueue;
+        std::atomic <bool> m_linkTest;
+
+        bool m_permitJoin, m_resetRequested;
         uint8_t m_status;
 
-        nvDataStruct m_nvData[8];
+        coordinatorStartupStruct m_startup;
+        uint32_t m_resetTime;
+
+        // all NV reads are sent at once, ZNP answers SREQs in order, so m_nvIndex counts replies,
+        // every mismatching item sets its bit and only the first one is reported
+        nvDataStruct m_nvData[11];
         uint8_t m_nvIndex;
+        uint16_t m_nvMismatch;
+        bool m_nvUpdate;
+
+        // startup option written before reset, SRSP of its write triggers the reset
+        uint8_t m_startupOption;
+
+        // first ZSTACK_MAXIMAL_LENGTH bytes of the ring are mirrored past its end, so every frame is contiguous
+        uint8_t m_ring[ZSTACK_RING_SIZE + ZSTACK_MAXIMAL_LENGTH];
+        size_t m_ringHead, m_ringTail;
+
+        // only one request waits for SRSP at a time, so SRSP always belongs to the request in requestSent state,
+        // it is written to output ring outside of request mutex, slot is not freed while in that state
+        requestStruct m_requests[ZSTACK_REQUEST_QUEUE_SIZE];
+        uint16_t m_requestHandle;
+        uint8_t m_transactionId;
+        uint8_t m_pipelineDepth, m_heldCount;
+        ZStackMutex m_requestMutex;
+
+        // AIMD congestion control, global window is in 1/16 of request to grow smoothly by 1/window on each confirm
+        destinationStruct m_destinations[ZSTACK_DESTINATION_COUNT];
+        uint16_t m_window;
+
+        destinationStruct *findDestination(uint16_t shortAddress, bool create);
+        void updateWindow(requestStruct *request, uint8_t status);
+
+        uint16_t enqueueRequest(uint16_t command, const frameSegmentStruct *segments, uint8_t count, uint16_t shortAddress, uint8_t endpointId, uint8_t transactionId, bool hold = false);
+        void sendRequests(void);
+        requestStruct *nextRequest(void);
+        bool sendRequest(requestStruct *request);
+        bool sleeping(uint16_t shortAddress);
+        void releaseRequests(uint16_t shortAddress);
+        static bool replaces(const requestStruct *request, const requestStruct *held);
+        static size_t writeRecord(const uint8_t *data, size_t length, size_t offset);
+        void requestResponse(uint16_t command, uint8_t status);
+        void answerRequest(uint16_t command, uint8_t status);
+        void requestFinished(ZStackEvent event, uint16_t command, uint16_t shortAddress, uint8_t endpointId, uint8_t transactionId, uint8_t status);
+        uint32_t checkRequests(void);
+
+        eventStruct *findEvent(void *data);
+        void postEvent(ZStackEvent event, const void *data, size_t length);
+
+        size_t ringSpace(uint8_t **buffer);
+        void ringWritten(size_t length);
+        void parseRing(void);
 
         void parseFrame(uint16_t command, uint8_t *data, size_t length);
-        void sendFrame(uint16_t command, uint8_t *data, size_t length);
-
-        void readNvItem(void);
+        // segments are copied into output ring with FCS computed on the way, false if frame is too long or ring stays full
+        bool sendFrame(uint16_t command, const void *data = NULL, size_t length = 0);
+        bool sendFrame(uint16_t command, const frameSegmentStruct *segments, uint8_t count);
+
+        void readNvItems(void);
+        void initNvMarker(void);
+        void nextNvItem(void);
+        bool networkMismatch(void);
+        void writeStartupOption(uint8_t option);
         void writeNvItem(void);
 
         static void inputTask(void *data);
+        static void outputTask(void *data);
+        static void eventTask(void *data);
 
 };
 
@@ -0,0 +1,235 @@
+#include <math.h>
+#include "ZStackAttributes.h"
+
+#define HASH_MASK                                   ((1 << ZSTACK_ATTRIBUTE_HASH_BITS) - 1)
+#define FREE_KEY                                    0xFFFFFFFFFFFFFFFFULL // real keys use 56 bits only
+
+ZStackAttributes::ZStackAttributes(void) : m_freeCount(ZSTACK_ATTRIBUTE_COUNT), m_evicted(ZSTACK_ATTRIBUTE_COUNT - 1), m_deadbandCount(0)
+{
+    memset(m_table, 0, sizeof(m_table));
+
+    for (uint16_t i = 0; i < ZSTACK_ATTRIBUTE_COUNT; i++)
+    {
+        m_keys[i] = FREE_KEY;
+        m_free[i] = ZSTACK_ATTRIBUTE_COUNT - i - 1;
+    }
+}
+
+bool ZStackAttributes::update(uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, const zclAttributeStruct &attribute)
+{
+    uint64_t id = key(shortAddress, endpointId, clusterId, attribute.id), value = 0;
+    uint8_t size = zclDataSize(attribute.dataType);
+    uint32_t now = zstackMillis();
+    int32_t index;
+    bool result = true;
+
+    if (attribute.status != STATUS_SUCCESS)
+        return false;
+
+    if (size && size <= sizeof(value) && size == attribute.size)
+    {
+        for (uint8_t i = size; i; i--)
+            value = value << 8 | attribute.data[i - 1];
+    }
+    else
+    {
+        // FNV-1a is enough to notice string or collection change, there is no need to keep its content
+
+        value = 0xCBF29CE484222325ULL;
+
+        for (size_t i = 0; i < attribute.size; i++)
+            value = (value ^ attribute.data[i]) * 0x100000001B3ULL;
+
+        size = 0;
+    }
+
+    m_mutex.lock();
+
+    if ((index = slot(id)) >= 0)
+    {
+        index = m_table[index] - 1;
+
+        if (m_types[index] == attribute.dataType && m_values[index] == value)
+            result = false;
+        else if (m_types[index] == attribute.dataType && zclAnalogDataType(attribute.dataType))
+        {
+            double band = deadband(clusterId, attribute.id), number = attribute.numericValue();
+
+            if (band > 0 && fabs(number - m_passed[index]) < band)
+                result = false;
+        }
+    }
+    else
+    {
+        index = allocate();
+        m_keys[index] = id;
+
+        for (uint32_t i = hash(id); ; i = (i + 1) & HASH_MASK)
+        {
+            if (m_table[i])
+                continue;
+
+            m_table[i] = index + 1;
+            break;
+        }
+    }
+
+    m_values[index] = value;
+    m_types[index] = attribute.dataType;
+    m_sizes[index] = size;
+    m_updated[index] = now;
+
+    if (result)
+    {
+        m_passed[index] = zclAnalogDataType(attribute.dataType) ? attribute.numericValue() : 0;
+        m_changed[index] = now;
+    }
+
+    m_mutex.unlock();
+    return result;
+}
+
+bool ZStackAttributes::find(uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, uint16_t attributeId, attributeValueStruct *value)
+{
+    int32_t index;
+
+    m_mutex.lock();
+
+    if ((index = slot(key(shortAddress, endpointId, clusterId, attributeId))) >= 0 && value)
+    {
+        index = m_table[index] - 1;
+
+        value->id = attributeId;
+        value->dataType = m_types[index];
+        value->size = m_sizes[index];
+        value->lastUpdate = m_updated[index];
+        value->lastChange = m_changed[index];
+
+        for (uint8_t i = 0; i < sizeof(value->data); i++)
+            value->data[i] = i < value->size ? static_cast <uint8_t> (m_values[index] >> (i * 8)) : 0;
+    }
+
+    m_mutex.unlock();
+    return index >= 0;
+}
+
+void ZStackAttributes::remove(uint16_t shortAddress)
+{
+    m_mutex.lock();
+
+    for (uint16_t i = 0; i < ZSTACK_ATTRIBUTE_COUNT; i++)
+    {
+        if (m_keys[i] >> 40 != shortAddress)
+            continue;
+
+        erase(slot(m_keys[i]));
+        m_keys[i] = FREE_KEY;
+        m_free[m_freeCount++] = i;
+    }
+
+    m_mutex.unlock();
+}
+
+size_t ZStackAttributes::count(void)
+{
+    return ZSTACK_ATTRIBUTE_COUNT - m_freeCount;
+}
+
+bool ZStackAttributes::setDeadband(uint16_t clusterId, uint16_t attributeId, double deadband)
+{
+    uint8_t index;
+
+    m_mutex.lock();
+
+    for (index = 0; index < m_deadbandCount; index++)
+        if (m_deadbands[index].clusterId == clusterId && m_deadbands[index].attributeId == attributeId)
+            break;
+
+    if (index < ZSTACK_DEADBAND_COUNT)
+    {
+        m_deadbands[index] = {clusterId, attributeId, deadband};
+
+        if (index == m_deadbandCount)
+            m_deadbandCount++;
+    }
+
+    m_mutex.unlock();
+    return index < ZSTACK_DEADBAND_COUNT;
+}
+
+uint64_t ZStackAttributes::key(uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, uint16_t attributeId)
+{
+    return static_cast <uint64_t> (shortAddress) << 40 | static_cast <uint64_t> (endpointId) << 32 | static_cast <uint32_t> (clusterId) << 16 | attributeId;
+}
+
+uint32_t ZStackAttributes::hash(uint64_t key)
+{
+    return static_cast <uint32_t> ((key * 0x9E3779B97F4A7C15ULL) >> (64 - ZSTACK_ATTRIBUTE_HASH_BITS));
+}
+
+int32_t ZStackAttributes::slot(uint64_t key)
+{
+    for (uint32_t slot = hash(key); m_table[slot]; slot = (slot + 1) & HASH_MASK)
+        if (m_keys[m_table[slot] - 1] == key)
+            return slot;
+
+    return -1;
+}
+
+double ZStackAttributes::deadband(uint16_t clusterId, uint16_t attributeId)
+{
+    for (uint8_t i = 0; i < m_deadbandCount; i++)
+        if (m_deadbands[i].clusterId == clusterId && m_deadbands[i].attributeId == attributeId)
+            return m_deadbands[i].deadband;
+
+    return 0;
+}
+
+void ZStackAttributes::erase(int32_t slot)
+{
+    uint32_t next = slot;
+
+    if (slot < 0)
+        return;
+
+    // backward shift deletion, same as device index
+
+    while (m_table[next = (next + 1) & HASH_MASK])
+    {
+        uint32_t home = hash(m_keys[m_table[next] - 1]);
+
+        if (((next - home) & HASH_MASK) < ((next - static_cast <uint32_t> (slot)) & HASH_MASK))
+            continue;
+
+        m_table[slot] = m_table[next];
+        slot = next;
+    }
+
+    m_table[slot] = 0;
+}
+
+uint16_t ZStackAttributes::allocate(void)
+{
+    if (!m_freeCount)
+    {
+        uint16_t oldest = (m_evicted + 1) % ZSTACK_ATTRIBUTE_COUNT;
+
+        // scan starts after last evicted entry, so attributes of one report updated within the same millisecond
+        // do not keep replacing each other
+
+        for (uint16_t i = 1; i < ZSTACK_ATTRIBUTE_COUNT; i++)
+        {
+            uint16_t index = (m_evicted + 1 + i) % ZSTACK_ATTRIBUTE_COUNT;
+
+            if (static_cast <int32_t> (m_updated[index] - m_updated[oldest]) < 0)
+                oldest = index;
+        }
+
+        erase(slot(m_keys[oldest]));
+        m_keys[oldest] = FREE_KEY;
+        m_evicted = oldest;
+        return oldest;
+    }
+
+    return m_free[--m_freeCount];
+}
@@ -0,0 +1,76 @@
+#ifndef ZSTACK_ATTRIBUTES_H
+#define ZSTACK_ATTRIBUTES_H
+
+#include "ZCL.h"
+
+#define ZSTACK_ATTRIBUTE_COUNT                      512    // cache capacity, least recently updated attribute is replaced when full
+#define ZSTACK_ATTRIBUTE_HASH_BITS                  10     // hash table size is 1 << bits, keep it at least twice the capacity
+#define ZSTACK_DEADBAND_COUNT                       16
+
+struct attributeValueStruct
+{
+    uint16_t id;
+    uint8_t  dataType;
+    uint8_t  size;                                         // zero for values over 8 bytes, only their hash is kept for change detection
+    uint8_t  data[8];
+    uint32_t lastUpdate;
+    uint32_t lastChange;
+
+    // decoding view over this copy, same accessors as reported attributes have
+    zclAttributeStruct attribute(void) const { return {id, STATUS_SUCCESS, dataType, data, size}; }
+};
+
+// last known attribute values keyed by (short address, endpoint, cluster, attribute), kept as parallel arrays
+// so the update path touches only keys and values, open addressing index works as in ZStackDevices
+//
+// update tells whether a reported value is worth passing on: first value, data type change, any change of discrete
+// value or analog change beyond configured deadband, measured from the last passed value so slow drift is not lost
+
+class ZStackAttributes
+{
+    public:
+
+        ZStackAttributes(void);
+
+        bool update(uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, const zclAttributeStruct &attribute);
+        bool find(uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, uint16_t attributeId, attributeValueStruct *value);
+        void remove(uint16_t shortAddress);
+        size_t count(void);
+
+        // deadband is in attribute units, e.g. 50 for 0.5 °C of temperature measurement
+        bool setDeadband(uint16_t clusterId, uint16_t attributeId, double deadband);
+
+    private:
+
+        struct deadbandStruct
+        {
+            uint16_t clusterId;
+            uint16_t attributeId;
+            double   deadband;
+        };
+
+        uint64_t m_keys[ZSTACK_ATTRIBUTE_COUNT], m_values[ZSTACK_ATTRIBUTE_COUNT];
+        double m_passed[ZSTACK_ATTRIBUTE_COUNT];
+        uint32_t m_updated[ZSTACK_ATTRIBUTE_COUNT], m_changed[ZSTACK_ATTRIBUTE_COUNT];
+        uint8_t m_types[ZSTACK_ATTRIBUTE_COUNT], m_sizes[ZSTACK_ATTRIBUTE_COUNT];
+
+        uint16_t m_table[1 << ZSTACK_ATTRIBUTE_HASH_BITS];
+        uint16_t m_free[ZSTACK_ATTRIBUTE_COUNT], m_freeCount, m_evicted;
+
+        deadbandStruct m_deadbands[ZSTACK_DEADBAND_COUNT];
+        uint8_t m_deadbandCount;
+
+        ZStackMutex m_mutex;
+
+        static uint64_t key(uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, uint16_t attributeId);
+        static uint32_t hash(uint64_t key);
+
+        int32_t slot(uint64_t key);
+        double deadband(uint16_t clusterId, uint16_t attributeId);
+
+        void erase(int32_t slot);
+        uint16_t allocate(void);
+
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "ZStackCapture.h"
+
+ZStackCapture::ZStackCapture(size_t size, ZStackCaptureOutput output) : m_buffer(new uint8_t[size]), m_size(size), m_head(0), m_length(0), m_output(output)
+{
+    captureHeaderStruct header = {ZSTACK_CAPTURE_MAGIC, ZSTACK_CAPTURE_VERSION, 0};
+
+    if (!m_output)
+        return;
+
+    m_output(reinterpret_cast <uint8_t*> (&header), sizeof(header));
+}
+
+ZStackCapture::~ZStackCapture(void)
+{
+    delete[] m_buffer;
+}
+
+void ZStackCapture::record(uint8_t direction, const uint8_t *data, size_t length)
+{
+    captureRecordStruct record = {zstackMicros(), static_cast <uint16_t> (length), direction};
+    size_t size = sizeof(record) + length;
+
+    if (!length || length > 0xFFFF || size > m_size)
+        return;
+
+    m_mutex.lock();
+
+    while (m_length + size > m_size)
+    {
+        captureRecordStruct oldest;
+
+        copyOut(m_head, &oldest, sizeof(oldest));
+        m_head = (m_head + sizeof(oldest) + oldest.length) % m_size;
+        m_length -= sizeof(oldest) + oldest.length;
+    }
+
+    copyIn((m_head + m_length) % m_size, &record, sizeof(record));
+    copyIn((m_head + m_length + sizeof(record)) % m_size, data, length);
+    m_length += size;
+
+    if (m_output)
+    {
+        m_output(reinterpret_cast <uint8_t*> (&record), sizeof(record));
+        m_output(data, length);
+    }
+
+    m_mutex.unlock();
+}
+
+void ZStackCapture::clear(void)
+{
+    m_mutex.lock();
+    m_head = 0;
+    m_length = 0;
+    m_mutex.unlock();
+}
+
+void ZStackCapture::dump(ZStackCaptureOutput output)
+{
+    captureHeaderStruct header = {ZSTACK_CAPTURE_MAGIC, ZSTACK_CAPTURE_VERSION, 0};
+    uint8_t *copy;
+    size_t length;
+
+    // records are copied out in order, so the copy is contiguous file content already,
+    // input and TX tasks would lose traffic waiting on the mutex while it goes to slow output
+
+    m_mutex.lock();
+    length = m_length;
+    copy = new uint8_t[length ? length : 1];
+    copyOut(m_head, copy, length);
+    m_mutex.unlock();
+
+    output(reinterpret_cast <uint8_t*> (&header), sizeof(header));
+
+    if (length)
+        output(copy, length);
+
+    delete[] copy;
+}
+
+void ZStackCapture::copyIn(size_t offset, const void *data, size_t length)
+{
+    size_t size = m_size - offset < length ? m_size - offset : length;
+
+    memcpy(m_buffer + offset, data, size);
+    memcpy(m_buffer, reinterpret_cast <const uint8_t*> (data) + size, length - size);
+}
+
+void ZStackCapture::copyOut(size_t offset, void *data, size_t length)
+{
+    size_t size = m_size - offset < length ? m_size - offset : length;
+
+    memcpy(data, m_buffer + offset, size);
+    memcpy(reinterpret_cast <uint8_t*> (data) + size, m_buffer, length - size);
+}
+
+ZStackCapturePort::ZStackCapturePort(ZStackPort *port, ZStackCapture *capture) : m_port(port), m_capture(capture) {}
+
+bool ZStackCapturePort::begin(void)
+{
+    return m_port->begin();
+}
+
+size_t ZStackCapturePort::read(uint8_t *buffer, size_t length, uint32_t timeout)
+{
+    size_t result = m_port->read(buffer, length, timeout);
+    m_capture->record(captureReceived, buffer, result);
+    return result;
+}
+
+size_t ZStackCapturePort::write(const uint8_t *buffer, size_t length)
+{
+    size_t result = m_port->write(buffer, length);
+    m_capture->record(captureSent, buffer, result);
+    return result;
+}
+
+bool ZStackCapturePort::reset(void)
+{
+    return m_port->reset();
+}
+
+bool ZStackCapturePort::connected(void)
+{
+    return m_port->connected();
+}
@@ -0,0 +1,87 @@
+#ifndef ZSTACK_CAPTURE_H
+#define ZSTACK_CAPTURE_H
+
+#include "ZStackPort.h"
+
+#define ZSTACK_CAPTURE_MAGIC                        0x5043535A // "ZSCP"
+#define ZSTACK_CAPTURE_VERSION                      1
+#define ZSTACK_CAPTURE_SIZE                         16384  // default RAM ring size in bytes
+
+// capture file is header followed by records appended one after another, all fields are little endian
+// and packed, so the file can be mapped and walked in place, record data is raw UART bytes as read or written
+
+enum ZStackCaptureDirection
+{
+    captureReceived,
+    captureSent
+};
+
+typedef void (*ZStackCaptureOutput) (const uint8_t *data, size_t length);
+
+#pragma pack(push, 1)
+
+struct captureHeaderStruct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+};
+
+struct captureRecordStruct
+{
+    uint64_t time;                                  // microseconds since boot
+    uint16_t length;
+    uint8_t  direction;
+};
+
+#pragma pack(pop)
+
+class ZStackCapture
+{
+    public:
+
+        // records are kept in RAM ring, oldest are overwritten when it is full,
+        // optional output gets file header right away and then every record as it is captured
+        ZStackCapture(size_t size = ZSTACK_CAPTURE_SIZE, ZStackCaptureOutput output = NULL);
+        ~ZStackCapture(void);
+
+        void record(uint8_t direction, const uint8_t *data, size_t length);
+        void clear(void);
+
+        // writes file header and ring content, oldest record first, ring is copied to heap first,
+        // so capture goes on while slow output runs
+        void dump(ZStackCaptureOutput output);
+
+    private:
+
+        uint8_t *m_buffer;
+        size_t m_size, m_head, m_length;
+        ZStackCaptureOutput m_output;
+        ZStackMutex m_mutex;
+
+        void copyIn(size_t offset, const void *data, size_t length);
+        void copyOut(size_t offset, void *data, size_t length);
+
+};
+
+// records everything passing through another port
+class ZStackCapturePort : public ZStackPort
+{
+    public:
+
+        ZStackCapturePort(ZStackPort *port, ZStackCapture *capture);
+
+        bool begin(void) override;
+        size_t read(uint8_t *buffer, size_t length, uint32_t timeout) override;
+        size_t write(const uint8_t *buffer, size_t length) override;
+        bool reset(void) override;
+        bool connected(void) override;
+
+    private:
+
+        ZStackPort *m_port;
+        ZStackCapture *m_capture;
+
+};
+
+#endif
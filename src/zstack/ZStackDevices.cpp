@@ -0,0 +1,247 @@
+#include "ZStackDevices.h"
+
+#define HASH_MASK                                   ((1 << ZSTACK_DEVICE_HASH_BITS) - 1)
+#define NO_DEVICE                                   ZSTACK_DEVICE_COUNT
+
+ZStackDevices::ZStackDevices(void) : m_freeCount(ZSTACK_DEVICE_COUNT), m_oldest(NO_DEVICE), m_newest(NO_DEVICE)
+{
+    memset(m_devices, 0, sizeof(m_devices));
+    memset(m_ieeeTable, 0, sizeof(m_ieeeTable));
+    memset(m_shortTable, 0, sizeof(m_shortTable));
+
+    for (uint16_t i = 0; i < ZSTACK_DEVICE_COUNT; i++)
+    {
+        m_free[i] = ZSTACK_DEVICE_COUNT - i - 1;
+        m_older[i] = NO_DEVICE;
+        m_newer[i] = NO_DEVICE;
+    }
+}
+
+void ZStackDevices::update(uint64_t ieeeAddress, uint16_t shortAddress, uint8_t capabilities)
+{
+    int32_t slot;
+    uint16_t index;
+    deviceStruct *device;
+
+    m_mutex.lock();
+
+    if ((slot = ieeeSlot(ieeeAddress)) >= 0)
+    {
+        index = m_ieeeTable[slot] - 1;
+        device = &m_devices[index];
+
+        if (device->shortAddress != shortAddress)
+            erase(m_shortTable, shortSlot(device->shortAddress), false);
+    }
+    else
+    {
+        if (!m_freeCount)
+        {
+            uint16_t oldest = m_oldest;
+
+            erase(m_ieeeTable, ieeeSlot(m_devices[oldest].ieeeAddress), true);
+            erase(m_shortTable, shortSlot(m_devices[oldest].shortAddress), false);
+            release(oldest);
+        }
+
+        index = m_free[--m_freeCount];
+        device = &m_devices[index];
+        device->ieeeAddress = ieeeAddress;
+        device->shortAddress = shortAddress ^ 0xFFFF;
+        device->linkQuality = 0;
+
+        insert(m_ieeeTable, ieeeHash(ieeeAddress), index);
+    }
+
+    if (device->shortAddress != shortAddress)
+    {
+        // short address can be reused by another device after it left or rejoined
+
+        if ((slot = shortSlot(shortAddress)) >= 0)
+        {
+            uint16_t other = m_shortTable[slot] - 1;
+
+            erase(m_shortTable, slot, false);
+            erase(m_ieeeTable, ieeeSlot(m_devices[other].ieeeAddress), true);
+            release(other);
+        }
+
+        device->shortAddress = shortAddress;
+        insert(m_shortTable, shortHash(shortAddress), index);
+    }
+
+    device->capabilities = capabilities;
+    device->lastSeen = zstackMillis();
+    touch(index);
+
+    m_mutex.unlock();
+}
+
+void ZStackDevices::remove(uint64_t ieeeAddress)
+{
+    int32_t slot;
+
+    m_mutex.lock();
+
+    if ((slot = ieeeSlot(ieeeAddress)) >= 0)
+    {
+        uint16_t index = m_ieeeTable[slot] - 1;
+
+        erase(m_ieeeTable, slot, true);
+        erase(m_shortTable, shortSlot(m_devices[index].shortAddress), false);
+        release(index);
+    }
+
+    m_mutex.unlock();
+}
+
+void ZStackDevices::seen(uint16_t shortAddress, uint8_t linkQuality)
+{
+    int32_t slot;
+
+    m_mutex.lock();
+
+    if ((slot = shortSlot(shortAddress)) >= 0)
+    {
+        uint16_t index = m_shortTable[slot] - 1;
+        deviceStruct *device = &m_devices[index];
+
+        device->linkQuality = linkQuality;
+        device->lastSeen = zstackMillis();
+        touch(index);
+    }
+
+    m_mutex.unlock();
+}
+
+bool ZStackDevices::findByIeeeAddress(uint64_t ieeeAddress, deviceStruct *device)
+{
+    int32_t slot;
+
+    m_mutex.lock();
+
+    if ((slot = ieeeSlot(ieeeAddress)) >= 0 && device)
+        *device = m_devices[m_ieeeTable[slot] - 1];
+
+    m_mutex.unlock();
+    return slot >= 0;
+}
+
+bool ZStackDevices::findByShortAddress(uint16_t shortAddress, deviceStruct *device)
+{
+    int32_t slot;
+
+    m_mutex.lock();
+
+    if ((slot = shortSlot(shortAddress)) >= 0 && device)
+        *device = m_devices[m_shortTable[slot] - 1];
+
+    m_mutex.unlock();
+    return slot >= 0;
+}
+
+size_t ZStackDevices::count(void)
+{
+    return ZSTACK_DEVICE_COUNT - m_freeCount;
+}
+
+uint32_t ZStackDevices::ieeeHash(uint64_t ieeeAddress)
+{
+    return static_cast <uint32_t> (((ieeeAddress ^ ieeeAddress >> 32) * 0x9E3779B97F4A7C15ULL) >> (64 - ZSTACK_DEVICE_HASH_BITS));
+}
+
+uint32_t ZStackDevices::shortHash(uint16_t shortAddress)
+{
+    return (shortAddress * 0x9E3779B1U) >> (32 - ZSTACK_DEVICE_HASH_BITS);
+}
+
+int32_t ZStackDevices::ieeeSlot(uint64_t ieeeAddress)
+{
+    for (uint32_t slot = ieeeHash(ieeeAddress); m_ieeeTable[slot]; slot = (slot + 1) & HASH_MASK)
+        if (m_devices[m_ieeeTable[slot] - 1].ieeeAddress == ieeeAddress)
+            return slot;
+
+    return -1;
+}
+
+int32_t ZStackDevices::shortSlot(uint16_t shortAddress)
+{
+    for (uint32_t slot = shortHash(shortAddress); m_shortTable[slot]; slot = (slot + 1) & HASH_MASK)
+        if (m_devices[m_shortTable[slot] - 1].shortAddress == shortAddress)
+            return slot;
+
+    return -1;
+}
+
+void ZStackDevices::insert(uint16_t *table, uint32_t hash, uint16_t index)
+{
+    while (table[hash])
+        hash = (hash + 1) & HASH_MASK;
+
+    table[hash] = index + 1;
+}
+
+void ZStackDevices::erase(uint16_t *table, int32_t slot, bool ieee)
+{
+    uint32_t next = slot;
+
+    if (slot < 0)
+        return;
+
+    // backward shift deletion: move every following entry of the chain that may legally sit in the freed slot
+
+    while (table[next = (next + 1) & HASH_MASK])
+    {
+        deviceStruct *device = &m_devices[table[next] - 1];
+        uint32_t hash = ieee ? ieeeHash(device->ieeeAddress) : shortHash(device->shortAddress);
+
+        if (((next - hash) & HASH_MASK) < ((next - static_cast <uint32_t> (slot)) & HASH_MASK))
+            continue;
+
+        table[slot] = table[next];
+        slot = next;
+    }
+
+    table[slot] = 0;
+}
+
+void ZStackDevices::release(uint16_t index)
+{
+    unlink(index);
+    m_free[m_freeCount++] = index;
+}
+
+void ZStackDevices::unlink(uint16_t index)
+{
+    if (m_older[index] != NO_DEVICE)
+        m_newer[m_older[index]] = m_newer[index];
+    else if (m_oldest == index)
+        m_oldest = m_newer[index];
+
+    if (m_newer[index] != NO_DEVICE)
+        m_older[m_newer[index]] = m_older[index];
+    else if (m_newest == index)
+        m_newest = m_older[index];
+
+    m_older[index] = NO_DEVICE;
+    m_newer[index] = NO_DEVICE;
+}
+
+void ZStackDevices::touch(uint16_t index)
+{
+    // every update and incoming frame moves the device to the newest end, list order is lastSeen order
+
+    if (m_newest == index)
+        return;
+
+    unlink(index);
+
+    m_older[index] = m_newest;
+
+    if (m_newest != NO_DEVICE)
+        m_newer[m_newest] = index;
+    else
+        m_oldest = index;
+
+    m_newest = index;
+}
@@ -0,0 +1,59 @@
+#ifndef ZSTACK_DEVICES_H
+#define ZSTACK_DEVICES_H
+
+#include "ZStackPlatform.h"
+
+#define ZSTACK_DEVICE_COUNT                         256    // index capacity, least recently seen device is replaced when full, 30 bytes per device (~30 KB per 1k)
+#define ZSTACK_DEVICE_HASH_BITS                     9      // hash table size is 1 << bits, keep it at least twice the capacity
+
+struct deviceStruct
+{
+    uint64_t ieeeAddress;
+    uint16_t shortAddress;
+    uint8_t  capabilities;
+    uint8_t  linkQuality;
+    uint32_t lastSeen;
+};
+
+// two open addressing tables (IEEE and short address) with linear probing over one fixed device array,
+// deletion shifts the probe chain back, so there are no tombstones and lookups stay O(1) at any churn,
+// devices are also linked from least to most recently seen, so replacing the oldest one when full is O(1) too
+
+class ZStackDevices
+{
+    public:
+
+        ZStackDevices(void);
+
+        void update(uint64_t ieeeAddress, uint16_t shortAddress, uint8_t capabilities);
+        void remove(uint64_t ieeeAddress);
+        void seen(uint16_t shortAddress, uint8_t linkQuality);
+
+        bool findByIeeeAddress(uint64_t ieeeAddress, deviceStruct *device);
+        bool findByShortAddress(uint16_t shortAddress, deviceStruct *device);
+        size_t count(void);
+
+    private:
+
+        deviceStruct m_devices[ZSTACK_DEVICE_COUNT];
+        uint16_t m_ieeeTable[1 << ZSTACK_DEVICE_HASH_BITS], m_shortTable[1 << ZSTACK_DEVICE_HASH_BITS];
+        uint16_t m_free[ZSTACK_DEVICE_COUNT], m_freeCount;
+        uint16_t m_older[ZSTACK_DEVICE_COUNT], m_newer[ZSTACK_DEVICE_COUNT], m_oldest, m_newest;
+        ZStackMutex m_mutex;
+
+        static uint32_t ieeeHash(uint64_t ieeeAddress);
+        static uint32_t shortHash(uint16_t shortAddress);
+
+        int32_t ieeeSlot(uint64_t ieeeAddress);
+        int32_t shortSlot(uint16_t shortAddress);
+
+        void insert(uint16_t *table, uint32_t hash, uint16_t index);
+        void erase(uint16_t *table, int32_t slot, bool ieee);
+        void release(uint16_t index);
+
+        void unlink(uint16_t index);
+        void touch(uint16_t index);
+
+};
+
+#endif
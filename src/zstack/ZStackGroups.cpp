@@ -0,0 +1,60 @@
+#include "ZStackGroups.h"
+
+ZStackGroups::ZStackGroups(ZStack *zstack) : m_zstack(zstack) {}
+
+uint8_t ZStackGroups::addMembers(uint16_t groupId, const uint16_t *shortAddresses, uint8_t count, uint8_t endpointId)
+{
+    return membership(GROUPS_ADD_GROUP, groupId, shortAddresses, count, endpointId);
+}
+
+uint8_t ZStackGroups::removeMembers(uint16_t groupId, const uint16_t *shortAddresses, uint8_t count, uint8_t endpointId)
+{
+    return membership(GROUPS_REMOVE_GROUP, groupId, shortAddresses, count, endpointId);
+}
+
+uint16_t ZStackGroups::groupCommand(uint16_t groupId, uint16_t clusterId, uint8_t commandId, const uint8_t *payload, size_t length)
+{
+    uint8_t buffer[ZSTACK_BUFFER_SIZE - ZSTACK_MINIMAL_LENGTH - sizeof(dataRequestExtStruct)];
+    zclHeader header;
+
+    if (sizeof(header) + length > sizeof(buffer))
+        return 0;
+
+    header.frameControl = FC_CLUSTER_SPECIFIC | FC_DISABLE_DEFAULT_RESPONSE;
+    header.transationId = m_zstack->transactionId();
+    header.commandId = commandId;
+
+    memcpy(buffer, &header, sizeof(header));
+    memcpy(buffer + sizeof(header), payload, length);
+
+    return m_zstack->dataRequestExt(header.transationId, ADDRESS_MODE_GROUP, groupId, 0xFF, clusterId, buffer, sizeof(header) + length);
+}
+
+uint8_t ZStackGroups::membership(uint8_t commandId, uint16_t groupId, const uint16_t *shortAddresses, uint8_t count, uint8_t endpointId)
+{
+    uint8_t buffer[sizeof(zclHeader) + 3];
+    zclHeader header;
+    size_t length = sizeof(header);
+
+    header.frameControl = FC_CLUSTER_SPECIFIC;
+    header.commandId = commandId;
+
+    buffer[length++] = static_cast <uint8_t> (groupId);
+    buffer[length++] = static_cast <uint8_t> (groupId >> 8);
+
+    // add group carries group name, empty one here
+
+    if (commandId == GROUPS_ADD_GROUP)
+        buffer[length++] = 0x00;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        header.transationId = m_zstack->transactionId();
+        memcpy(buffer, &header, sizeof(header));
+
+        if (!m_zstack->dataRequest(header.transationId, shortAddresses[i], endpointId, CLUSTER_GROUPS, buffer, length))
+            return i;
+    }
+
+    return count;
+}
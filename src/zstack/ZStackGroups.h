@@ -0,0 +1,32 @@
+#ifndef ZSTACK_GROUPS_H
+#define ZSTACK_GROUPS_H
+
+#include "ZCL.h"
+#include "ZStack.h"
+
+// device group membership is managed with Groups cluster commands, one unicast per member through the request queue,
+// queue may be shorter than member list, so add and remove return queued count and are called again with the rest
+//
+// once members are in the group, one group addressed frame reaches all of them
+
+class ZStackGroups
+{
+    public:
+
+        ZStackGroups(ZStack *zstack);
+
+        uint8_t addMembers(uint16_t groupId, const uint16_t *shortAddresses, uint8_t count, uint8_t endpointId);
+        uint8_t removeMembers(uint16_t groupId, const uint16_t *shortAddresses, uint8_t count, uint8_t endpointId);
+
+        // cluster specific command to the whole group, default responses are disabled, every member would send one
+        uint16_t groupCommand(uint16_t groupId, uint16_t clusterId, uint8_t commandId, const uint8_t *payload, size_t length);
+
+    private:
+
+        ZStack *m_zstack;
+
+        uint8_t membership(uint8_t commandId, uint16_t groupId, const uint16_t *shortAddresses, uint8_t count, uint8_t endpointId);
+
+};
+
+#endif
@@ -0,0 +1,240 @@
+#include "ZStackLog.h"
+
+#define RECORD_ALIGN(size)                          (((size) + 7) & ~7U)
+
+ZStackLog::ZStackLog(ZStackLogOutput output, uint8_t priority, int8_t core) : m_output(output), m_head(0), m_tail(0), m_dropped(0), m_reported(0)
+{
+    zstackCreateTask(logTask, "ZStack Log", 4096, this, priority, core);
+}
+
+uint32_t ZStackLog::dropped(void)
+{
+    return m_dropped.load(std::memory_order_relaxed);
+}
+
+uint64_t ZStackLog::argument(double value)
+{
+    uint64_t result;
+    memcpy(&result, &value, sizeof(result));
+    return result;
+}
+
+void ZStackLog::write(const char *format, const uint64_t *values, uint8_t count, const uint8_t *data, size_t length)
+{
+    uint32_t tail = m_tail.load(std::memory_order_relaxed), head = m_head.load(std::memory_order_acquire), offset = tail & (ZSTACK_LOG_SIZE - 1), space = ZSTACK_LOG_SIZE - offset;
+    size_t size = RECORD_ALIGN(sizeof(recordStruct) + count * sizeof(uint64_t) + length);
+    recordStruct record;
+
+    // record never wraps, end of the ring is skipped with padding record (or silently if even header does not fit)
+
+    if (size > space)
+    {
+        if (ZSTACK_LOG_SIZE - (tail - head) < space + size)
+        {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        if (space >= sizeof(recordStruct))
+        {
+            memset(&record, 0, sizeof(record));
+            record.size = static_cast <uint16_t> (space);
+            memcpy(m_buffer + offset, &record, sizeof(record));
+        }
+
+        tail += space;
+        offset = 0;
+    }
+    else if (ZSTACK_LOG_SIZE - (tail - head) < size)
+    {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    record.size = static_cast <uint16_t> (size);
+    record.count = count;
+    record.reserved = 0;
+    record.length = static_cast <uint16_t> (length);
+    record.padding = 0;
+    record.format = format;
+
+    memcpy(m_buffer + offset, &record, sizeof(record));
+    memcpy(m_buffer + offset + sizeof(record), values, count * sizeof(uint64_t));
+
+    if (length)
+        memcpy(m_buffer + offset + sizeof(record) + count * sizeof(uint64_t), data, length);
+
+    m_tail.store(tail + size, std::memory_order_release);
+}
+
+bool ZStackLog::drain(void)
+{
+    uint32_t head = m_head.load(std::memory_order_relaxed), tail = m_tail.load(std::memory_order_acquire), dropped = m_dropped.load(std::memory_order_relaxed);
+
+    if (dropped != m_reported)
+    {
+        char text[64];
+        int length = snprintf(text, sizeof(text), "%u log entries dropped\n", static_cast <unsigned int> (dropped - m_reported));
+
+        m_output(text, length);
+        m_reported = dropped;
+    }
+
+    if (head == tail)
+        return false;
+
+    while (head != tail)
+    {
+        uint32_t offset = head & (ZSTACK_LOG_SIZE - 1);
+        recordStruct record;
+
+        if (ZSTACK_LOG_SIZE - offset < sizeof(recordStruct))
+        {
+            head += ZSTACK_LOG_SIZE - offset;
+            m_head.store(head, std::memory_order_release);
+            continue;
+        }
+
+        memcpy(&record, m_buffer + offset, sizeof(record));
+
+        if (record.format)
+            format(&record, m_buffer + offset + sizeof(record), m_buffer + offset + sizeof(record) + record.count * sizeof(uint64_t));
+
+        head += record.size;
+        m_head.store(head, std::memory_order_release);
+    }
+
+    return true;
+}
+
+void ZStackLog::format(const recordStruct *record, const uint8_t *values, const uint8_t *data)
+{
+    char text[ZSTACK_LOG_LINE], specifier[16];
+    const char *format = record->format;
+    size_t length = 0;
+    uint8_t index = 0;
+
+    while (*format)
+    {
+        uint64_t value = 0;
+        size_t size = 0;
+        int result;
+
+        if (length > sizeof(text) - 32)
+        {
+            m_output(text, length);
+            length = 0;
+        }
+
+        if (*format != '%' || format[1] == '%')
+        {
+            text[length++] = *format;
+            format += *format == '%' ? 2 : 1;
+            continue;
+        }
+
+        // every specifier is printed separately, length modifiers are replaced because arguments are stored as 64 bit values
+
+        specifier[size++] = *format++;
+
+        while (*format && strchr("-+ #0123456789.", *format) && size < sizeof(specifier) - 4)
+            specifier[size++] = *format++;
+
+        while (*format && strchr("hlLqjzt", *format))
+            format++;
+
+        if (!*format)
+            break;
+
+        if (index < record->count)
+            memcpy(&value, values + index++ * sizeof(uint64_t), sizeof(value));
+
+        switch (*format)
+        {
+            case 'd':
+            case 'i':
+                specifier[size++] = 'l';
+                specifier[size++] = 'l';
+                specifier[size++] = *format;
+                specifier[size] = 0;
+                result = snprintf(text + length, sizeof(text) - length, specifier, static_cast <long long> (value));
+                break;
+
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+                specifier[size++] = 'l';
+                specifier[size++] = 'l';
+                specifier[size++] = *format;
+                specifier[size] = 0;
+                result = snprintf(text + length, sizeof(text) - length, specifier, static_cast <unsigned long long> (value));
+                break;
+
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+            {
+                double number;
+
+                memcpy(&number, &value, sizeof(number));
+                specifier[size++] = *format;
+                specifier[size] = 0;
+                result = snprintf(text + length, sizeof(text) - length, specifier, number);
+                break;
+            }
+
+            case 's':
+                specifier[size++] = *format;
+                specifier[size] = 0;
+                result = snprintf(text + length, sizeof(text) - length, specifier, value ? reinterpret_cast <const char*> (static_cast <uintptr_t> (value)) : "(null)");
+                break;
+
+            case 'p':
+                specifier[size++] = *format;
+                specifier[size] = 0;
+                result = snprintf(text + length, sizeof(text) - length, specifier, reinterpret_cast <void*> (static_cast <uintptr_t> (value)));
+                break;
+
+            default:
+                result = snprintf(text + length, sizeof(text) - length, "%c", static_cast <int> (value));
+                break;
+        }
+
+        if (result > 0)
+            length += static_cast <size_t> (result) < sizeof(text) - length ? static_cast <size_t> (result) : sizeof(text) - length - 1;
+
+        format++;
+    }
+
+    for (uint16_t i = 0; i < record->length; i++)
+    {
+        if (length > sizeof(text) - 8)
+        {
+            m_output(text, length);
+            length = 0;
+        }
+
+        length += snprintf(text + length, sizeof(text) - length, " %02x", data[i]);
+    }
+
+    if (record->length)
+        text[length++] = '\n';
+
+    if (length)
+        m_output(text, length);
+}
+
+void ZStackLog::logTask(void *data)
+{
+    ZStackLog *log = reinterpret_cast <ZStackLog*> (data);
+
+    while (1)
+        if (!log->drain())
+            zstackDelay(ZSTACK_LOG_INTERVAL);
+}
@@ -0,0 +1,70 @@
+#ifndef ZSTACK_LOG_H
+#define ZSTACK_LOG_H
+
+#include <atomic>
+#include "ZStackPlatform.h"
+
+#define ZSTACK_LOG_SIZE                             8192   // ring size in bytes, must be power of two
+#define ZSTACK_LOG_INTERVAL                         20     // ms between drains when ring is empty
+#define ZSTACK_LOG_LINE                             256    // formatted output chunk
+
+typedef void (*ZStackLogOutput) (const char *text, size_t length);
+
+// binary log ring: producer stores format pointer, raw arguments and dump bytes without formatting anything,
+// log task formats and writes them out later, entries that do not fit are dropped and counted
+//
+// there is one producer per instance (event task for ZStack callbacks), format must be string literal
+// and %s arguments must point to static strings, because both are read after the call returns
+
+class ZStackLog
+{
+    public:
+
+        ZStackLog(ZStackLogOutput output, uint8_t priority = 0, int8_t core = 1);
+
+        template <typename... Args> void print(const char *format, Args... args)
+        {
+            uint64_t values[sizeof...(args) + 1] = {argument(args)...};
+            write(format, values, sizeof...(args), NULL, 0);
+        }
+
+        // format is printed first, followed by data bytes in hex and new line
+        template <typename... Args> void dump(const uint8_t *data, size_t length, const char *format, Args... args)
+        {
+            uint64_t values[sizeof...(args) + 1] = {argument(args)...};
+            write(format, values, sizeof...(args), data, length);
+        }
+
+        uint32_t dropped(void);
+
+    private:
+
+        struct recordStruct
+        {
+            uint16_t size;
+            uint8_t  count;
+            uint8_t  reserved;
+            uint16_t length;
+            uint16_t padding;
+            const char *format;
+        };
+
+        ZStackLogOutput m_output;
+        uint8_t m_buffer[ZSTACK_LOG_SIZE];
+        std::atomic <uint32_t> m_head, m_tail, m_dropped;
+        uint32_t m_reported;
+
+        static uint64_t argument(double value);
+        static uint64_t argument(float value) { return argument(static_cast <double> (value)); }
+        template <typename T> static uint64_t argument(T *value) { return reinterpret_cast <uintptr_t> (value); }
+        template <typename T> static uint64_t argument(T value) { return static_cast <uint64_t> (static_cast <int64_t> (value)); }
+
+        void write(const char *format, const uint64_t *values, uint8_t count, const uint8_t *data, size_t length);
+        bool drain(void);
+        void format(const recordStruct *record, const uint8_t *values, const uint8_t *data);
+
+        static void logTask(void *data);
+
+};
+
+#endif
@@ -0,0 +1,202 @@
+#include "ZStack.h"
+#include "ZStackMetrics.h"
+
+#define COMMAND_MASK                                ((1 << ZSTACK_METRICS_COMMAND_BITS) - 1)
+
+static const char *levelNames[levelCount] = {"requests", "held requests", "events", "output bytes", "input bytes"};
+static const uint32_t levelLimits[levelCount] = {ZSTACK_REQUEST_QUEUE_SIZE, ZSTACK_HOLD_COUNT, ZSTACK_EVENT_POOL_SIZE, ZSTACK_TX_RING_SIZE, ZSTACK_RING_SIZE};
+static const char *latencyNames[latencyCount] = {"SRSP", "data confirm", "callback", "startup"};
+
+ZStackMetrics::ZStackMetrics(void) : m_framesReceived(0), m_framesSent(0), m_fcsErrors(0), m_skippedBytes(0), m_rejectedFrames(0)
+{
+    for (uint8_t i = 0; i <= COMMAND_MASK; i++)
+    {
+        m_commands[i].command = 0;
+        m_commands[i].received = 0;
+        m_commands[i].sent = 0;
+    }
+
+    for (uint8_t i = 0; i < levelCount; i++)
+        m_levels[i] = 0;
+
+    for (uint8_t i = 0; i < latencyCount; i++)
+    {
+        m_latencies[i].count = 0;
+        m_latencies[i].max = 0;
+
+        for (uint8_t j = 0; j < ZSTACK_METRICS_BUCKETS; j++)
+            m_latencies[i].buckets[j] = 0;
+    }
+}
+
+void ZStackMetrics::frameReceived(uint16_t command)
+{
+    commandStruct *entry = findCommand(command);
+
+    m_framesReceived.fetch_add(1, std::memory_order_relaxed);
+
+    if (entry)
+        entry->received.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ZStackMetrics::frameSent(uint16_t command)
+{
+    commandStruct *entry = findCommand(command);
+
+    m_framesSent.fetch_add(1, std::memory_order_relaxed);
+
+    if (entry)
+        entry->sent.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ZStackMetrics::fcsError(void)
+{
+    m_fcsErrors.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ZStackMetrics::skippedBytes(size_t count)
+{
+    m_skippedBytes.fetch_add(static_cast <uint32_t> (count), std::memory_order_relaxed);
+}
+
+void ZStackMetrics::rejectedFrame(void)
+{
+    m_rejectedFrames.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ZStackMetrics::level(ZStackMetricsLevel level, uint32_t value)
+{
+    updateMax(m_levels[level], value);
+}
+
+void ZStackMetrics::latency(ZStackMetricsLatency latency, uint32_t value)
+{
+    histogramStruct *histogram = &m_latencies[latency];
+    uint8_t bucket = value ? 32 - __builtin_clz(value) : 0;
+
+    histogram->count.fetch_add(1, std::memory_order_relaxed);
+    histogram->buckets[bucket < ZSTACK_METRICS_BUCKETS ? bucket : ZSTACK_METRICS_BUCKETS - 1].fetch_add(1, std::memory_order_relaxed);
+    updateMax(histogram->max, value);
+}
+
+void ZStackMetrics::snapshot(metricsStruct *metrics)
+{
+    memset(metrics, 0, sizeof(metricsStruct));
+
+    for (uint8_t i = 0; i <= COMMAND_MASK; i++)
+    {
+        commandStruct *entry = &m_commands[i];
+        uint16_t command = entry->command.load(std::memory_order_relaxed);
+
+        if (!command)
+            continue;
+
+        metrics->commands[metrics->commandCount++] = {command, entry->received.load(std::memory_order_relaxed), entry->sent.load(std::memory_order_relaxed)};
+    }
+
+    metrics->framesReceived = m_framesReceived.load(std::memory_order_relaxed);
+    metrics->framesSent = m_framesSent.load(std::memory_order_relaxed);
+    metrics->fcsErrors = m_fcsErrors.load(std::memory_order_relaxed);
+    metrics->skippedBytes = m_skippedBytes.load(std::memory_order_relaxed);
+    metrics->rejectedFrames = m_rejectedFrames.load(std::memory_order_relaxed);
+
+    for (uint8_t i = 0; i < levelCount; i++)
+        metrics->levels[i] = m_levels[i].load(std::memory_order_relaxed);
+
+    for (uint8_t i = 0; i < latencyCount; i++)
+    {
+        metricsHistogramStruct *histogram = &metrics->latencies[i];
+
+        histogram->count = m_latencies[i].count.load(std::memory_order_relaxed);
+        histogram->max = m_latencies[i].max.load(std::memory_order_relaxed);
+
+        for (uint8_t j = 0; j < ZSTACK_METRICS_BUCKETS; j++)
+            histogram->buckets[j] = m_latencies[i].buckets[j].load(std::memory_order_relaxed);
+    }
+}
+
+uint32_t ZStackMetrics::percentile(const metricsHistogramStruct *histogram, uint8_t percent)
+{
+    uint64_t total = 0, target;
+
+    // buckets are summed instead of taking count, so a snapshot taken while counters move stays consistent
+
+    for (uint8_t i = 0; i < ZSTACK_METRICS_BUCKETS; i++)
+        total += histogram->buckets[i];
+
+    if (!total)
+        return 0;
+
+    target = (total * percent + 99) / 100;
+
+    for (uint8_t i = 0; i < ZSTACK_METRICS_BUCKETS - 1; i++)
+    {
+        if (target <= histogram->buckets[i])
+            return 1UL << i;
+
+        target -= histogram->buckets[i];
+    }
+
+    return histogram->max;
+}
+
+void ZStackMetrics::dump(const metricsStruct *metrics, ZStackMetricsOutput output)
+{
+    char line[160];
+    int length;
+
+    length = snprintf(line, sizeof(line), "ZStack frames received %u, sent %u, FCS errors %u, skipped bytes %u, rejected frames %u, dropped events %u\n", metrics->framesReceived, metrics->framesSent, metrics->fcsErrors, metrics->skippedBytes, metrics->rejectedFrames, metrics->droppedEvents);
+    output(line, length);
+
+    for (uint8_t i = 0; i < metrics->commandCount; i++)
+    {
+        const metricsCommandStruct *command = &metrics->commands[i];
+        length = snprintf(line, sizeof(line), "ZStack command 0x%04x received %u, sent %u\n", command->command, command->received, command->sent);
+        output(line, length);
+    }
+
+    for (uint8_t i = 0; i < levelCount; i++)
+    {
+        length = snprintf(line, sizeof(line), "ZStack high-water mark of %s %u of %u\n", levelNames[i], metrics->levels[i], levelLimits[i]);
+        output(line, length);
+    }
+
+    for (uint8_t i = 0; i < latencyCount; i++)
+    {
+        const metricsHistogramStruct *histogram = &metrics->latencies[i];
+
+        if (!histogram->count)
+            continue;
+
+        length = snprintf(line, sizeof(line), "ZStack %s latency count %u, p50 below %u us, p99 below %u us, max %u us\n", latencyNames[i], histogram->count, percentile(histogram, 50), percentile(histogram, 99), histogram->max);
+        output(line, length);
+    }
+}
+
+ZStackMetrics::commandStruct *ZStackMetrics::findCommand(uint16_t command)
+{
+    uint32_t index = static_cast <uint16_t> (command * 40503U) >> (16 - ZSTACK_METRICS_COMMAND_BITS);
+
+    // empty entry is claimed by the first task to get there, the loser finds it taken by the same command or moves on
+
+    for (uint8_t i = 0; i <= COMMAND_MASK; i++)
+    {
+        commandStruct *entry = &m_commands[(index + i) & COMMAND_MASK];
+        uint16_t current = entry->command.load(std::memory_order_relaxed);
+
+        if (!current && entry->command.compare_exchange_strong(current, command, std::memory_order_relaxed))
+            return entry;
+
+        if (current == command)
+            return entry;
+    }
+
+    return NULL;
+}
+
+void ZStackMetrics::updateMax(std::atomic <uint32_t> &target, uint32_t value)
+{
+    uint32_t current = target.load(std::memory_order_relaxed);
+
+    while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed));
+}
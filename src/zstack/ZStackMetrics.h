@@ -0,0 +1,112 @@
+#ifndef ZSTACK_METRICS_H
+#define ZSTACK_METRICS_H
+
+#include <atomic>
+#include "ZStackPlatform.h"
+
+#define ZSTACK_METRICS_COMMAND_BITS                 6      // command table size is 1 << bits, commands beyond it are counted in totals only
+#define ZSTACK_METRICS_BUCKETS                      26     // bucket n counts values below 2^n µs and not below 2^(n - 1), last one takes the rest
+
+enum ZStackMetricsLevel
+{
+    levelRequests,                                  // used request slots
+    levelHeldRequests,
+    levelEvents,                                    // event buffers waiting for or in callback
+    levelOutput,                                    // output ring bytes
+    levelInput,                                     // unparsed input ring bytes
+    levelCount
+};
+
+enum ZStackMetricsLatency
+{
+    latencyResponse,                                // request sent to its SRSP
+    latencyConfirm,                                 // data request sent to its AF_DATA_CONFIRM
+    latencyCallback,                                // callback execution
+    latencyStartup,                                 // reset to coordinator ready
+    latencyCount
+};
+
+typedef void (*ZStackMetricsOutput) (const char *text, size_t length);
+
+struct metricsCommandStruct
+{
+    uint16_t command;
+    uint32_t received;
+    uint32_t sent;
+};
+
+struct metricsHistogramStruct
+{
+    uint32_t count;
+    uint32_t max;                                   // µs
+    uint32_t buckets[ZSTACK_METRICS_BUCKETS];
+};
+
+struct metricsStruct
+{
+    metricsCommandStruct commands[1 << ZSTACK_METRICS_COMMAND_BITS];
+    uint8_t  commandCount;
+    uint32_t framesReceived;
+    uint32_t framesSent;
+    uint32_t fcsErrors;
+    uint32_t skippedBytes;                          // input bytes dropped while looking for next frame
+    uint32_t rejectedFrames;                        // frames output ring had no room for
+    uint32_t droppedEvents;
+    uint32_t levels[levelCount];                    // high-water marks since start
+    metricsHistogramStruct latencies[latencyCount];
+};
+
+// counters are plain relaxed atomics updated by whatever task sees the thing happen, so there is no lock on any path,
+// snapshot is not atomic as a whole, counters may move while it is copied, which is fine for monitoring
+//
+// command counters sit in open addressing table claimed with compare and swap, entries are never removed
+
+class ZStackMetrics
+{
+    public:
+
+        ZStackMetrics(void);
+
+        void frameReceived(uint16_t command);
+        void frameSent(uint16_t command);
+        void fcsError(void);
+        void skippedBytes(size_t count);
+        void rejectedFrame(void);
+
+        void level(ZStackMetricsLevel level, uint32_t value);
+        void latency(ZStackMetricsLatency latency, uint32_t value);
+
+        void snapshot(metricsStruct *metrics);
+
+        // upper bound of the bucket holding given percentile, 0 for empty histogram
+        static uint32_t percentile(const metricsHistogramStruct *histogram, uint8_t percent);
+
+        // human readable report, one line per output call
+        static void dump(const metricsStruct *metrics, ZStackMetricsOutput output);
+
+    private:
+
+        struct commandStruct
+        {
+            std::atomic <uint16_t> command;
+            std::atomic <uint32_t> received, sent;
+        };
+
+        struct histogramStruct
+        {
+            std::atomic <uint32_t> count, max;
+            std::atomic <uint32_t> buckets[ZSTACK_METRICS_BUCKETS];
+        };
+
+        commandStruct m_commands[1 << ZSTACK_METRICS_COMMAND_BITS];
+        std::atomic <uint32_t> m_framesReceived, m_framesSent, m_fcsErrors, m_skippedBytes, m_rejectedFrames;
+        std::atomic <uint32_t> m_levels[levelCount];
+        histogramStruct m_latencies[latencyCount];
+
+        commandStruct *findCommand(uint16_t command);
+
+        static void updateMax(std::atomic <uint32_t> &target, uint32_t value);
+
+};
+
+#endif
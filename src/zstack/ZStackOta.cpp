@@ -0,0 +1,454 @@
+#include "ZStackOta.h"
+
+// block responses go as plain data requests, which ZNP does not fragment, so a block has to fit one APS frame
+#define BLOCK_LIMIT                                 (ZSTACK_OTA_APS_PAYLOAD - ZSTACK_OTA_ROUTE_ROOM - sizeof(zclHeader) - sizeof(otaBlockResponseStruct))
+
+ZStackOta::ZStackOta(ZStack *zstack, ZStackOtaCallback callback, int8_t core) : m_zstack(zstack), m_callback(callback), m_imageCount(0), m_inFlight(0), m_next(0), m_activeTime(0), m_tickTime(zstackMillis())
+{
+    memset(m_images, 0, sizeof(m_images));
+    memset(m_sessions, 0, sizeof(m_sessions));
+    memset(&m_stats, 0, sizeof(m_stats));
+    zstackCreateTask(otaTask, "ZStack OTA", 4096, this, 1, core);
+}
+
+bool ZStackOta::addImage(const uint8_t *data, uint32_t size)
+{
+    otaHeaderStruct header;
+    bool result = false;
+
+    if (size < sizeof(header))
+        return false;
+
+    memcpy(&header, data, sizeof(header));
+
+    if (header.magic != ZSTACK_OTA_MAGIC || header.headerLength < sizeof(header) || header.imageSize > size || header.imageSize < header.headerLength)
+        return false;
+
+    m_mutex.lock();
+
+    if (m_imageCount < ZSTACK_OTA_IMAGES)
+    {
+        imageStruct *image = &m_images[m_imageCount++];
+
+        image->id = {header.manufacturerCode, header.imageType, header.fileVersion};
+        image->data = data;
+        image->size = header.imageSize;
+        result = true;
+    }
+
+    m_mutex.unlock();
+    return result;
+}
+
+uint16_t ZStackOta::notify(uint16_t shortAddress, uint8_t endpointId)
+{
+    uint8_t payload[] = {0x00, 100}; // query jitter only, every device answers
+
+    return sendResponse(shortAddress, endpointId, m_zstack->transactionId(), OTA_IMAGE_NOTIFY, payload, sizeof(payload));
+}
+
+void ZStackOta::parseEvent(ZStackEvent event, void *data, size_t length)
+{
+    switch (event)
+    {
+        case ZStackEvent::requestFailed:
+        case ZStackEvent::requestFinished:
+        case ZStackEvent::requestTimeout:
+            requestFinished(event, reinterpret_cast <requestStatusStruct*> (data));
+            break;
+
+        case ZStackEvent::messageReceived:
+        {
+            incomingMessageStruct *message = reinterpret_cast <incomingMessageStruct*> (data);
+            size_t size;
+
+            if (message->clusterId != CLUSTER_OTA_UPGRADE || length < sizeof(incomingMessageStruct))
+                break;
+
+            // payload length comes from the air, event buffer may hold less of it
+
+            size = length - sizeof(incomingMessageStruct) < message->length ? length - sizeof(incomingMessageStruct) : message->length;
+
+            if (size >= sizeof(zclHeader))
+                parseRequest(message, reinterpret_cast <uint8_t*> (data) + sizeof(incomingMessageStruct), size);
+
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+void ZStackOta::stats(otaStatsStruct *stats)
+{
+    m_mutex.lock();
+
+    updateTime();
+    *stats = m_stats;
+    stats->sessions = 0;
+
+    for (uint8_t i = 0; i < ZSTACK_OTA_SESSIONS; i++)
+        if (m_sessions[i].active)
+            stats->sessions++;
+
+    stats->rate = m_activeTime ? static_cast <uint32_t> (m_stats.bytes * 1000 / m_activeTime) : 0;
+
+    m_mutex.unlock();
+}
+
+int8_t ZStackOta::findImage(const otaImageIdStruct *id, bool next)
+{
+    int8_t result = -1;
+
+    for (uint8_t i = 0; i < m_imageCount; i++)
+    {
+        const otaImageIdStruct *image = &m_images[i].id;
+
+        if (image->manufacturerCode != id->manufacturerCode || image->imageType != id->imageType)
+            continue;
+
+        if (!next)
+        {
+            if (image->fileVersion == id->fileVersion)
+                return i;
+
+            continue;
+        }
+
+        // newest image above the running version
+
+        if (image->fileVersion > id->fileVersion && (result < 0 || image->fileVersion > m_images[result].id.fileVersion))
+            result = i;
+    }
+
+    return result;
+}
+
+ZStackOta::sessionStruct *ZStackOta::findSession(uint16_t shortAddress, bool allocate)
+{
+    sessionStruct *free = NULL;
+
+    for (uint8_t i = 0; i < ZSTACK_OTA_SESSIONS; i++)
+    {
+        sessionStruct *session = &m_sessions[i];
+
+        if (!session->active)
+        {
+            // finished session keeps its slot until confirm of the last block arrives
+
+            if (!free && !session->handle)
+                free = session;
+
+            continue;
+        }
+
+        if (session->shortAddress == shortAddress)
+            return session;
+    }
+
+    if (!allocate || !free)
+        return NULL;
+
+    memset(free, 0, sizeof(sessionStruct));
+    free->shortAddress = shortAddress;
+    free->active = true;
+    return free;
+}
+
+void ZStackOta::parseRequest(incomingMessageStruct *message, uint8_t *data, size_t length)
+{
+    uint8_t frameControl = data[0], transactionId = data[1], commandId = data[2];
+
+    if (!(frameControl & FC_CLUSTER_SPECIFIC) || frameControl & (FC_MANUFACTURER_SPECIFIC | FC_SERVER_TO_CLIENT))
+        return;
+
+    switch (commandId)
+    {
+        case OTA_QUERY_NEXT_IMAGE_REQUEST:
+            queryRequest(message, transactionId, data + 3, length - 3);
+            break;
+
+        case OTA_IMAGE_BLOCK_REQUEST:
+            blockRequest(message, transactionId, data + 3, length - 3);
+            break;
+
+        case OTA_UPGRADE_END_REQUEST:
+            endRequest(message, transactionId, data + 3, length - 3);
+            break;
+    }
+}
+
+void ZStackOta::queryRequest(incomingMessageStruct *message, uint8_t transactionId, uint8_t *payload, size_t size)
+{
+    otaQueryRequestStruct request;
+    otaQueryResponseStruct response;
+    int8_t index;
+
+    if (size < sizeof(request))
+        return;
+
+    memcpy(&request, payload, sizeof(request));
+
+    m_mutex.lock();
+
+    if ((index = findImage(&request.image, true)) >= 0)
+    {
+        response.status = STATUS_SUCCESS;
+        response.image = m_images[index].id;
+        response.imageSize = m_images[index].size;
+    }
+    else
+        response.status = STATUS_NO_IMAGE_AVAILABLE;
+
+    m_mutex.unlock();
+
+    // status only response when there is nothing to offer
+
+    sendResponse(message->srcAddress, message->srcEndpointId, transactionId, OTA_QUERY_NEXT_IMAGE_RESPONSE, &response, response.status ? 1 : sizeof(response));
+}
+
+void ZStackOta::blockRequest(incomingMessageStruct *message, uint8_t transactionId, uint8_t *payload, size_t size)
+{
+    otaBlockRequestStruct request;
+    sessionStruct *session;
+    uint8_t status = STATUS_SUCCESS;
+    int8_t index;
+
+    if (size < sizeof(request))
+        return;
+
+    memcpy(&request, payload, sizeof(request));
+
+    m_mutex.lock();
+    updateTime();
+
+    if ((index = findImage(&request.image, false)) < 0 || request.fileOffset >= m_images[index].size || !request.maxDataSize)
+        status = index < 0 ? STATUS_ABORT : STATUS_MALFORMED_COMMAND;
+    else if (!(session = findSession(message->srcAddress, true)))
+        status = STATUS_WAIT_FOR_DATA;
+
+    if (status)
+    {
+        m_mutex.unlock();
+
+        if (status == STATUS_WAIT_FOR_DATA)
+        {
+            otaWaitResponseStruct response = {STATUS_WAIT_FOR_DATA, 0, ZSTACK_OTA_WAIT_TIME, 0};
+            sendResponse(message->srcAddress, message->srcEndpointId, transactionId, OTA_IMAGE_BLOCK_RESPONSE, &response, sizeof(response));
+        }
+        else
+            sendResponse(message->srcAddress, message->srcEndpointId, transactionId, OTA_IMAGE_BLOCK_RESPONSE, &status, sizeof(status));
+
+        return;
+    }
+
+    // repeated request replaces the waiting one, device gave up on it anyway
+
+    session->endpointId = message->srcEndpointId;
+    session->transactionId = transactionId;
+    session->image = static_cast <uint8_t> (index);
+    session->offset = request.fileOffset;
+    session->blockSize = static_cast <uint8_t> (request.maxDataSize < BLOCK_LIMIT ? request.maxDataSize : BLOCK_LIMIT);
+    session->pending = true;
+    session->time = zstackMillis();
+
+    sendBlocks();
+    m_mutex.unlock();
+}
+
+void ZStackOta::endRequest(incomingMessageStruct *message, uint8_t transactionId, uint8_t *payload, size_t size)
+{
+    otaEndRequestStruct request;
+    sessionStruct *session;
+
+    if (size < sizeof(request))
+        return;
+
+    memcpy(&request, payload, sizeof(request));
+
+    m_mutex.lock();
+    updateTime();
+
+    if ((session = findSession(message->srcAddress, false)))
+    {
+        if (request.status == STATUS_SUCCESS)
+            m_stats.completed++;
+        else
+            m_stats.failed++;
+
+        // block response still in flight keeps its slot until its confirm, session is gone already
+
+        session->active = false;
+        session->pending = false;
+    }
+
+    m_mutex.unlock();
+
+    // upgrade right now, both times are relative
+
+    if (request.status == STATUS_SUCCESS)
+    {
+        otaEndResponseStruct response = {request.image, 0, 0};
+        sendResponse(message->srcAddress, message->srcEndpointId, transactionId, OTA_UPGRADE_END_RESPONSE, &response, sizeof(response));
+    }
+    else
+        sendDefaultResponse(message, transactionId, OTA_UPGRADE_END_REQUEST, STATUS_SUCCESS);
+
+    if (session && m_callback)
+        m_callback(message->srcAddress, request.image.fileVersion, request.status);
+}
+
+void ZStackOta::requestFinished(ZStackEvent event, requestStatusStruct *status)
+{
+    m_mutex.lock();
+
+    for (uint8_t i = 0; i < ZSTACK_OTA_SESSIONS; i++)
+    {
+        sessionStruct *session = &m_sessions[i];
+
+        if (!session->handle || session->handle != status->handle)
+            continue;
+
+        if (event == ZStackEvent::requestFinished && !status->status)
+            m_stats.bytes += session->sentSize;
+
+        session->handle = 0;
+        m_inFlight--;
+
+        sendBlocks();
+        break;
+    }
+
+    m_mutex.unlock();
+}
+
+// failed upgrade end request gets no upgrade end response, spec asks for default response with success status instead
+void ZStackOta::sendDefaultResponse(incomingMessageStruct *message, uint8_t transactionId, uint8_t commandId, uint8_t status)
+{
+    zclHeader header = {FC_SERVER_TO_CLIENT | FC_DISABLE_DEFAULT_RESPONSE, transactionId, CMD_DEFAULT_RESPONSE};
+    uint8_t payload[] = {commandId, status};
+    frameSegmentStruct segments[] = {{&header, sizeof(header)}, {payload, sizeof(payload)}};
+
+    m_zstack->dataRequest(m_zstack->transactionId(), message->srcAddress, message->srcEndpointId, CLUSTER_OTA_UPGRADE, segments, 2);
+}
+
+uint16_t ZStackOta::sendResponse(uint16_t shortAddress, uint8_t endpointId, uint8_t transactionId, uint8_t commandId, const void *data, size_t length, const uint8_t *block, size_t blockSize)
+{
+    zclHeader header = {FC_CLUSTER_SPECIFIC | FC_SERVER_TO_CLIENT | FC_DISABLE_DEFAULT_RESPONSE, transactionId, commandId};
+    frameSegmentStruct segments[] = {{&header, sizeof(header)}, {data, length}, {block, blockSize}};
+
+    // ZCL transaction id echoes the request, data confirm is matched by own one, device ids would collide with ours
+
+    return m_zstack->dataRequest(m_zstack->transactionId(), shortAddress, endpointId, CLUSTER_OTA_UPGRADE, segments, block ? 3 : 2);
+}
+
+void ZStackOta::sendBlocks(void)
+{
+    // called with mutex locked, one waiting block per session at most, sessions take turns
+
+    for (uint8_t i = 0, start = m_next; i < ZSTACK_OTA_SESSIONS && m_inFlight < ZSTACK_OTA_IN_FLIGHT; i++)
+    {
+        uint8_t index = (start + i) % ZSTACK_OTA_SESSIONS;
+        sessionStruct *session = &m_sessions[index];
+        const imageStruct *image;
+        otaBlockResponseStruct response;
+
+        if (!session->active || !session->pending || session->handle)
+            continue;
+
+        image = &m_images[session->image];
+
+        if (session->blockSize > image->size - session->offset)
+            session->blockSize = static_cast <uint8_t> (image->size - session->offset);
+
+        response.status = STATUS_SUCCESS;
+        response.image = image->id;
+        response.fileOffset = session->offset;
+        response.dataSize = session->blockSize;
+
+        if (!(session->handle = sendResponse(session->shortAddress, session->endpointId, session->transactionId, OTA_IMAGE_BLOCK_RESPONSE, &response, sizeof(response), image->data + session->offset, session->blockSize)))
+            break;
+
+        session->pending = false;
+        session->sentSize = session->blockSize;
+        session->sent = zstackMillis();
+        m_inFlight++;
+        m_next = (index + 1) % ZSTACK_OTA_SESSIONS;
+    }
+}
+
+void ZStackOta::process(void)
+{
+    uint16_t expired[ZSTACK_OTA_SESSIONS];
+    uint32_t now = zstackMillis(), versions[ZSTACK_OTA_SESSIONS];
+    uint8_t count = 0;
+
+    m_mutex.lock();
+    updateTime();
+
+    for (uint8_t i = 0; i < ZSTACK_OTA_SESSIONS; i++)
+    {
+        sessionStruct *session = &m_sessions[i];
+
+        // request table reports its own timeout, slot of a block whose result event got dropped is taken back here
+
+        if (session->handle && now - session->sent >= ZSTACK_REQUEST_TIMEOUT * 2)
+        {
+            session->handle = 0;
+            m_inFlight--;
+        }
+
+        if (!session->active)
+            continue;
+
+        if (now - session->time < ZSTACK_OTA_SESSION_TIMEOUT)
+            continue;
+
+        expired[count] = session->shortAddress;
+        versions[count++] = m_images[session->image].id.fileVersion;
+
+        session->active = false;
+        session->pending = false;
+        m_stats.failed++;
+    }
+
+    sendBlocks();
+
+    m_mutex.unlock();
+
+    if (!m_callback)
+        return;
+
+    for (uint8_t i = 0; i < count; i++)
+        m_callback(expired[i], versions[i], STATUS_TIMEOUT);
+}
+
+void ZStackOta::updateTime(void)
+{
+    uint32_t now = zstackMillis();
+
+    // called with mutex locked before sessions change, rate is measured over the time any device was upgrading only
+
+    for (uint8_t i = 0; i < ZSTACK_OTA_SESSIONS; i++)
+    {
+        if (!m_sessions[i].active)
+            continue;
+
+        m_activeTime += now - m_tickTime;
+        break;
+    }
+
+    m_tickTime = now;
+}
+
+void ZStackOta::otaTask(void *data)
+{
+    ZStackOta *ota = reinterpret_cast <ZStackOta*> (data);
+
+    while (1)
+    {
+        zstackDelay(ZSTACK_OTA_INTERVAL);
+        ota->process();
+    }
+}
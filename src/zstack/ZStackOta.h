@@ -0,0 +1,183 @@
+#ifndef ZSTACK_OTA_H
+#define ZSTACK_OTA_H
+
+#include "ZCL.h"
+#include "ZStack.h"
+
+#define ZSTACK_OTA_MAGIC                            0x0BEEF11E
+#define ZSTACK_OTA_IMAGES                           4
+#define ZSTACK_OTA_SESSIONS                         16     // devices upgrading at the same time, more get wait for data response
+#define ZSTACK_OTA_IN_FLIGHT                        4      // block responses waiting for confirm, shared by all sessions
+#define ZSTACK_OTA_INTERVAL                         50     // ms between checks for blocks waiting for in-flight slot
+#define ZSTACK_OTA_SESSION_TIMEOUT                  60000  // ms without block request after which session slot is reused
+#define ZSTACK_OTA_WAIT_TIME                        30     // seconds busy server asks devices to wait before next block request
+#define ZSTACK_OTA_APS_PAYLOAD                      82     // unfragmented APS payload with network security, ZNP refuses longer plain data requests
+#define ZSTACK_OTA_ROUTE_ROOM                       (2 + ZSTACK_ROUTE_RELAYS * 2) // NWK source route subframe of the longest cached route takes it from the payload
+
+#pragma pack(push, 1)
+
+struct otaHeaderStruct
+{
+    uint32_t magic;
+    uint16_t headerVersion;
+    uint16_t headerLength;
+    uint16_t fieldControl;
+    uint16_t manufacturerCode;
+    uint16_t imageType;
+    uint32_t fileVersion;
+    uint16_t stackVersion;
+    uint8_t  headerString[32];
+    uint32_t imageSize;
+};
+
+struct otaImageIdStruct
+{
+    uint16_t manufacturerCode;
+    uint16_t imageType;
+    uint32_t fileVersion;
+};
+
+struct otaQueryRequestStruct
+{
+    uint8_t  fieldControl;
+    otaImageIdStruct image;                                // current one, hardware version may follow
+};
+
+struct otaQueryResponseStruct
+{
+    uint8_t  status;
+    otaImageIdStruct image;
+    uint32_t imageSize;
+};
+
+struct otaBlockRequestStruct
+{
+    uint8_t  fieldControl;
+    otaImageIdStruct image;
+    uint32_t fileOffset;
+    uint8_t  maxDataSize;                                  // node address and minimum block period may follow
+};
+
+struct otaBlockResponseStruct                              // followed by block data
+{
+    uint8_t  status;
+    otaImageIdStruct image;
+    uint32_t fileOffset;
+    uint8_t  dataSize;
+};
+
+struct otaWaitResponseStruct
+{
+    uint8_t  status;
+    uint32_t currentTime;                                  // zero, request time is relative then
+    uint32_t requestTime;
+    uint16_t minimumBlockPeriod;
+};
+
+struct otaEndRequestStruct
+{
+    uint8_t  status;
+    otaImageIdStruct image;
+};
+
+struct otaEndResponseStruct
+{
+    otaImageIdStruct image;
+    uint32_t currentTime;
+    uint32_t upgradeTime;
+};
+
+#pragma pack(pop)
+
+struct otaStatsStruct
+{
+    uint8_t  sessions;                                     // devices upgrading right now
+    uint32_t completed;
+    uint32_t failed;
+    uint64_t bytes;                                        // image bytes confirmed by ZNP
+    uint32_t rate;                                         // aggregate bytes per second over the time any device was upgrading
+};
+
+typedef void (*ZStackOtaCallback) (uint16_t shortAddress, uint32_t fileVersion, uint8_t status);
+
+// OTA Upgrade cluster server, images stay where they are (flash, mmap) and block responses are gathered straight from them
+//
+// block requests of all sessions wait in their session until one of ZSTACK_OTA_IN_FLIGHT slots is free, slots are
+// given round robin, so many devices upgrading at once share the link evenly instead of flooding the request queue,
+// block size is the one each device asks for, limited only by what fits into one data request
+
+class ZStackOta
+{
+    public:
+
+        ZStackOta(ZStack *zstack, ZStackOtaCallback callback = NULL, int8_t core = 0);
+
+        // image is a complete OTA file, its header is checked and it must stay valid while server runs
+        bool addImage(const uint8_t *data, uint32_t size);
+
+        // image notify makes device query next image now instead of at its next query interval
+        uint16_t notify(uint16_t shortAddress, uint8_t endpointId);
+
+        // forward ZStack events here, OTA cluster commands and block response results are taken from them
+        void parseEvent(ZStackEvent event, void *data, size_t length);
+
+        void stats(otaStatsStruct *stats);
+
+    private:
+
+        struct imageStruct
+        {
+            otaImageIdStruct id;
+            const uint8_t *data;
+            uint32_t size;
+        };
+
+        struct sessionStruct
+        {
+            uint16_t shortAddress;
+            uint8_t  endpointId;
+            bool     active;
+            bool     pending;
+            uint8_t  transactionId;
+            uint8_t  image;
+            uint8_t  blockSize;
+            uint32_t offset;
+            uint16_t handle;
+            uint8_t  sentSize;                             // block of the response in flight, repeated request may change blockSize meanwhile
+            uint32_t time, sent;
+        };
+
+        ZStack *m_zstack;
+        ZStackOtaCallback m_callback;
+
+        imageStruct m_images[ZSTACK_OTA_IMAGES];
+        uint8_t m_imageCount;
+
+        sessionStruct m_sessions[ZSTACK_OTA_SESSIONS];
+        uint8_t m_inFlight, m_next;
+
+        otaStatsStruct m_stats;
+        uint32_t m_activeTime, m_tickTime;
+
+        ZStackMutex m_mutex;
+
+        int8_t findImage(const otaImageIdStruct *id, bool next);
+        sessionStruct *findSession(uint16_t shortAddress, bool allocate);
+
+        void parseRequest(incomingMessageStruct *message, uint8_t *data, size_t length);
+        void queryRequest(incomingMessageStruct *message, uint8_t transactionId, uint8_t *payload, size_t size);
+        void blockRequest(incomingMessageStruct *message, uint8_t transactionId, uint8_t *payload, size_t size);
+        void endRequest(incomingMessageStruct *message, uint8_t transactionId, uint8_t *payload, size_t size);
+        void requestFinished(ZStackEvent event, requestStatusStruct *status);
+
+        void sendDefaultResponse(incomingMessageStruct *message, uint8_t transactionId, uint8_t commandId, uint8_t status);
+        uint16_t sendResponse(uint16_t shortAddress, uint8_t endpointId, uint8_t transactionId, uint8_t commandId, const void *data, size_t length, const uint8_t *block = NULL, size_t blockSize = 0);
+        void sendBlocks(void);
+        void updateTime(void);
+        void process(void);
+
+        static void otaTask(void *data);
+
+};
+
+#endif
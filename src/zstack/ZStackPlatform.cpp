@@ -0,0 +1,225 @@
+#include "ZStackPlatform.h"
+
+#ifdef ARDUINO
+
+#include "esp_timer.h"
+
+ZStackMutex::ZStackMutex(void)
+{
+    m_handle = xSemaphoreCreateMutex();
+}
+
+ZStackMutex::~ZStackMutex(void)
+{
+    vSemaphoreDelete(m_handle);
+}
+
+void ZStackMutex::lock(void)
+{
+    xSemaphoreTake(m_handle, portMAX_DELAY);
+}
+
+void ZStackMutex::unlock(void)
+{
+    xSemaphoreGive(m_handle);
+}
+
+ZStackQueue::ZStackQueue(size_t length)
+{
+    m_handle = xQueueCreate(length, sizeof(void*));
+}
+
+ZStackQueue::~ZStackQueue(void)
+{
+    vQueueDelete(m_handle);
+}
+
+bool ZStackQueue::send(void *item, uint32_t timeout)
+{
+    return xQueueSend(m_handle, &item, timeout == 0xFFFFFFFF ? portMAX_DELAY : pdMS_TO_TICKS(timeout)) == pdTRUE;
+}
+
+bool ZStackQueue::receive(void **item, uint32_t timeout)
+{
+    return xQueueReceive(m_handle, item, timeout == 0xFFFFFFFF ? portMAX_DELAY : pdMS_TO_TICKS(timeout)) == pdTRUE;
+}
+
+bool zstackCreateTask(ZStackTask task, const char *name, uint32_t stackSize, void *data, uint8_t priority, int8_t core)
+{
+    return xTaskCreatePinnedToCore(task, name, stackSize, data, priority, NULL, core < 0 ? tskNO_AFFINITY : core) == pdPASS;
+}
+
+void zstackDelay(uint32_t ms)
+{
+    delay(ms);
+}
+
+uint32_t zstackMillis(void)
+{
+    return millis();
+}
+
+uint64_t zstackMicros(void)
+{
+    return static_cast <uint64_t> (esp_timer_get_time());
+}
+
+#else
+
+#include <errno.h>
+#include <time.h>
+
+ZStackMutex::ZStackMutex(void)
+{
+    pthread_mutex_init(&m_handle, NULL);
+}
+
+ZStackMutex::~ZStackMutex(void)
+{
+    pthread_mutex_destroy(&m_handle);
+}
+
+void ZStackMutex::lock(void)
+{
+    pthread_mutex_lock(&m_handle);
+}
+
+void ZStackMutex::unlock(void)
+{
+    pthread_mutex_unlock(&m_handle);
+}
+
+ZStackQueue::ZStackQueue(size_t length) : m_items(new void* [length]), m_length(length), m_head(0), m_count(0)
+{
+    pthread_condattr_t attributes;
+
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+
+    pthread_mutex_init(&m_mutex, NULL);
+    pthread_cond_init(&m_condition, &attributes);
+    pthread_condattr_destroy(&attributes);
+}
+
+ZStackQueue::~ZStackQueue(void)
+{
+    pthread_cond_destroy(&m_condition);
+    pthread_mutex_destroy(&m_mutex);
+    delete[] m_items;
+}
+
+bool ZStackQueue::send(void *item, uint32_t timeout)
+{
+    pthread_mutex_lock(&m_mutex);
+
+    if (!wait(timeout, false))
+    {
+        pthread_mutex_unlock(&m_mutex);
+        return false;
+    }
+
+    m_items[(m_head + m_count++) % m_length] = item;
+    pthread_cond_broadcast(&m_condition);
+    pthread_mutex_unlock(&m_mutex);
+    return true;
+}
+
+bool ZStackQueue::receive(void **item, uint32_t timeout)
+{
+    pthread_mutex_lock(&m_mutex);
+
+    if (!wait(timeout, true))
+    {
+        pthread_mutex_unlock(&m_mutex);
+        return false;
+    }
+
+    *item = m_items[m_head];
+    m_head = (m_head + 1) % m_length;
+    m_count--;
+
+    pthread_cond_broadcast(&m_condition);
+    pthread_mutex_unlock(&m_mutex);
+    return true;
+}
+
+bool ZStackQueue::wait(uint32_t timeout, bool receive)
+{
+    timespec deadline;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += static_cast <long> (timeout % 1000) * 1000000;
+
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    while (receive ? !m_count : m_count == m_length)
+    {
+        if (!timeout || (timeout != 0xFFFFFFFF ? pthread_cond_timedwait(&m_condition, &m_mutex, &deadline) : pthread_cond_wait(&m_condition, &m_mutex)) == ETIMEDOUT)
+            return false;
+    }
+
+    return true;
+}
+
+struct taskStartStruct
+{
+    ZStackTask task;
+    void *data;
+};
+
+static void *taskStart(void *data)
+{
+    taskStartStruct start = *reinterpret_cast <taskStartStruct*> (data);
+
+    delete reinterpret_cast <taskStartStruct*> (data);
+    start.task(start.data);
+
+    return NULL;
+}
+
+bool zstackCreateTask(ZStackTask task, const char *name, uint32_t stackSize, void *data, uint8_t priority, int8_t core)
+{
+    taskStartStruct *start = new taskStartStruct {task, data};
+    pthread_t thread;
+
+    (void) name;
+    (void) stackSize;
+    (void) priority;
+    (void) core;
+
+    if (pthread_create(&thread, NULL, taskStart, start))
+    {
+        delete start;
+        return false;
+    }
+
+    pthread_detach(thread);
+    return true;
+}
+
+void zstackDelay(uint32_t ms)
+{
+    timespec time = {static_cast <time_t> (ms / 1000), static_cast <long> (ms % 1000) * 1000000};
+    nanosleep(&time, NULL);
+}
+
+uint32_t zstackMillis(void)
+{
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return static_cast <uint32_t> (time.tv_sec * 1000 + time.tv_nsec / 1000000);
+}
+
+uint64_t zstackMicros(void)
+{
+    timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return static_cast <uint64_t> (time.tv_sec) * 1000000 + time.tv_nsec / 1000;
+}
+
+#endif
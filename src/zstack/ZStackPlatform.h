@@ -0,0 +1,73 @@
+#ifndef ZSTACK_PLATFORM_H
+#define ZSTACK_PLATFORM_H
+
+#ifdef ARDUINO
+
+#include "Arduino.h"
+
+#else
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#endif
+
+typedef void (*ZStackTask) (void *data);
+
+class ZStackMutex
+{
+    public:
+
+        ZStackMutex(void);
+        ~ZStackMutex(void);
+
+        void lock(void);
+        void unlock(void);
+
+    private:
+
+#ifdef ARDUINO
+        SemaphoreHandle_t m_handle;
+#else
+        pthread_mutex_t m_handle;
+#endif
+
+};
+
+// thin layer over FreeRTOS (ESP32) or pthreads (host build), so the stack itself stays platform independent
+
+// fixed length queue of pointers, timeout in ms, 0 does not wait and 0xFFFFFFFF waits forever
+class ZStackQueue
+{
+    public:
+
+        ZStackQueue(size_t length);
+        ~ZStackQueue(void);
+
+        bool send(void *item, uint32_t timeout);
+        bool receive(void **item, uint32_t timeout);
+
+    private:
+
+#ifdef ARDUINO
+        QueueHandle_t m_handle;
+#else
+        pthread_mutex_t m_mutex;
+        pthread_cond_t m_condition;
+        void **m_items;
+        size_t m_length, m_head, m_count;
+
+        bool wait(uint32_t timeout, bool receive);
+#endif
+
+};
+
+bool zstackCreateTask(ZStackTask task, const char *name, uint32_t stackSize, void *data, uint8_t priority, int8_t core);
+void zstackDelay(uint32_t ms);
+uint32_t zstackMillis(void);
+uint64_t zstackMicros(void);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef ZSTACK_PORT_H
+#define ZSTACK_PORT_H
+
+#include "ZStackPlatform.h"
+
+#define ZSTACK_WAIT_FOREVER                         0xFFFFFFFF
+
+// transport between ZStack and the ZNP, see ZStackUartPort (ESP32) and ZStackPosixPort (host build)
+
+class ZStackPort
+{
+    public:
+
+        virtual ~ZStackPort(void) {}
+
+        // called from ZStack::start, false fails the start
+        virtual bool begin(void) = 0;
+        // blocks until some data arrives or timeout (ms) expires, returns 0 on timeout or hangup
+        virtual size_t read(uint8_t *buffer, size_t length, uint32_t timeout) = 0;
+        virtual size_t write(const uint8_t *buffer, size_t length) = 0;
+
+        // false after read found the other side gone (unplugged USB stick, pty without slave), true again with next data
+        virtual bool connected(void) { return true; }
+
+        // returns false if the transport has no reset line, ZStack will request soft reset then
+        virtual bool reset(void) = 0;
+
+};
+
+#endif
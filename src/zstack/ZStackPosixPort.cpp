@@ -0,0 +1,175 @@
+#ifndef ARDUINO
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#include "ZStackPosixPort.h"
+
+static speed_t baudRateSpeed(uint32_t baudRate)
+{
+    switch (baudRate)
+    {
+        case 9600:    return B9600;
+        case 19200:   return B19200;
+        case 38400:   return B38400;
+        case 57600:   return B57600;
+        case 115200:  return B115200;
+        case 230400:  return B230400;
+#ifdef B460800
+        case 460800:  return B460800;
+#endif
+#ifdef B921600
+        case 921600:  return B921600;
+#endif
+#ifdef B1000000
+        case 1000000: return B1000000;
+#endif
+        default:      return B0;
+    }
+}
+
+ZStackPosixPort::ZStackPosixPort(const char *path, uint32_t baudRate, bool flowControl, bool hardwareReset) : m_path(strdup(path)), m_fd(-1), m_baudRate(baudRate), m_flowControl(flowControl), m_hardwareReset(hardwareReset), m_connected(true) {}
+
+ZStackPosixPort::ZStackPosixPort(int fd, uint32_t baudRate, bool flowControl, bool hardwareReset) : m_path(NULL), m_fd(fd), m_baudRate(baudRate), m_flowControl(flowControl), m_hardwareReset(hardwareReset), m_connected(true) {}
+
+ZStackPosixPort::~ZStackPosixPort(void)
+{
+    if (m_fd >= 0)
+        close(m_fd);
+
+    free(m_path);
+}
+
+bool ZStackPosixPort::begin(void)
+{
+    speed_t speed = baudRateSpeed(m_baudRate);
+    termios options;
+
+    // errno tells the caller what went wrong
+
+    if (speed == B0)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (m_path && (m_fd = open(m_path, O_RDWR | O_NOCTTY)) < 0)
+        return false;
+
+    if (!isatty(m_fd))
+        return true;
+
+    if (tcgetattr(m_fd, &options) < 0)
+        return false;
+
+    cfmakeraw(&options);
+    cfsetspeed(&options, speed);
+
+    options.c_cflag |= CLOCAL | CREAD;
+
+    if (m_flowControl)
+        options.c_cflag |= CRTSCTS;
+    else
+        options.c_cflag &= ~CRTSCTS;
+
+    options.c_cc[VMIN] = 1;
+    options.c_cc[VTIME] = 0;
+
+    return !tcsetattr(m_fd, TCSANOW, &options);
+}
+
+size_t ZStackPosixPort::read(uint8_t *buffer, size_t length, uint32_t timeout)
+{
+    pollfd descriptor = {m_fd, POLLIN, 0};
+    uint32_t start = zstackMillis();
+    int wait;
+
+    while (1)
+    {
+        uint32_t elapsed = zstackMillis() - start;
+        ssize_t result;
+        int ready;
+
+        wait = timeout == ZSTACK_WAIT_FOREVER ? -1 : static_cast <int> (elapsed < timeout ? timeout - elapsed : 0);
+        ready = poll(&descriptor, 1, wait);
+
+        if (ready < 0 && errno == EINTR)
+            continue;
+
+        if (ready <= 0)
+            return 0;
+
+        if (!(descriptor.revents & POLLIN))
+            break;
+
+        result = ::read(m_fd, buffer, length);
+
+        if (result > 0)
+        {
+            m_connected = true;
+            return static_cast <size_t> (result);
+        }
+
+        if (result < 0 && (errno == EINTR || errno == EAGAIN))
+            continue;
+
+        break;
+    }
+
+    // hangup, error or end of file, caller sees it from connected() and its read loop is slowed down here instead of spinning
+
+    m_connected = false;
+    zstackDelay(wait >= 0 && wait < ZSTACK_POSIX_HANGUP_DELAY ? wait : ZSTACK_POSIX_HANGUP_DELAY);
+    return 0;
+}
+
+size_t ZStackPosixPort::write(const uint8_t *buffer, size_t length)
+{
+    size_t offset = 0;
+
+    while (offset < length)
+    {
+        ssize_t result = ::write(m_fd, buffer + offset, length - offset);
+
+        if (result < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            break;
+        }
+
+        offset += result;
+    }
+
+    return offset;
+}
+
+bool ZStackPosixPort::connected(void)
+{
+    return m_connected;
+}
+
+bool ZStackPosixPort::reset(void)
+{
+    int lines = TIOCM_RTS;
+
+    // any tty accepts the ioctl whether reset is wired or not, and with flow control RTS belongs to the driver
+
+    if (!m_hardwareReset || m_flowControl || !isatty(m_fd))
+        return false;
+
+    if (ioctl(m_fd, TIOCMBIS, &lines) < 0)
+        return false;
+
+    zstackDelay(10);
+    ioctl(m_fd, TIOCMBIC, &lines);
+    return true;
+}
+
+#endif
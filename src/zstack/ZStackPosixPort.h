@@ -0,0 +1,43 @@
+#ifndef ZSTACK_POSIX_PORT_H
+#define ZSTACK_POSIX_PORT_H
+
+#ifndef ARDUINO
+
+#include "ZStackPort.h"
+
+#define ZSTACK_POSIX_HANGUP_DELAY                   100    // ms read waits on hangup, pty without slave or closed socket reports it constantly
+#define ZSTACK_POSIX_BAUD_RATE                      115200 // default ZNP firmware speed
+
+class ZStackPosixPort : public ZStackPort
+{
+    public:
+
+        // serial device or pty slave path (copied, it is opened only by begin), or already opened descriptor (socketpair end, pty master),
+        // baud rate must match ZNP firmware and have termios constant, flow control is RTS/CTS,
+        // hardware reset pulses RTS for sticks with ZNP reset wired to it, it is off by default
+        // and with flow control, ZStack sends SYS_RESET_REQ instead then
+        ZStackPosixPort(const char *path, uint32_t baudRate = ZSTACK_POSIX_BAUD_RATE, bool flowControl = false, bool hardwareReset = false);
+        ZStackPosixPort(int fd, uint32_t baudRate = ZSTACK_POSIX_BAUD_RATE, bool flowControl = false, bool hardwareReset = false);
+        ~ZStackPosixPort(void);
+
+        // sets errno on failure, EINVAL for baud rate without termios constant
+        bool begin(void) override;
+        size_t read(uint8_t *buffer, size_t length, uint32_t timeout) override;
+        size_t write(const uint8_t *buffer, size_t length) override;
+        bool reset(void) override;
+        bool connected(void) override;
+
+    private:
+
+        char *m_path;
+        int m_fd;
+        uint32_t m_baudRate;
+        bool m_flowControl;
+        bool m_hardwareReset;
+        bool m_connected;
+
+};
+
+#endif
+
+#endif
@@ -0,0 +1,392 @@
+#include "ZStackProvisioning.h"
+
+ZStackProvisioning::ZStackProvisioning(ZStack *zstack, const provisionProfileStruct *profile, ZStackProvisionCallback callback, int8_t core) : m_zstack(zstack), m_profile(profile), m_callback(callback), m_next(0), m_backlogHead(0), m_backlogTail(0)
+{
+    memset(m_jobs, 0, sizeof(m_jobs));
+    zstackCreateTask(provisionTask, "ZStack Provision", 4096, this, 1, core);
+}
+
+void ZStackProvisioning::deviceJoined(uint16_t shortAddress, uint64_t ieeeAddress)
+{
+    jobStruct *job = NULL;
+
+    m_mutex.lock();
+
+    for (uint8_t i = 0; i < ZSTACK_PROVISION_JOBS; i++)
+    {
+        if (m_jobs[i].state != jobFree && m_jobs[i].ieeeAddress == ieeeAddress)
+        {
+            job = &m_jobs[i];
+            break;
+        }
+
+        if (!job && m_jobs[i].state == jobFree)
+            job = &m_jobs[i];
+    }
+
+    if (!job)
+    {
+        // short address is taken from device index when job starts, it may change until then
+
+        if (m_backlogTail - m_backlogHead < ZSTACK_PROVISION_BACKLOG)
+            m_backlog[m_backlogTail++ % ZSTACK_PROVISION_BACKLOG] = ieeeAddress;
+
+        m_mutex.unlock();
+        return;
+    }
+
+    startJob(job, shortAddress, ieeeAddress);
+    m_mutex.unlock();
+}
+
+void ZStackProvisioning::parseEvent(ZStackEvent event, void *data, size_t length)
+{
+    switch (event)
+    {
+        case ZStackEvent::requestFailed:
+        case ZStackEvent::requestFinished:
+        case ZStackEvent::bindFailed:
+        case ZStackEvent::bindFinished:
+        case ZStackEvent::requestTimeout:
+            requestFinished(event, reinterpret_cast <requestStatusStruct*> (data));
+            break;
+
+        case ZStackEvent::messageReceived:
+        {
+            incomingMessageStruct *message = reinterpret_cast <incomingMessageStruct*> (data);
+
+            if (length >= sizeof(incomingMessageStruct) + sizeof(zclHeader))
+                parseResponse(message, reinterpret_cast <uint8_t*> (data) + sizeof(incomingMessageStruct), message->length);
+
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+void ZStackProvisioning::startJob(jobStruct *job, uint16_t shortAddress, uint64_t ieeeAddress)
+{
+    memset(job, 0, sizeof(jobStruct));
+
+    job->ieeeAddress = ieeeAddress;
+    job->shortAddress = shortAddress;
+    job->state = jobIdle;
+
+    for (uint8_t i = 0; i < m_profile->clusterCount && i < ZSTACK_PROVISION_CLUSTERS; i++)
+    {
+        const provisionClusterStruct *cluster = &m_profile->clusters[i];
+
+        if (cluster->bind)
+            job->bind |= 1 << i;
+
+        job->report[i] = static_cast <uint16_t> ((1UL << (cluster->attributeCount < 16 ? cluster->attributeCount : 16)) - 1);
+    }
+}
+
+void ZStackProvisioning::parseResponse(incomingMessageStruct *message, uint8_t *data, size_t length)
+{
+    uint8_t frameControl = data[0], transactionId, commandId, *payload;
+    size_t size;
+
+    if (frameControl & FC_CLUSTER_SPECIFIC)
+        return;
+
+    if (frameControl & FC_MANUFACTURER_SPECIFIC)
+    {
+        if (length < 5)
+            return;
+
+        transactionId = data[3];
+        commandId = data[4];
+        payload = data + 5;
+        size = length - 5;
+    }
+    else
+    {
+        transactionId = data[1];
+        commandId = data[2];
+        payload = data + 3;
+        size = length - 3;
+    }
+
+    if (commandId != CMD_CONFIGURE_REPORTING_RESPONSE || !size)
+        return;
+
+    m_mutex.lock();
+
+    for (uint8_t i = 0; i < ZSTACK_PROVISION_JOBS; i++)
+    {
+        jobStruct *job = &m_jobs[i];
+        const provisionClusterStruct *cluster;
+        uint16_t retry = 0;
+
+        if (job->state != jobReport || job->shortAddress != message->srcAddress || job->transactionId != transactionId)
+            continue;
+
+        cluster = &m_profile->clusters[job->cluster];
+
+        if (cluster->clusterId != message->clusterId)
+            continue;
+
+        // single success status means all records were accepted, otherwise only failed records are listed
+
+        if (size == 1)
+        {
+            if (payload[0] != STATUS_SUCCESS)
+                retry = job->sent;
+        }
+        else
+        {
+            for (size_t offset = 0; offset + sizeof(configureReportingStatusStruct) <= size; offset += sizeof(configureReportingStatusStruct))
+            {
+                configureReportingStatusStruct record;
+
+                memcpy(&record, payload + offset, sizeof(record));
+
+                for (uint8_t j = 0; j < cluster->attributeCount && j < 16; j++)
+                {
+                    if (cluster->attributes[j].attributeId != record.attributeId)
+                        continue;
+
+                    if (record.status == STATUS_UNSUPPORTED_ATTRIBUTE || record.status == STATUS_UNREPORTABLE_ATTRIBUTE)
+                        job->failed = true;
+                    else if (record.status != STATUS_SUCCESS)
+                        retry |= 1 << j;
+
+                    break;
+                }
+            }
+        }
+
+        // records left out of the frame stay pending for the next one
+
+        job->report[job->cluster] &= ~(job->sent & ~retry);
+
+        if (retry)
+        {
+            retryJob(job);
+            break;
+        }
+
+        job->state = jobIdle;
+        job->retries = 0;
+        break;
+    }
+
+    m_mutex.unlock();
+}
+
+void ZStackProvisioning::requestFinished(ZStackEvent event, requestStatusStruct *status)
+{
+    m_mutex.lock();
+
+    for (uint8_t i = 0; i < ZSTACK_PROVISION_JOBS; i++)
+    {
+        jobStruct *job = &m_jobs[i];
+
+        if ((job->state != jobBind && job->state != jobReport) || !status->handle || job->handle != status->handle)
+            continue;
+
+        if (status->status || event == ZStackEvent::requestFailed || event == ZStackEvent::bindFailed || event == ZStackEvent::requestTimeout)
+        {
+            retryJob(job);
+            break;
+        }
+
+        // confirmed configure reporting still waits for device response
+
+        if (event == ZStackEvent::bindFinished)
+        {
+            job->bind &= ~(1 << job->cluster);
+            job->state = jobIdle;
+            job->retries = 0;
+        }
+
+        job->handle = 0;
+        job->time = zstackMillis();
+        break;
+    }
+
+    m_mutex.unlock();
+}
+
+void ZStackProvisioning::retryJob(jobStruct *job)
+{
+    if (++job->retries > ZSTACK_PROVISION_RETRIES)
+    {
+        if (job->state == jobBind)
+            job->bind &= ~(1 << job->cluster);
+        else
+            job->report[job->cluster] = 0;
+
+        job->failed = true;
+        job->retries = 0;
+    }
+
+    job->handle = 0;
+    job->state = jobIdle;
+}
+
+bool ZStackProvisioning::sendFrame(jobStruct *job)
+{
+    uint8_t buffer[ZSTACK_BUFFER_SIZE - ZSTACK_MINIMAL_LENGTH - sizeof(dataRequestStruct)];
+
+    for (uint8_t i = 0; i < m_profile->clusterCount && i < ZSTACK_PROVISION_CLUSTERS; i++)
+    {
+        const provisionClusterStruct *cluster = &m_profile->clusters[i];
+
+        if (job->bind & (1 << i))
+        {
+            if (!(job->handle = m_zstack->bindRequest(job->shortAddress, job->ieeeAddress, m_profile->endpointId, cluster->clusterId)))
+                return false;
+
+            job->state = jobBind;
+            job->cluster = i;
+            job->time = zstackMillis();
+            return true;
+        }
+    }
+
+    for (uint8_t i = 0; i < m_profile->clusterCount && i < ZSTACK_PROVISION_CLUSTERS; i++)
+    {
+        const provisionClusterStruct *cluster = &m_profile->clusters[i];
+        zclHeader header;
+        size_t length = sizeof(header);
+
+        if (!job->report[i])
+            continue;
+
+        header.frameControl = 0x00;
+        header.transationId = m_zstack->transactionId();
+        header.commandId = CMD_CONFIGURE_REPORTING;
+
+        memcpy(buffer, &header, sizeof(header));
+        job->sent = 0;
+
+        // all pending attributes of the cluster go into one command, records that do not fit are sent next time
+
+        for (uint8_t j = 0; j < cluster->attributeCount && j < 16; j++)
+        {
+            const provisionAttributeStruct *attribute = &cluster->attributes[j];
+            configureReportingStruct record;
+            uint8_t size = zclAnalogDataType(attribute->dataType) ? zclDataSize(attribute->dataType) : 0;
+
+            if (!(job->report[i] & (1 << j)) || length + sizeof(record) + size > sizeof(buffer))
+                continue;
+
+            record.direction = 0x00; // server to client
+            record.attributeId = attribute->attributeId;
+            record.dataType = attribute->dataType;
+            record.minInterval = attribute->minInterval;
+            record.maxInterval = attribute->maxInterval;
+
+            memcpy(buffer + length, &record, sizeof(record));
+            length += sizeof(record);
+            job->sent |= 1 << j;
+
+            for (uint8_t k = 0; k < size; k++)
+                buffer[length++] = k < sizeof(attribute->valueChange) ? static_cast <uint8_t> (attribute->valueChange >> (k * 8)) : 0x00;
+        }
+
+        if (!(job->handle = m_zstack->dataRequest(header.transationId, job->shortAddress, m_profile->endpointId, cluster->clusterId, buffer, length)))
+            return false;
+
+        job->state = jobReport;
+        job->transactionId = header.transationId;
+        job->cluster = i;
+        job->time = zstackMillis();
+        return true;
+    }
+
+    return false;
+}
+
+void ZStackProvisioning::process(void)
+{
+    uint64_t finished[ZSTACK_PROVISION_JOBS];
+    bool success[ZSTACK_PROVISION_JOBS], sent = false;
+    uint32_t now = zstackMillis();
+    uint8_t count = 0;
+
+    m_mutex.lock();
+
+    for (uint8_t i = 0; i < ZSTACK_PROVISION_JOBS; i++)
+    {
+        jobStruct *job = &m_jobs[(m_next + i) % ZSTACK_PROVISION_JOBS];
+
+        switch (job->state)
+        {
+            case jobFree:
+                break;
+
+            case jobIdle:
+            {
+                bool pending = job->bind != 0;
+
+                for (uint8_t j = 0; j < ZSTACK_PROVISION_CLUSTERS; j++)
+                    pending |= job->report[j] != 0;
+
+                if (!pending)
+                {
+                    deviceStruct device;
+
+                    finished[count] = job->ieeeAddress;
+                    success[count++] = !job->failed;
+                    job->state = jobFree;
+
+                    while (m_backlogHead != m_backlogTail)
+                    {
+                        uint64_t ieeeAddress = m_backlog[m_backlogHead++ % ZSTACK_PROVISION_BACKLOG];
+
+                        if (!m_zstack->devices()->findByIeeeAddress(ieeeAddress, &device))
+                            continue;
+
+                        startJob(job, device.shortAddress, ieeeAddress);
+                        break;
+                    }
+
+                    break;
+                }
+
+                // one frame per interval in total, next time the following job gets its turn
+
+                if (sent || !sendFrame(job))
+                    break;
+
+                m_next = (m_next + i + 1) % ZSTACK_PROVISION_JOBS;
+                sent = true;
+                break;
+            }
+
+            default:
+
+                // request table reports its own timeout (held ones included), this one covers device response after confirm
+
+                if (!job->handle && now - job->time >= ZSTACK_REQUEST_TIMEOUT * 2)
+                    retryJob(job);
+
+                break;
+        }
+    }
+
+    m_mutex.unlock();
+
+    if (!m_callback)
+        return;
+
+    for (uint8_t i = 0; i < count; i++)
+        m_callback(finished[i], success[i]);
+}
+
+void ZStackProvisioning::provisionTask(void *data)
+{
+    ZStackProvisioning *provisioning = reinterpret_cast <ZStackProvisioning*> (data);
+
+    while (1)
+    {
+        zstackDelay(ZSTACK_PROVISION_INTERVAL);
+        provisioning->process();
+    }
+}
@@ -0,0 +1,102 @@
+#ifndef ZSTACK_PROVISIONING_H
+#define ZSTACK_PROVISIONING_H
+
+#include "ZCL.h"
+#include "ZStack.h"
+
+#define ZSTACK_PROVISION_JOBS                       16     // devices provisioned at the same time, more joiners wait for free job
+#define ZSTACK_PROVISION_CLUSTERS                   8      // clusters in profile, attributes per cluster are limited to 16
+#define ZSTACK_PROVISION_INTERVAL                   100    // ms between provisioning frames, spreads join bursts over the air
+#define ZSTACK_PROVISION_RETRIES                    3
+#define ZSTACK_PROVISION_BACKLOG                    128    // joined devices waiting for free job
+
+struct provisionAttributeStruct
+{
+    uint16_t attributeId;
+    uint8_t  dataType;
+    uint16_t minInterval;
+    uint16_t maxInterval;
+    uint32_t valueChange;
+};
+
+struct provisionClusterStruct
+{
+    uint16_t clusterId;
+    bool     bind;
+    uint8_t  attributeCount;
+    const provisionAttributeStruct *attributes;
+};
+
+struct provisionProfileStruct
+{
+    uint8_t  endpointId;
+    uint8_t  clusterCount;
+    const provisionClusterStruct *clusters;
+};
+
+typedef void (*ZStackProvisionCallback) (uint64_t ieeeAddress, bool success);
+
+// joined devices get binds and one configure reporting command per cluster with all its attributes,
+// only one frame per device is in flight and failed binds or attribute records are retried
+
+class ZStackProvisioning
+{
+    public:
+
+        ZStackProvisioning(ZStack *zstack, const provisionProfileStruct *profile, ZStackProvisionCallback callback = NULL, int8_t core = 0);
+
+        void deviceJoined(uint16_t shortAddress, uint64_t ieeeAddress);
+
+        // forward ZStack events here, request results and configure reporting responses are taken from them
+        void parseEvent(ZStackEvent event, void *data, size_t length);
+
+    private:
+
+        enum jobState
+        {
+            jobFree,
+            jobIdle,
+            jobBind,
+            jobReport
+        };
+
+        struct jobStruct
+        {
+            uint64_t ieeeAddress;
+            uint16_t shortAddress;
+            uint8_t  state;
+            uint8_t  bind;
+            uint16_t report[ZSTACK_PROVISION_CLUSTERS];
+            uint16_t sent;                                 // records of configure reporting in flight, the rest did not fit
+            uint16_t handle;
+            uint8_t  transactionId;
+            uint8_t  cluster;
+            uint8_t  retries;
+            bool     failed;
+            uint32_t time;
+        };
+
+        ZStack *m_zstack;
+        const provisionProfileStruct *m_profile;
+        ZStackProvisionCallback m_callback;
+
+        jobStruct m_jobs[ZSTACK_PROVISION_JOBS];
+        uint8_t m_next;
+
+        uint64_t m_backlog[ZSTACK_PROVISION_BACKLOG];
+        uint32_t m_backlogHead, m_backlogTail;
+
+        ZStackMutex m_mutex;
+
+        void startJob(jobStruct *job, uint16_t shortAddress, uint64_t ieeeAddress);
+        void parseResponse(incomingMessageStruct *message, uint8_t *data, size_t length);
+        void requestFinished(ZStackEvent event, requestStatusStruct *status);
+        void retryJob(jobStruct *job);
+        bool sendFrame(jobStruct *job);
+        void process(void);
+
+        static void provisionTask(void *data);
+
+};
+
+#endif
@@ -0,0 +1,307 @@
+#include "ZStackReader.h"
+
+ZStackReader::ZStackReader(ZStack *zstack, int8_t core) : m_zstack(zstack)
+{
+    memset(m_targets, 0, sizeof(m_targets));
+    zstackCreateTask(readTask, "ZStack Reader", 4096, this, 1, core);
+}
+
+bool ZStackReader::read(uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, const uint16_t *attributes, uint8_t count, ZStackReadCallback callback, void *context)
+{
+    targetStruct *target;
+    batchStruct *batch;
+
+    if (!count || count > ZSTACK_READ_ATTRIBUTES || !callback)
+        return false;
+
+    m_mutex.lock();
+
+    if (!(target = findTarget(shortAddress, endpointId, clusterId, true)))
+    {
+        m_mutex.unlock();
+        return false;
+    }
+
+    // join command in flight when it already asks for everything, otherwise wait for next one
+
+    batch = target->busy && target->sent.waiterCount < ZSTACK_READ_WAITERS && contains(&target->sent, attributes, count) ? &target->sent : &target->pending;
+
+    if (batch->waiterCount == ZSTACK_READ_WAITERS || (batch == &target->pending && !merge(batch, attributes, count)))
+    {
+        m_mutex.unlock();
+        return false;
+    }
+
+    batch->waiters[batch->waiterCount++] = {callback, context};
+    m_mutex.unlock();
+    return true;
+}
+
+void ZStackReader::parseEvent(ZStackEvent event, void *data, size_t length)
+{
+    switch (event)
+    {
+        case ZStackEvent::requestFailed:
+        case ZStackEvent::requestFinished:
+        case ZStackEvent::requestTimeout:
+            requestFinished(event, reinterpret_cast <requestStatusStruct*> (data));
+            break;
+
+        case ZStackEvent::messageReceived:
+        {
+            incomingMessageStruct *message = reinterpret_cast <incomingMessageStruct*> (data);
+
+            if (length >= sizeof(incomingMessageStruct) + sizeof(zclHeader))
+                parseResponse(message, reinterpret_cast <uint8_t*> (data) + sizeof(incomingMessageStruct), message->length);
+
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+ZStackReader::targetStruct *ZStackReader::findTarget(uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, bool allocate)
+{
+    targetStruct *free = NULL;
+
+    for (uint8_t i = 0; i < ZSTACK_READ_TARGETS; i++)
+    {
+        targetStruct *target = &m_targets[i];
+
+        if (!target->busy && !target->pending.waiterCount)
+        {
+            if (!free)
+                free = target;
+
+            continue;
+        }
+
+        if (target->shortAddress == shortAddress && target->endpointId == endpointId && target->clusterId == clusterId)
+            return target;
+    }
+
+    if (!allocate || !free)
+        return NULL;
+
+    memset(free, 0, sizeof(targetStruct));
+    free->shortAddress = shortAddress;
+    free->endpointId = endpointId;
+    free->clusterId = clusterId;
+    return free;
+}
+
+void ZStackReader::parseResponse(incomingMessageStruct *message, uint8_t *data, size_t length)
+{
+    uint8_t frameControl = data[0], transactionId, commandId, *payload;
+    size_t size;
+
+    if (frameControl & FC_CLUSTER_SPECIFIC)
+        return;
+
+    if (frameControl & FC_MANUFACTURER_SPECIFIC)
+    {
+        if (length < 5)
+            return;
+
+        transactionId = data[3];
+        commandId = data[4];
+        payload = data + 5;
+        size = length - 5;
+    }
+    else
+    {
+        transactionId = data[1];
+        commandId = data[2];
+        payload = data + 3;
+        size = length - 3;
+    }
+
+    // device without the cluster answers with default response instead
+
+    if (commandId != CMD_READ_ATTRIBUTES_RESPONSE && (commandId != CMD_DEFAULT_RESPONSE || size < 2 || payload[0] != CMD_READ_ATTRIBUTES))
+        return;
+
+    m_mutex.lock();
+
+    for (uint8_t i = 0; i < ZSTACK_READ_TARGETS; i++)
+    {
+        targetStruct *target = &m_targets[i];
+
+        if (!target->busy || target->transactionId != transactionId || target->shortAddress != message->srcAddress || target->endpointId != message->srcEndpointId || target->clusterId != message->clusterId)
+            continue;
+
+        if (commandId == CMD_DEFAULT_RESPONSE)
+            finish(target, payload[1] != STATUS_SUCCESS ? payload[1] : STATUS_FAILURE, NULL, 0);
+        else
+            finish(target, STATUS_SUCCESS, payload, size);
+
+        return;
+    }
+
+    m_mutex.unlock();
+}
+
+void ZStackReader::requestFinished(ZStackEvent event, requestStatusStruct *status)
+{
+    m_mutex.lock();
+
+    for (uint8_t i = 0; i < ZSTACK_READ_TARGETS; i++)
+    {
+        targetStruct *target = &m_targets[i];
+
+        if (!target->busy || !status->handle || target->handle != status->handle)
+            continue;
+
+        if (status->status || event != ZStackEvent::requestFinished)
+        {
+            finish(target, STATUS_TIMEOUT, NULL, 0);
+            return;
+        }
+
+        // confirmed request still waits for device response
+
+        target->handle = 0;
+        target->time = zstackMillis();
+        break;
+    }
+
+    m_mutex.unlock();
+}
+
+void ZStackReader::finish(targetStruct *target, uint8_t status, const uint8_t *data, size_t length)
+{
+    readResultStruct result = {target->shortAddress, target->endpointId, target->clusterId, status, data, length};
+    batchStruct batch = target->sent;
+
+    // called with mutex locked, it is released before callbacks, so they can issue next reads
+
+    target->busy = false;
+    target->handle = 0;
+    target->sent.attributeCount = 0;
+    target->sent.waiterCount = 0;
+
+    m_mutex.unlock();
+
+    for (uint8_t i = 0; i < batch.waiterCount; i++)
+        batch.waiters[i].callback(&result, batch.waiters[i].context);
+}
+
+bool ZStackReader::sendFrame(targetStruct *target)
+{
+    uint8_t buffer[sizeof(zclHeader) + ZSTACK_READ_ATTRIBUTES * 2];
+    zclHeader header;
+    size_t length = sizeof(header);
+
+    header.frameControl = 0x00;
+    header.transationId = m_zstack->transactionId();
+    header.commandId = CMD_READ_ATTRIBUTES;
+
+    memcpy(buffer, &header, sizeof(header));
+
+    for (uint8_t i = 0; i < target->pending.attributeCount; i++)
+    {
+        buffer[length++] = static_cast <uint8_t> (target->pending.attributes[i]);
+        buffer[length++] = static_cast <uint8_t> (target->pending.attributes[i] >> 8);
+    }
+
+    if (!(target->handle = m_zstack->dataRequest(header.transationId, target->shortAddress, target->endpointId, target->clusterId, buffer, length)))
+        return false;
+
+    target->sent = target->pending;
+    target->pending.attributeCount = 0;
+    target->pending.waiterCount = 0;
+
+    target->busy = true;
+    target->transactionId = header.transationId;
+    target->time = zstackMillis();
+    return true;
+}
+
+void ZStackReader::process(void)
+{
+    uint32_t now = zstackMillis();
+
+    m_mutex.lock();
+
+    for (uint8_t i = 0; i < ZSTACK_READ_TARGETS; i++)
+    {
+        targetStruct *target = &m_targets[i];
+
+        if (!target->busy)
+        {
+            if (target->pending.waiterCount)
+                sendFrame(target);
+
+            continue;
+        }
+
+        // request table reports its own timeout (held ones included), this one covers device response after confirm
+
+        if (target->handle || now - target->time < ZSTACK_REQUEST_TIMEOUT * 2)
+            continue;
+
+        finish(target, STATUS_TIMEOUT, NULL, 0);
+        m_mutex.lock();
+    }
+
+    m_mutex.unlock();
+}
+
+bool ZStackReader::contains(const batchStruct *batch, const uint16_t *attributes, uint8_t count)
+{
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint8_t j = 0;
+
+        while (j < batch->attributeCount && batch->attributes[j] != attributes[i])
+            j++;
+
+        if (j == batch->attributeCount)
+            return false;
+    }
+
+    return true;
+}
+
+bool ZStackReader::merge(batchStruct *batch, const uint16_t *attributes, uint8_t count)
+{
+    uint16_t merged[ZSTACK_READ_ATTRIBUTES];
+    uint8_t total = batch->attributeCount;
+
+    // nothing is changed when the union does not fit into one command
+
+    memcpy(merged, batch->attributes, sizeof(merged));
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+        uint8_t j = 0;
+
+        while (j < total && merged[j] != attributes[i])
+            j++;
+
+        if (j < total)
+            continue;
+
+        if (total == ZSTACK_READ_ATTRIBUTES)
+            return false;
+
+        merged[total++] = attributes[i];
+    }
+
+    memcpy(batch->attributes, merged, sizeof(merged));
+    batch->attributeCount = total;
+    return true;
+}
+
+void ZStackReader::readTask(void *data)
+{
+    ZStackReader *reader = reinterpret_cast <ZStackReader*> (data);
+
+    while (1)
+    {
+        zstackDelay(ZSTACK_READ_INTERVAL);
+        reader->process();
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef ZSTACK_READER_H
+#define ZSTACK_READER_H
+
+#include "ZCL.h"
+#include "ZStack.h"
+
+#define ZSTACK_READ_TARGETS                         16     // device, endpoint and cluster combinations read at the same time
+#define ZSTACK_READ_ATTRIBUTES                      16     // attributes in one read attributes command
+#define ZSTACK_READ_WAITERS                         4      // callers sharing one command
+#define ZSTACK_READ_INTERVAL                        20     // ms, reads for the same target issued within it go out as one command
+
+struct readResultStruct
+{
+    uint16_t shortAddress;
+    uint8_t  endpointId;
+    uint16_t clusterId;
+    uint8_t  status;                                       // ZCL status, request failure or missing response is reported as timeout
+    const uint8_t *data;                                   // read attributes response records, iterate them with ZCLAttributes
+    size_t   length;
+};
+
+typedef void (*ZStackReadCallback) (const readResultStruct *result, void *context);
+
+// pending attribute ids of one target are packed into one read attributes command, reads of attributes already
+// in flight share that command, so every caller gets the same response records and filters its own attributes
+//
+// callbacks run in ZStack event task on response, or in reader task on timeout, without reader lock held
+
+class ZStackReader
+{
+    public:
+
+        ZStackReader(ZStack *zstack, int8_t core = 0);
+
+        bool read(uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, const uint16_t *attributes, uint8_t count, ZStackReadCallback callback, void *context = NULL);
+
+        // forward ZStack events here, request results and read attributes responses are taken from them
+        void parseEvent(ZStackEvent event, void *data, size_t length);
+
+    private:
+
+        struct waiterStruct
+        {
+            ZStackReadCallback callback;
+            void *context;
+        };
+
+        struct batchStruct
+        {
+            uint16_t attributes[ZSTACK_READ_ATTRIBUTES];
+            uint8_t  attributeCount;
+            waiterStruct waiters[ZSTACK_READ_WAITERS];
+            uint8_t  waiterCount;
+        };
+
+        struct targetStruct
+        {
+            uint16_t shortAddress;
+            uint8_t  endpointId;
+            uint16_t clusterId;
+            bool     busy;
+            uint16_t handle;
+            uint8_t  transactionId;
+            uint32_t time;
+            batchStruct sent, pending;
+        };
+
+        ZStack *m_zstack;
+        targetStruct m_targets[ZSTACK_READ_TARGETS];
+        ZStackMutex m_mutex;
+
+        targetStruct *findTarget(uint16_t shortAddress, uint8_t endpointId, uint16_t clusterId, bool allocate);
+        void parseResponse(incomingMessageStruct *message, uint8_t *data, size_t length);
+        void requestFinished(ZStackEvent event, requestStatusStruct *status);
+        void finish(targetStruct *target, uint8_t status, const uint8_t *data, size_t length);
+        bool sendFrame(targetStruct *target);
+        void process(void);
+
+        static bool contains(const batchStruct *batch, const uint16_t *attributes, uint8_t count);
+        static bool merge(batchStruct *batch, const uint16_t *attributes, uint8_t count);
+        static void readTask(void *data);
+
+};
+
+#endif
@@ -0,0 +1,119 @@
+#include "ZStack.h"
+#include "ZStackRoutes.h"
+
+ZStackRoutes::ZStackRoutes(void)
+{
+    memset(m_routes, 0, sizeof(m_routes));
+}
+
+void ZStackRoutes::record(uint16_t shortAddress, const uint8_t *relays, uint8_t count)
+{
+    routeStruct *route;
+
+    m_mutex.lock();
+
+    if (count > ZSTACK_ROUTE_RELAYS)
+    {
+        // stale shorter route must not be used any more
+
+        if ((route = findEntry(shortAddress, false)))
+            route->state = routeUnknown;
+
+        m_mutex.unlock();
+        return;
+    }
+
+    route = findEntry(shortAddress, true);
+    route->state = routeSource;
+    route->relayCount = count;
+    route->time = zstackMillis();
+    memcpy(route->relays, relays, count * sizeof(uint16_t));
+
+    m_mutex.unlock();
+}
+
+void ZStackRoutes::delivered(uint16_t shortAddress, uint8_t status)
+{
+    routeStruct *route;
+
+    m_mutex.lock();
+
+    switch (status)
+    {
+        case ZSTATUS_SUCCESS:
+
+            // delivery over source route confirms the relay list too
+
+            route = findEntry(shortAddress, true);
+
+            if (route->state != routeSource)
+                route->state = routeDirect;
+
+            route->time = zstackMillis();
+            break;
+
+        case ZSTATUS_APS_NO_ACK:
+        case ZSTATUS_NWK_NO_ROUTE:
+        case ZSTATUS_MAC_NO_ACK:
+        case ZSTATUS_TIMEOUT:
+
+            if ((route = findEntry(shortAddress, false)))
+                route->state = routeFailed;
+
+            break;
+    }
+
+    m_mutex.unlock();
+}
+
+void ZStackRoutes::remove(uint16_t shortAddress)
+{
+    routeStruct *route;
+
+    m_mutex.lock();
+
+    if ((route = findEntry(shortAddress, false)))
+        route->state = routeUnknown;
+
+    m_mutex.unlock();
+}
+
+ZStackRouteState ZStackRoutes::find(uint16_t shortAddress, routeStruct *route)
+{
+    routeStruct *entry;
+    ZStackRouteState state = routeUnknown;
+
+    m_mutex.lock();
+
+    if ((entry = findEntry(shortAddress, false)) && zstackMillis() - entry->time < ZSTACK_ROUTE_EXPIRY)
+    {
+        *route = *entry;
+        state = static_cast <ZStackRouteState> (entry->state);
+    }
+
+    m_mutex.unlock();
+    return state;
+}
+
+routeStruct *ZStackRoutes::findEntry(uint16_t shortAddress, bool create)
+{
+    routeStruct *set = &m_routes[(static_cast <uint16_t> (shortAddress * 40503U) >> (16 - ZSTACK_ROUTE_CACHE_BITS)) * 2], *entry;
+
+    for (uint8_t i = 0; i < 2; i++)
+        if (set[i].state != routeUnknown && set[i].shortAddress == shortAddress)
+            return &set[i];
+
+    if (!create)
+        return NULL;
+
+    // free entry first, otherwise the one updated longer ago
+
+    if (set[0].state == routeUnknown || (set[1].state != routeUnknown && static_cast <int32_t> (set[0].time - set[1].time) < 0))
+        entry = &set[0];
+    else
+        entry = &set[1];
+
+    memset(entry, 0, sizeof(routeStruct));
+    entry->shortAddress = shortAddress;
+    return entry;
+}
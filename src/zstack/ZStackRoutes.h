@@ -0,0 +1,54 @@
+#ifndef ZSTACK_ROUTES_H
+#define ZSTACK_ROUTES_H
+
+#include "ZStackPlatform.h"
+
+#define ZSTACK_ROUTE_CACHE_BITS                     7      // cache has 2 << bits entries in two-way sets
+#define ZSTACK_ROUTE_RELAYS                         8      // longer source routes are not cached, ZNP finds those itself
+#define ZSTACK_ROUTE_EXPIRY                         300000 // ms route record or delivery is trusted, concentrator discovery refreshes records before it
+
+enum ZStackRouteState
+{
+    routeUnknown,                                   // nothing known or too old, request asks for route discovery
+    routeDirect,                                    // last request was delivered, ZNP routing table has the route
+    routeSource,                                    // route record received, request carries the relay list
+    routeFailed                                     // last request failed on the way, route discovery again
+};
+
+struct routeStruct
+{
+    uint16_t shortAddress;
+    uint8_t  state;
+    uint8_t  relayCount;
+    uint16_t relays[ZSTACK_ROUTE_RELAYS];           // as reported by route record indication, passed back to ZNP unchanged
+    uint32_t time;
+};
+
+// coordinator side route state of recent destinations, fed by route record indications (many-to-one routing)
+// and data confirms, so route discovery broadcasts are asked for only when no working route is known
+//
+// each destination maps to one set of two entries, new one replaces the least recently updated of them
+
+class ZStackRoutes
+{
+    public:
+
+        ZStackRoutes(void);
+
+        void record(uint16_t shortAddress, const uint8_t *relays, uint8_t count);
+        void delivered(uint16_t shortAddress, uint8_t status);
+        void remove(uint16_t shortAddress);
+
+        // expired entries are reported as unknown
+        ZStackRouteState find(uint16_t shortAddress, routeStruct *route);
+
+    private:
+
+        routeStruct m_routes[2 << ZSTACK_ROUTE_CACHE_BITS];
+        ZStackMutex m_mutex;
+
+        routeStruct *findEntry(uint16_t shortAddress, bool create);
+
+};
+
+#endif
@@ -0,0 +1,160 @@
+#include "ZStackShards.h"
+
+ZStackShards::ZStackShards(ZStack **instances, uint8_t count) : m_count(count > ZSTACK_SHARD_COUNT ? ZSTACK_SHARD_COUNT : count), m_permit(false), m_joinInstance(-1)
+{
+    for (uint8_t i = 0; i < m_count; i++)
+    {
+        m_instances[i] = instances[i];
+        m_ready[i] = false;
+    }
+}
+
+void ZStackShards::permitJoin(bool permit)
+{
+    m_mutex.lock();
+    m_permit = permit;
+    updateJoin();
+    m_mutex.unlock();
+}
+
+void ZStackShards::parseEvent(ZStack *zstack, ZStackEvent event, void *, size_t)
+{
+    uint8_t i = index(zstack);
+
+    if (i >= m_count)
+        return;
+
+    m_mutex.lock();
+
+    switch (event)
+    {
+        case ZStackEvent::coordinatorReady:
+        {
+            // restarted coordinator does not keep permit join, so it is sent again if this instance is still the least loaded
+            m_ready[i] = true;
+
+            if (m_joinInstance == i)
+                m_joinInstance = -1;
+
+            updateJoin();
+            break;
+        }
+
+        case ZStackEvent::resetDetected:
+        case ZStackEvent::coordinatorFailed:
+        {
+            m_ready[i] = false;
+
+            if (m_joinInstance == i)
+                m_joinInstance = -1;
+
+            updateJoin();
+            break;
+        }
+
+        case ZStackEvent::deviceJoinedNetwork:
+        case ZStackEvent::deviceLeftNetwork:
+        {
+            updateJoin();
+            break;
+        }
+
+        default:
+            break;
+    }
+
+    m_mutex.unlock();
+}
+
+ZStack *ZStackShards::find(uint64_t ieeeAddress)
+{
+    ZStack *zstack = NULL;
+    uint32_t now = zstackMillis(), age = 0;
+
+    for (uint8_t i = 0; i < m_count; i++)
+    {
+        deviceStruct device;
+
+        if (!m_instances[i]->devices()->findByIeeeAddress(ieeeAddress, &device) || (zstack && now - device.lastSeen >= age))
+            continue;
+
+        zstack = m_instances[i];
+        age = now - device.lastSeen;
+    }
+
+    return zstack;
+}
+
+uint16_t ZStackShards::dataRequest(uint64_t ieeeAddress, uint8_t endpointId, uint16_t clusterId, uint8_t *data, size_t length, ZStack **instance)
+{
+    ZStack *zstack = find(ieeeAddress);
+
+    if (instance)
+        *instance = zstack;
+
+    return zstack ? zstack->dataRequest(zstack->transactionId(), ieeeAddress, endpointId, clusterId, data, length) : 0;
+}
+
+uint16_t ZStackShards::bindRequest(uint64_t ieeeAddress, uint8_t endpointId, uint16_t clusterId, ZStack **instance)
+{
+    ZStack *zstack = find(ieeeAddress);
+
+    if (instance)
+        *instance = zstack;
+
+    return zstack ? zstack->bindRequest(ieeeAddress, endpointId, clusterId) : 0;
+}
+
+uint8_t ZStackShards::index(ZStack *zstack)
+{
+    uint8_t i = 0;
+
+    while (i < m_count && m_instances[i] != zstack)
+        i++;
+
+    return i;
+}
+
+int8_t ZStackShards::joinInstance(void)
+{
+    return m_joinInstance;
+}
+
+int8_t ZStackShards::leastLoaded(void)
+{
+    int8_t result = -1;
+    size_t load = 0;
+
+    for (uint8_t i = 0; i < m_count; i++)
+    {
+        size_t count = m_instances[i]->devices()->count();
+
+        if (!m_ready[i])
+            continue;
+
+        // ties stay on the current join instance, so permit join does not bounce between equal networks
+        if (result < 0 || count < load || (count == load && i == m_joinInstance))
+        {
+            result = i;
+            load = count;
+        }
+    }
+
+    return result;
+}
+
+void ZStackShards::updateJoin(void)
+{
+    int8_t target = m_permit ? leastLoaded() : -1;
+
+    if (target == m_joinInstance)
+        return;
+
+    if (m_joinInstance >= 0)
+        m_instances[m_joinInstance]->permitJoin(false);
+
+    if (target >= 0)
+        m_instances[target]->permitJoin(true);
+
+    m_joinInstance = target;
+}
@@ -0,0 +1,47 @@
+#ifndef ZSTACK_SHARDS_H
+#define ZSTACK_SHARDS_H
+
+#include "ZStack.h"
+
+#define ZSTACK_SHARD_COUNT                          4      // coordinators one shard layer can spread devices over
+
+// several coordinators (own port, channel and PAN ID each) used as one network: join is permitted
+// on the instance with the fewest known devices only, outbound requests go to the instance the device is on
+//
+// application forwards every ZStack event here, so the layer sees joins, leaves and coordinator restarts
+
+class ZStackShards
+{
+    public:
+
+        ZStackShards(ZStack **instances, uint8_t count);
+
+        void permitJoin(bool permit);
+        void parseEvent(ZStack *zstack, ZStackEvent event, void *data, size_t length);
+
+        // instance device is joined to, most recently seen one if device moved between networks, NULL if unknown
+        ZStack *find(uint64_t ieeeAddress);
+
+        // same requests as ZStack ones routed by device address, 0 if device is unknown or request queue is full
+        uint16_t dataRequest(uint64_t ieeeAddress, uint8_t endpointId, uint16_t clusterId, uint8_t *data, size_t length, ZStack **instance = NULL);
+        uint16_t bindRequest(uint64_t ieeeAddress, uint8_t endpointId, uint16_t clusterId, ZStack **instance = NULL);
+
+        uint8_t index(ZStack *zstack);
+        int8_t joinInstance(void);
+
+    private:
+
+        ZStack *m_instances[ZSTACK_SHARD_COUNT];
+        bool m_ready[ZSTACK_SHARD_COUNT];
+        uint8_t m_count;
+
+        bool m_permit;
+        int8_t m_joinInstance;
+        ZStackMutex m_mutex;
+
+        int8_t leastLoaded(void);
+        void updateJoin(void);
+
+};
+
+#endif
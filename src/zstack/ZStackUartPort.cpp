@@ -0,0 +1,77 @@
+#ifdef ARDUINO
+
+#include "ZStackUartPort.h"
+
+ZStackUartPort::ZStackUartPort(uart_port_t uart, int8_t bslPin, int8_t rstPin, int8_t rxPin, int8_t txPin, uint32_t baudRate, int8_t rtsPin, int8_t ctsPin) : m_uart(uart), m_queue(NULL), m_bslPin(bslPin), m_rstPin(rstPin), m_rxPin(rxPin), m_txPin(txPin), m_rtsPin(rtsPin), m_ctsPin(ctsPin), m_baudRate(baudRate) {}
+
+bool ZStackUartPort::begin(void)
+{
+    uart_config_t config;
+
+    pinMode(m_bslPin, OUTPUT);
+    pinMode(m_rstPin, OUTPUT);
+
+    digitalWrite(m_bslPin, HIGH);
+
+    memset(&config, 0, sizeof(config));
+
+    config.baud_rate = m_baudRate;
+    config.data_bits = UART_DATA_8_BITS;
+    config.parity = UART_PARITY_DISABLE;
+    config.stop_bits = UART_STOP_BITS_1;
+    config.flow_ctrl = m_rtsPin >= 0 && m_ctsPin >= 0 ? UART_HW_FLOWCTRL_CTS_RTS : UART_HW_FLOWCTRL_DISABLE;
+    config.rx_flow_ctrl_thresh = ZSTACK_UART_RTS_THRESHOLD;
+
+    if (uart_driver_install(m_uart, ZSTACK_UART_RX_BUFFER_SIZE, 0, ZSTACK_UART_EVENT_QUEUE_LENGTH, &m_queue, 0) != ESP_OK)
+        return false;
+
+    if (uart_param_config(m_uart, &config) != ESP_OK || uart_set_pin(m_uart, m_txPin, m_rxPin, config.flow_ctrl ? m_rtsPin : UART_PIN_NO_CHANGE, config.flow_ctrl ? m_ctsPin : UART_PIN_NO_CHANGE) != ESP_OK)
+        return false;
+
+    return uart_set_rx_timeout(m_uart, ZSTACK_UART_RX_TIMEOUT) == ESP_OK;
+}
+
+size_t ZStackUartPort::read(uint8_t *buffer, size_t length, uint32_t timeout)
+{
+    while (1)
+    {
+        uart_event_t event;
+        size_t available = 0;
+        int result;
+
+        uart_get_buffered_data_len(m_uart, &available);
+
+        if (available)
+        {
+            result = uart_read_bytes(m_uart, buffer, available < length ? available : length, 0);
+            return result > 0 ? static_cast <size_t> (result) : 0;
+        }
+
+        // sleep until driver reports rx fifo threshold or rx timeout, no polling here
+
+        if (xQueueReceive(m_queue, &event, timeout == ZSTACK_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(timeout)) != pdTRUE)
+            return 0;
+
+        if (event.type != UART_FIFO_OVF && event.type != UART_BUFFER_FULL)
+            continue;
+
+        uart_flush_input(m_uart);
+        xQueueReset(m_queue);
+    }
+}
+
+size_t ZStackUartPort::write(const uint8_t *buffer, size_t length)
+{
+    int result = uart_write_bytes(m_uart, reinterpret_cast <const char*> (buffer), length);
+    return result > 0 ? static_cast <size_t> (result) : 0;
+}
+
+bool ZStackUartPort::reset(void)
+{
+    digitalWrite(m_rstPin, LOW);
+    delay(10);
+    digitalWrite(m_rstPin, HIGH);
+    return true;
+}
+
+#endif
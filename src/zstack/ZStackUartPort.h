@@ -0,0 +1,38 @@
+#ifndef ZSTACK_UART_PORT_H
+#define ZSTACK_UART_PORT_H
+
+#ifdef ARDUINO
+
+#include "driver/uart.h"
+#include "ZStackPort.h"
+
+#define ZSTACK_UART_RX_BUFFER_SIZE                  2048   // driver buffer, holds input while the parser is busy with callbacks
+#define ZSTACK_UART_EVENT_QUEUE_LENGTH              16
+#define ZSTACK_UART_RX_TIMEOUT                      3      // idle symbols before rx timeout event, ~260 us at 115200
+#define ZSTACK_UART_BAUD_RATE                       115200 // default ZNP firmware speed
+#define ZSTACK_UART_RTS_THRESHOLD                   100    // rx fifo level (of 128) where RTS is deasserted
+
+class ZStackUartPort : public ZStackPort
+{
+    public:
+
+        // baud rate must match ZNP firmware, RTS/CTS flow control is enabled when both pins are set
+        ZStackUartPort(uart_port_t uart, int8_t bslPin, int8_t rstPin, int8_t rxPin, int8_t txPin, uint32_t baudRate = ZSTACK_UART_BAUD_RATE, int8_t rtsPin = -1, int8_t ctsPin = -1);
+
+        bool begin(void) override;
+        size_t read(uint8_t *buffer, size_t length, uint32_t timeout) override;
+        size_t write(const uint8_t *buffer, size_t length) override;
+        bool reset(void) override;
+
+    private:
+
+        uart_port_t m_uart;
+        QueueHandle_t m_queue;
+        int8_t m_bslPin, m_rstPin, m_rxPin, m_txPin, m_rtsPin, m_ctsPin;
+        uint32_t m_baudRate;
+
+};
+
+#endif
+
+#endif